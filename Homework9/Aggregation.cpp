@@ -0,0 +1,325 @@
+/*
+ * Implementation of aggregate functions and group by.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <algorithm>
+#include <charconv>
+#include "Aggregation.h"
+
+/**
+ * Helper method to apply an aggregate function to the matching rows of a
+ * segment. This is the inner loop of an aggregation; the function is a
+ * lambda so that it is inlined into the loop.
+ *
+ * @param col The column to which the function applies.
+ *
+ * @param rows The matching rows in the segment.
+ *
+ * @param groupOf The group of each of the rows.
+ *
+ * @param groups The groups in the partial result.
+ *
+ * @param item The index of the function in the select list.
+ *
+ * @param op The function that updates an accumulator with a value.
+ */
+template <typename Op>
+static void
+forEachRow(const Column& col, const RowList& rows,
+           const std::vector<uint32_t>& groupOf,
+           std::vector<Aggregation::Group>& groups, const size_t item,
+           Op op) {
+    for (size_t i = 0; (i < rows.size()); i++) {
+        op(groups[groupOf[i]].accs[item], col.at(rows[i]));
+    }
+}
+
+/**
+ * Helper method to add a number to a string, in the shortest form that
+ * reads back as the same number.
+ *
+ * @param out The string to which the number is added.
+ *
+ * @param num The number to be added.
+ */
+static void
+appendNumber(std::string& out, const double num) {
+    char buf[32];
+    const auto result = std::to_chars(buf, buf + sizeof(buf), num);
+    out.append(buf, result.ptr);
+}
+
+bool
+Aggregation::toFunction(const std::string& name, Function& func) {
+    if (name == "count") {
+        func = Count;
+    } else if (name == "sum") {
+        func = Sum;
+    } else if (name == "avg") {
+        func = Avg;
+    } else if (name == "min") {
+        func = Min;
+    } else if (name == "max") {
+        func = Max;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Aggregation::Aggregation(const std::vector<Item>& items,
+                         const std::vector<int>& groupCols,
+                         const std::vector<ColumnType>& types) :
+    items(items), groupCols(groupCols), types(types) {
+}
+
+uint32_t
+Aggregation::findGroup(Partial& partial, const std::string& key,
+                       const RowId id) const {
+    const auto entry = partial.index.find(key);
+    if (entry != partial.index.end()) {
+        return entry->second;
+    }
+    // A new group. Split the key into the values of the group by columns.
+    Group group;
+    group.first = id;
+    for (size_t start = 0, end; (group.values.size() < groupCols.size());
+         start = end + 1) {
+        end = std::min(key.find('\0', start), key.size());
+        group.values.push_back(key.substr(start, end - start));
+    }
+    group.accs.resize(items.size());
+    partial.groups.push_back(std::move(group));
+    return partial.index[key] = partial.groups.size() - 1;
+}
+
+void
+Aggregation::add(const Segment& seg, const size_t segIdx,
+                 const RowList& rows, Partial& partial) const {
+    // First assign each row to its group. Without a group by clause all
+    // the rows are in one group.
+    std::vector<uint32_t> groupOf(rows.size(), 0);
+    if (groupCols.empty() && !rows.empty()) {
+        findGroup(partial, "", ColumnStore::toRowId(segIdx, rows[0]));
+    } else {
+        std::string key;
+        for (size_t i = 0; (i < rows.size()); i++) {
+            key.clear();
+            for (size_t g = 0; (g < groupCols.size()); g++) {
+                if (g > 0) {
+                    key += '\0';
+                }
+                key += seg.cols[groupCols[g]].at(rows[i]);
+            }
+            groupOf[i] = findGroup(partial, key,
+                                   ColumnStore::toRowId(segIdx, rows[i]));
+        }
+    }
+    // Now compute the aggregates one column at a time.
+    std::vector<Group>& groups = partial.groups;
+    for (size_t item = 0; (item < items.size()); item++) {
+        const Function func = items[item].func;
+        if (func == Value) {
+            continue;  // Values of group by columns are in the group.
+        } else if (items[item].colIdx == -1) {
+            for (size_t i = 0; (i < rows.size()); i++) {  // count(*)
+                groups[groupOf[i]].accs[item].count++;
+            }
+            continue;
+        }
+        const Column& col = seg.cols[items[item].colIdx];
+        const ColumnType type = types[item];
+        const bool numeric = (type == ColumnType::Int ||
+                              type == ColumnType::Double);
+        if (func == Count) {
+            forEachRow(col, rows, groupOf, groups, item,
+                       [](Accumulator& acc, std::string_view val) {
+                           acc.count += !val.empty();
+                       });
+        } else if ((func == Sum || func == Avg) && type == ColumnType::Int) {
+            forEachRow(col, rows, groupOf, groups, item,
+                       [](Accumulator& acc, std::string_view val) {
+                           int64_t intVal;
+                           double num;
+                           if (Range::toInt(val, intVal)) {
+                               acc.intSum += intVal;
+                               acc.count++;
+                           } else if (Range::toDouble(val, num)) {
+                               acc.sum += num;
+                               acc.count++;
+                           }
+                       });
+        } else if (func == Sum || func == Avg) {
+            forEachRow(col, rows, groupOf, groups, item,
+                       [](Accumulator& acc, std::string_view val) {
+                           double num;
+                           if (Range::toDouble(val, num)) {
+                               acc.sum += num;
+                               acc.count++;
+                           }
+                       });
+        } else if (numeric) {
+            const bool isMin = (func == Min);
+            forEachRow(col, rows, groupOf, groups, item,
+                       [isMin](Accumulator& acc, std::string_view val) {
+                           double num;
+                           if (Range::toDouble(val, num) &&
+                               (acc.count++ == 0 ||
+                                (isMin ? num < acc.num : num > acc.num))) {
+                               acc.num = num;
+                               acc.text.assign(val);
+                           }
+                       });
+        } else {
+            const bool isMin = (func == Min);
+            forEachRow(col, rows, groupOf, groups, item,
+                       [isMin](Accumulator& acc, std::string_view val) {
+                           if (!val.empty() &&
+                               (acc.count++ == 0 ||
+                                (isMin ? val < acc.text : val > acc.text))) {
+                               acc.text.assign(val);
+                           }
+                       });
+        }
+    }
+}
+
+void
+Aggregation::combine(const size_t item, Accumulator& into,
+                     Accumulator& from) const {
+    const Function func = items[item].func;
+    if (func == Min || func == Max) {
+        const bool numeric = (types[item] == ColumnType::Int ||
+                              types[item] == ColumnType::Double);
+        const bool isMin = (func == Min);
+        const bool better = numeric ?
+            (isMin ? from.num < into.num : from.num > into.num) :
+            (isMin ? from.text < into.text : from.text > into.text);
+        if (from.count > 0 && (into.count == 0 || better)) {
+            into.num = from.num;
+            into.text.swap(from.text);
+        }
+    }
+    into.count  += from.count;
+    into.intSum += from.intSum;
+    into.sum    += from.sum;
+}
+
+void
+Aggregation::merge(Partial& into, Partial& from) const {
+    std::string key;
+    for (Group& group : from.groups) {
+        key.clear();
+        for (size_t g = 0; (g < group.values.size()); g++) {
+            if (g > 0) {
+                key += '\0';
+            }
+            key += group.values[g];
+        }
+        const auto entry = into.index.find(key);
+        if (entry == into.index.end()) {
+            into.index.emplace(key, into.groups.size());
+            into.groups.push_back(std::move(group));
+            continue;
+        }
+        Group& dest = into.groups[entry->second];
+        dest.first = std::min(dest.first, group.first);
+        for (size_t item = 0; (item < items.size()); item++) {
+            combine(item, dest.accs[item], group.accs[item]);
+        }
+    }
+    from.groups.clear();
+    from.index.clear();
+}
+
+void
+Aggregation::writeHeader(std::string& out) const {
+    for (size_t item = 0; (item < items.size()); item++) {
+        out += (item > 0 ? "\t" : "") + items[item].name;
+    }
+    out += '\n';
+}
+
+int
+Aggregation::findItem(const std::string& name) const {
+    for (size_t item = 0; (item < items.size()); item++) {
+        if (items[item].name == name) {
+            return item;
+        }
+    }
+    return -1;
+}
+
+void
+Aggregation::writeItem(const Group& group, const size_t item,
+                       std::string& out) const {
+    const Accumulator& acc = group.accs[item];
+    switch (items[item].func) {
+    case Value:
+        out += group.values[std::find(groupCols.begin(), groupCols.end(),
+                                      items[item].colIdx) - groupCols.begin()];
+        break;
+    case Count:
+        out += std::to_string(acc.count);
+        break;
+    case Sum:
+        if (acc.count > 0 && acc.sum == 0) {
+            out += std::to_string(acc.intSum);  // An exact integer
+        } else if (acc.count > 0) {
+            appendNumber(out, acc.intSum + acc.sum);
+        }
+        break;
+    case Avg:
+        if (acc.count > 0) {
+            appendNumber(out, (acc.intSum + acc.sum) / acc.count);
+        }
+        break;
+    default:
+        out += acc.text;  // min or max
+    }
+}
+
+size_t
+Aggregation::write(const Partial& result, const OrderBy& order,
+                   std::string& out) const {
+    // If no rows matched there is still one line (e.g., a count of 0)
+    // without a group by clause.
+    const std::vector<Group> noRows{
+        Group{StrVec(), 0, std::vector<Accumulator>(items.size())}};
+    const bool empty = (result.groups.empty() && groupCols.empty());
+    const std::vector<Group>& groups = (empty ? noRows : result.groups);
+    // The groups are sorted with a bounded heap. Without an order by
+    // clause every key is "", so the groups are sorted by their first row,
+    // i.e., they are printed in table order (the segments may have been
+    // merged in any order).
+    const int sortItem = order.colIdx;
+    const Function sortFunc = (sortItem == -1 ? Value : items[sortItem].func);
+    const bool counted = (sortFunc == Count || sortFunc == Sum ||
+                          sortFunc == Avg);
+    TopK top(order.getNeeded(), (sortItem == -1) ? ColumnType::String :
+             (counted ? ColumnType::Double : types[sortItem]),
+             order.descending);
+    std::string line, key;
+    for (const Group& group : groups) {
+        line.clear();
+        for (size_t item = 0; (item < items.size()); item++) {
+            line += (item > 0 ? "\t" : "");
+            const size_t start = line.size();
+            writeItem(group, item, line);
+            if (int(item) == sortItem) {
+                key.assign(line, start, std::string::npos);
+            }
+        }
+        line += '\n';
+        if (top.accepts(key, group.first)) {
+            top.push(key, group.first, line);
+        }
+    }
+    const std::vector<TopK::Entry> entries = top.take();
+    for (size_t i = order.offset; (i < entries.size()); i++) {
+        out += entries[i].line;
+    }
+    return entries.size() - std::min(order.offset, entries.size());
+}
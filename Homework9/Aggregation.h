@@ -0,0 +1,216 @@
+#ifndef AGGREGATION_H
+#define AGGREGATION_H
+
+/*
+ * Aggregate functions (count, sum, avg, min, and max) over the rows that
+ * match a select statement, optionally grouped by the values of some
+ * columns, e.g.:
+ *
+ *     select country, count(*) from airports.csv group by country;
+ *
+ * The matching rows of each segment are aggregated into a partial result
+ * (on the thread that scanned the segment). Rows are assigned to groups
+ * via a hash table, and then each aggregate is computed one column at a
+ * time with a tight loop over the rows. The partial results of the
+ * segments are then merged into the final result.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "ColumnStore.h"
+#include "TopK.h"
+
+/**
+ * The aggregates in a select statement. The methods are const, so an
+ * aggregation can be used from many threads (each with its own Partial).
+ */
+class Aggregation {
+public:
+    /** The kinds of items in the select list of an aggregate query. Value
+     * is a plain column, which must be one of the group by columns.
+     */
+    enum Function { Value, Count, Sum, Avg, Min, Max };
+
+    /** An item in the select list, such as "avg(altitude)". */
+    struct Item {
+        /** The aggregate function (or Value for a plain column). */
+        Function func;
+        /** The column the function applies to. -1 for "count(*)". */
+        int colIdx;
+        /** The name of the item in the header of the output. */
+        std::string name;
+    };
+
+    /** The running state of one aggregate function for one group. */
+    struct Accumulator {
+        /** The number of rows (count(*)) or values aggregated. */
+        int64_t count = 0;
+        /** The sum of the integer values (for Int columns). */
+        int64_t intSum = 0;
+        /** The sum of the other numeric values. */
+        double sum = 0;
+        /** The smallest (or largest) numeric value seen so far. */
+        double num = 0;
+        /** The smallest (or largest) value seen so far, as it appears in
+         * the table.
+         */
+        std::string text;
+    };
+
+    /** A group of rows: the values of the group by columns and the state
+     * of each item in the select list.
+     */
+    struct Group {
+        StrVec values;
+        /** The first row in the group, to print groups in table order. */
+        RowId first;
+        std::vector<Accumulator> accs;
+    };
+
+    /** The (partial) result of an aggregation: the groups and a hash
+     * table to find them.
+     */
+    struct Partial {
+        std::vector<Group> groups;
+        std::unordered_map<std::string, uint32_t> index;
+    };
+
+    /**
+     * Obtain the aggregate function with a given name.
+     *
+     * @param name The name of the function, e.g., "count".
+     *
+     * @param func Set to the function, if there is one with the name.
+     *
+     * @return This method returns true if name is an aggregate function.
+     */
+    static bool toFunction(const std::string& name, Function& func);
+
+    /**
+     * Create an aggregation.
+     *
+     * @param items The items in the select list.
+     *
+     * @param groupCols The columns in the group by clause (may be empty).
+     *
+     * @param types The type of the column of each item (see
+     * ColumnStore::getColumnType). Sums are integers for Int columns, and
+     * min, max, and order by compare values as numbers in numeric
+     * columns.
+     */
+    Aggregation(const std::vector<Item>& items,
+                const std::vector<int>& groupCols,
+                const std::vector<ColumnType>& types);
+
+    /**
+     * Add the matching rows in a segment to a partial result. The caller
+     * must hold a lock on the segment.
+     *
+     * @param seg The segment that contains the rows.
+     *
+     * @param segIdx The index of the segment in the column store.
+     *
+     * @param rows The matching rows in the segment, in ascending order.
+     *
+     * @param partial The partial result to which the rows are added.
+     */
+    void add(const Segment& seg, const size_t segIdx, const RowList& rows,
+             Partial& partial) const;
+
+    /**
+     * Merge a partial result into another.
+     *
+     * @param into The result into which the groups are merged.
+     *
+     * @param from The result to be merged. It is left empty.
+     */
+    void merge(Partial& into, Partial& from) const;
+
+    /**
+     * Write the header (the names of the items in the select list).
+     *
+     * @param out The string to which the tab-separated names are added.
+     */
+    void writeHeader(std::string& out) const;
+
+    /**
+     * Obtain the index of an item in the select list.
+     *
+     * @param name The name of the item, e.g., "count(*)".
+     *
+     * @return The index of the item, or -1 if there is no such item.
+     */
+    int findItem(const std::string& name) const;
+
+    /**
+     * Write one line for each group in a result. The groups are printed in
+     * the order in which they first appear in the table, unless they are
+     * sorted by an item in the select list.
+     *
+     * @param result The merged result of all the segments.
+     *
+     * @param order The order by and limit clauses. The column is the index
+     * of an item (see findItem).
+     *
+     * @param out The string to which the lines are added.
+     *
+     * @return The number of lines written. Without a group by clause there
+     * is one group (even if no rows matched).
+     */
+    size_t write(const Partial& result, const OrderBy& order,
+                 std::string& out) const;
+
+private:
+    /**
+     * Helper method to write the value of an item for a group.
+     *
+     * @param group The group whose value is to be written.
+     *
+     * @param item The index of the item in the select list.
+     *
+     * @param out The string to which the value is added.
+     */
+    void writeItem(const Group& group, const size_t item,
+                   std::string& out) const;
+
+    /**
+     * Helper method to merge the state of an item from another group.
+     *
+     * @param item The index of the item in the select list.
+     *
+     * @param into The accumulator into which the state is merged.
+     *
+     * @param from The accumulator to be merged.
+     */
+    void combine(const size_t item, Accumulator& into,
+                 Accumulator& from) const;
+
+    /**
+     * Helper method to find (or add) a group in a partial result.
+     *
+     * @param partial The partial result.
+     *
+     * @param key The values of the group by columns, separated by '\0'.
+     *
+     * @param id The row that is in the group.
+     *
+     * @return The index of the group in partial.groups.
+     */
+    uint32_t findGroup(Partial& partial, const std::string& key,
+                       const RowId id) const;
+
+    /** The items in the select list. */
+    std::vector<Item> items;
+
+    /** The columns in the group by clause. */
+    std::vector<int> groupCols;
+
+    /** The type of the column of each item (String for counts). */
+    std::vector<ColumnType> types;
+};
+
+#endif /* AGGREGATION_H */
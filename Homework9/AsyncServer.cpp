@@ -0,0 +1,165 @@
+/*
+ * Implementation of the asynchronous web-server for SQLAir.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <unistd.h>
+#include <algorithm>
+#include <future>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "AsyncServer.h"
+#include "SQLAir.h"
+
+// Convenience namespace to streamline the code below.
+using namespace boost::asio;
+using namespace boost::asio::ip;
+
+AsyncServer::AsyncServer(SQLAir& air, tcp::acceptor& server) :
+    air(air), acceptor(ioc), acceptTimer(ioc),
+    numThreads(std::max(1u, std::thread::hardware_concurrency())),
+    queryPool(numThreads) {
+    // The acceptor set up by main is bound to a different io_context. So
+    // accept connections on a duplicate of its socket instead.
+    acceptor.assign(server.local_endpoint().protocol(),
+                    ::dup(server.native_handle()));
+}
+
+void
+AsyncServer::run() {
+    accept();
+    // Run the I/O on a fixed pool of threads, including this one.
+    std::vector<std::thread> threads;
+    for (unsigned int i = 1; (i < numThreads); i++) {
+        threads.emplace_back([this] { ioc.run(); });
+    }
+    ioc.run();
+    for (auto& thr : threads) {
+        thr.join();
+    }
+}
+
+void
+AsyncServer::accept() {
+    // Each connection gets its own strand so that its handlers (including
+    // the idle timer) never run concurrently.
+    acceptor.async_accept(make_strand(ioc),
+                          [this](const boost::system::error_code& ec,
+                                 tcp::socket socket) {
+        if (ec == error::operation_aborted) {
+            return;  // The acceptor was closed
+        }
+        if (ec == error::no_descriptors || ec == error::no_buffer_space ||
+            ec == error::no_memory ||
+            ec == boost::system::errc::too_many_files_open_in_system) {
+            // Accepting again right away would fail the same way. So wait
+            // for connections to be closed before trying again.
+            acceptTimer.expires_after(AcceptRetryDelay);
+            acceptTimer.async_wait([this](const boost::system::error_code&
+                                          ec) {
+                if (!ec) {
+                    accept();
+                }
+            });
+            return;
+        }
+        if (!ec) {
+            std::make_shared<Connection>(*this, std::move(socket))->start();
+        }
+        accept();  // Accept the next connection
+    });
+}
+
+//-------------------------------------------------------------------------
+
+void
+AsyncServer::Connection::closeWhenIdle() {
+    auto self = shared_from_this();
+    // The expiry is checked because the timer may fire just as the client
+    // does something.
+    timer.expires_after(SQLAir::IdleTimeout);
+    timer.async_wait([this, self](const boost::system::error_code& ec) {
+        if (!ec && timer.expiry() <= steady_timer::clock_type::now()) {
+            boost::system::error_code ignored;
+            socket.close(ignored);
+        }
+    });
+}
+
+void
+AsyncServer::Connection::start() {
+    auto self = shared_from_this();
+    // Close the connection if the client does not send a request in time.
+    closeWhenIdle();
+    // Read the request line and headers, which end with a blank line.
+    async_read_until(socket, request, "\r\n\r\n",
+        [this, self](const boost::system::error_code& ec, size_t len) {
+            // Queries may take a long time. So stop the idle timer.
+            timer.expires_at(steady_timer::time_point::max());
+            if (ec) {
+                return;  // Client went away. The connection is closed.
+            }
+            // Any pipelined requests after this one stay in the buffer
+            std::istringstream is(std::string(
+                buffers_begin(request.data()),
+                buffers_begin(request.data()) + len));
+            request.consume(len);
+            std::string req;
+            if (SQLAir::readRequest(is, req, keepAlive)) {
+                dispatch(req);
+            }
+        });
+}
+
+void
+AsyncServer::Connection::dispatch(const std::string& req,
+                                  std::shared_ptr<ParkedQuery> parked) {
+    auto self = shared_from_this();
+    post(server.queryPool, [this, self, req, parked] {
+        std::ostream os(&response);
+        // Called by the thread that changed the rows. So it only posts.
+        const auto onWake = [this, self, req](std::shared_ptr<ParkedQuery> p) {
+            dispatch(req, std::move(p));
+        };
+        if (server.air.processOrPark(req, os, keepAlive, onWake, parked)) {
+            // Do the I/O back on the I/O threads
+            post(socket.get_executor(), [this, self] { write(); });
+        }
+    });
+}
+
+bool
+AsyncServer::Connection::flush() {
+    // This method is called on a query thread. So the data is sent by the
+    // I/O threads, while the query waits. A client that stops reading is
+    // dropped, so that it does not hold the query thread for long.
+    std::promise<boost::system::error_code> sent;
+    auto result = sent.get_future();
+    post(socket.get_executor(), [this, &sent] {
+        closeWhenIdle();
+        // Written as a streambuf (which is consumed as it is sent)
+        async_write(socket, static_cast<streambuf&>(response),
+            [this, &sent](const boost::system::error_code& ec, size_t) {
+                timer.expires_at(steady_timer::time_point::max());
+                sent.set_value(ec);
+            });
+    });
+    return !result.get();
+}
+
+void
+AsyncServer::Connection::write() {
+    auto self = shared_from_this();
+    async_write(socket, static_cast<streambuf&>(response),
+        [this, self](const boost::system::error_code& ec, size_t) {
+            if (!ec && keepAlive) {
+                start();  // Wait for the next request
+                return;
+            }
+            boost::system::error_code ignored;
+            socket.shutdown(tcp::socket::shutdown_both, ignored);
+            socket.close(ignored);
+        });
+}
@@ -0,0 +1,192 @@
+#ifndef ASYNC_SERVER_H
+#define ASYNC_SERVER_H
+
+/*
+ * An asynchronous web-server for SQLAir. Instead of using one thread per
+ * connection, a fixed pool of threads (one per core) runs a
+ * boost::asio::io_context that accepts connections, reads requests, and
+ * writes responses without blocking. Queries are run on a separate pool of
+ * threads, so a slow query does not hold up I/O on other connections. A
+ * query that waits is parked (see SQLAir::processOrPark) instead of holding
+ * a thread, and is posted to the pool again once rows change. Hence the
+ * number of connections is not limited by the number of threads.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+
+// Forward declaration to avoid circular include with SQLAir.h
+class SQLAir;
+struct ParkedQuery;
+
+/**
+ * The asynchronous server. This server is used by SQLAir::runServer when
+ * the SQLAIR_ASYNC environment variable is set to a non-zero value.
+ */
+class AsyncServer {
+public:
+    /**
+     * Create the server.
+     *
+     * @param air The SQLAir object to be used to process requests.
+     *
+     * @param server The acceptor (on which the server is listening) set up
+     * by main. This server accepts connections on a duplicate of it.
+     */
+    AsyncServer(SQLAir& air, boost::asio::ip::tcp::acceptor& server);
+
+    /**
+     * Run the server. This method does not return.
+     */
+    void run();
+
+private:
+    /**
+     * The state of one (persistent) connection from a client. The
+     * connection keeps itself alive (via shared_from_this) as long as an
+     * asynchronous operation on it is pending.
+     */
+    class Connection : public std::enable_shared_from_this<Connection> {
+    public:
+        /**
+         * Create a connection.
+         *
+         * @param server The server that accepted the connection.
+         *
+         * @param socket The socket connected to the client.
+         */
+        Connection(AsyncServer& server, boost::asio::ip::tcp::socket socket)
+            : server(server), socket(std::move(socket)),
+              timer(this->socket.get_executor()) {}
+
+        /**
+         * Start reading the next request from the client. The connection is
+         * closed if no request arrives within SQLAir::IdleTimeout.
+         */
+        void start();
+
+    private:
+        /**
+         * Run the request on the query pool and then send the response to
+         * the client. A query that has to wait is parked and dispatched
+         * again once rows change.
+         *
+         * @param req The path in the HTTP-GET request.
+         *
+         * @param parked The parked query, if the request is run again.
+         */
+        void dispatch(const std::string& req,
+                      std::shared_ptr<ParkedQuery> parked = nullptr);
+
+        /**
+         * Send the response to the client. Then read the next request, or
+         * close the connection if it is not to be kept alive.
+         */
+        void write();
+
+        /**
+         * Send the part of the response written so far to the client and
+         * wait until it has been sent. This method is called on the
+         * thread running the query (see ResponseStreambuf).
+         *
+         * @return This method returns false if the data could not be sent
+         * (e.g., because the client went away or stopped reading for
+         * SQLAir::IdleTimeout).
+         */
+        bool flush();
+
+        /**
+         * Close the connection if the timer is not reset (or stopped)
+         * within SQLAir::IdleTimeout.
+         */
+        void closeWhenIdle();
+
+        /**
+         * The buffer into which a query writes its response. ResponseBuffer
+         * flushes its stream after each chunk of a large result, at which
+         * point the chunk is sent to the client (see flush). So a large
+         * result is not held in memory before it is sent.
+         */
+        class ResponseStreambuf : public boost::asio::streambuf {
+        public:
+            /**
+             * Create the buffer.
+             *
+             * @param conn The connection to which the response is sent.
+             */
+            explicit ResponseStreambuf(Connection& conn) : conn(conn) {}
+
+        protected:
+            /**
+             * Send the data in the buffer to the client.
+             *
+             * @return This method returns -1 if the data could not be sent.
+             */
+            int sync() override { return conn.flush() ? 0 : -1; }
+
+        private:
+            /** The connection to which the response is sent. */
+            Connection& conn;
+        };
+
+        /** The server that accepted this connection. */
+        AsyncServer& server;
+
+        /** The socket connected to the client. All handlers for this
+         * connection run on the socket's strand, one at a time.
+         */
+        boost::asio::ip::tcp::socket socket;
+
+        /** The timer used to close the connection when it is idle. */
+        boost::asio::steady_timer timer;
+
+        /** Flag to indicate if the connection stays open after the
+         * current response.
+         */
+        bool keepAlive = false;
+
+        /** Buffer for the data read from the client. Pipelined requests
+         * remain in the buffer until the earlier ones are answered.
+         */
+        boost::asio::streambuf request;
+
+        /** The HTTP response to be sent to the client. The response is
+         * written directly into this buffer and consumed as it is sent.
+         */
+        ResponseStreambuf response{*this};
+    };
+
+    /**
+     * Accept the next connection (asynchronously). If the process has run
+     * out of resources (such as file descriptors), the next connection is
+     * accepted after AcceptRetryDelay.
+     */
+    void accept();
+
+    /** How long to wait before accepting again when out of resources. */
+    static constexpr std::chrono::milliseconds AcceptRetryDelay{100};
+
+    /** The SQLAir object used to process requests. */
+    SQLAir& air;
+
+    /** The context that runs all the asynchronous I/O. */
+    boost::asio::io_context ioc;
+
+    /** The acceptor used to accept connections. */
+    boost::asio::ip::tcp::acceptor acceptor;
+
+    /** The timer used to accept again after running out of resources. */
+    boost::asio::steady_timer acceptTimer;
+
+    /** The number of threads running ioc and in the query pool. */
+    const unsigned int numThreads;
+
+    /** The threads on which queries are run. */
+    boost::asio::thread_pool queryPool;
+};
+
+#endif /* ASYNC_SERVER_H */
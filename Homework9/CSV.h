@@ -15,6 +15,14 @@
 #include <unordered_map>
 #include <thread>
 #include <condition_variable>
+#include <memory>
+#include <chrono>
+#include "ColumnStore.h"
+#include "HashIndex.h"
+#include "SortedIndex.h"
+#include "TrigramIndex.h"
+#include "WaitRegistry.h"
+#include "WriteAheadLog.h"
 
 /** A short cut to refer to a vector of strings */
 using StrVec = std::vector<std::string>;
@@ -74,7 +82,13 @@ public:
         return *this;
     }
     
-    /** A convenience mutex for each row to enable MT-safe operations. */
+    /** A convenience mutex for each row to enable MT-safe operations.
+     *
+     * \note SQLAir no longer locks rows. Rows only exist while a CSV is
+     * being loaded, before they are moved into the column store (which uses
+     * reader-writer locks per segment). The mutex is kept only because
+     * libsqlair_lib.a is compiled against this layout of CSVRow.
+     */
     std::mutex rowMutex;
 };
 
@@ -132,11 +146,12 @@ public:
     void save(std::ostream& os, const std::string& delim = ",", 
         bool quote = true, const std::string& nl = "\n") const;
     
-    /** Obtain the number of rows in the CSV.
+    /** Obtain the number of rows in the CSV. Once the rows have been
+     * moved into the column store (see toColumns), they are counted there.
      *
      * \return The number of rows in the CSV file.
      */
-    int getRowCount() const { return this->size(); }
+    int getRowCount() const { return this->size() + columns.getRowCount(); }
 
     /**
      * Obtain the number of columns in each row of the CSV.
@@ -184,6 +199,17 @@ public:
      */
     void move(CSV& other);
 
+    /**
+     * Moves the rows loaded by the load() method into the column-major
+     * store (see the columns instance variable). The rows in this vector are
+     * released once they have been copied into the column store.
+     */
+    void toColumns() {
+        columns.build(*this, getColumnCount());
+        clear();
+        shrink_to_fit();
+    }
+
     /**
      * Split a given string based on spaces or other specified
      * delimiters while handling quotes.  This method does a
@@ -277,28 +303,29 @@ public:
     static std::string toLower(std::string str);
 
     /** A mutex that can be used for blocking-CSV level operations to enable
-     * MT-safe operations. Of course, blocking at the CSV level this way is
-     * rather inefficient. Instead a reader-write type lock is the preferred
-     * approach.
+     * MT-safe operations. This mutex is held only briefly, as it guards the
+     * reader-writer lock implemented by lock_shared() and lock().
      */
     std::mutex csvMutex;
     
     /** A condition variable for sleep-wake-up approach for waiting on
      * some condition to be met.
+     *
+     * \note Queries with a "wait" clause no longer use this condition
+     * variable. They wait via the waiters registry below, so that a change
+     * wakes up only the queries it is relevant to.
      */
     std::condition_variable csvCondVar;
 
     /**
-     * Number of threads just doing reads (i.e., select).  This variable  
-     * may be used for most effectively implementing the insert & delete 
-     * methods.
+     * Number of threads holding the read lock (see lock_shared()). This
+     * variable is guarded by csvMutex.
      */
     int numReadThreads = 0;
 
     /**
-     * Number of threads just doing writes (i.e., update, insert, or delete).  
-     * This variable is may be used for most effectively implementing the 
-     * insert & delete methods.
+     * Number of threads holding or waiting for the exclusive lock (see
+     * lock()). This variable is guarded by csvMutex.
      */
     int numWriteThreads = 0;
 
@@ -317,6 +344,273 @@ private:
      * indicates the zero-based column number.
      */
     std::unordered_map<std::string, int> colNames;
+
+    // NOTE: libsqlair_lib.a is compiled against the layout of the members
+    // above. Add new members only below this line.
+
+public:
+    /**
+     * The column-major copy of the data in this CSV. SQLAir runs its
+     * queries against this store. See the toColumns() method.
+     */
+    ColumnStore columns;
+
+    /**
+     * The queries (with a "wait" clause) that are waiting for rows in this
+     * CSV to change.
+     */
+    WaitRegistry waiters;
+
+    /**
+     * An identifier that is different each time a CSV is loaded. Statements
+     * parsed (and cached) by SQLAir are valid only for the CSV with the same
+     * identifier, as the columns may be different after a reload.
+     */
+    unsigned long schemaId = 0;
+
+    /**
+     * The number of statements (and queued checkpoints) using this CSV. A
+     * pinned CSV is never evicted to stay within SQLAir's memory budget.
+     * This and the next three members are guarded by SQLAir's
+     * recentCSVMutex. See SQLAir::loadAndGet.
+     */
+    int pins = 0;
+
+    /** When this CSV was last used, as a count of uses of all CSVs. */
+    unsigned long lastUsed = 0;
+
+    /** The memory used by the rows of this CSV when it was last used. */
+    size_t memUsage = 0;
+
+    /** Flag to indicate if this CSV is being evicted from memory. */
+    bool evicting = false;
+
+    /**
+     * The validators (the ETag and Last-Modified headers) sent by the web
+     * server, if this CSV was loaded from a URL. They are used to check
+     * if the data has changed since it was loaded (see
+     * SQLAir::refreshCSV).
+     */
+    std::string etag, lastModified;
+
+    /**
+     * A hash of the data loaded from a URL. A refresh that gets the same
+     * data again (say, from a server that does not send validators) keeps
+     * this CSV as it is.
+     */
+    size_t contentHash = 0;
+
+    /** When this CSV was last loaded or found to be up to date. */
+    std::chrono::steady_clock::time_point fetchedAt;
+
+    /**
+     * The log of changes to this CSV, if it was loaded from a local file
+     * and logging is enabled. See SQLAir::loadAndGet.
+     */
+    std::unique_ptr<WriteAheadLog> wal;
+
+    /**
+     * Flag set (while holding the write lock) when this CSV has been
+     * replaced by a newer copy (see SQLAir::refreshCSV). Statements that
+     * change rows must check it while holding the read lock and, if it is
+     * set, make their changes to the new copy instead.
+     */
+    bool retired = false;
+
+    /**
+     * Obtain the hash index on a given column, if one has been created.
+     *
+     * @param colIdx The index of the column whose hash index is needed.
+     *
+     * @return The index on the column. If the column does not have an
+     * index this method returns nullptr.
+     */
+    std::shared_ptr<HashIndex> getIndex(const int colIdx) {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        const auto entry = indexes.find(colIdx);
+        return (entry != indexes.end() ? entry->second : nullptr);
+    }
+
+    /**
+     * Obtain all the hash indexes on the columns in this CSV.
+     *
+     * @return The list of indexes on this CSV.
+     */
+    std::vector<std::shared_ptr<HashIndex>> getIndexes() {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        std::vector<std::shared_ptr<HashIndex>> list;
+        for (const auto& entry : indexes) {
+            list.push_back(entry.second);
+        }
+        return list;
+    }
+
+    /**
+     * Add (or replace) the hash index on a column.
+     *
+     * @param index The fully built index to be added.
+     */
+    void addIndex(std::shared_ptr<HashIndex> index) {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        indexes[index->getColumnIndex()] = index;
+    }
+
+    /**
+     * Obtain the sorted index on a given column, if one has been created.
+     *
+     * @param colIdx The index of the column whose sorted index is needed.
+     *
+     * @return The index on the column. If the column does not have a
+     * sorted index this method returns nullptr.
+     */
+    std::shared_ptr<SortedIndex> getSortedIndex(const int colIdx) {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        const auto entry = sortedIndexes.find(colIdx);
+        return (entry != sortedIndexes.end() ? entry->second : nullptr);
+    }
+
+    /**
+     * Obtain all the sorted indexes on the columns in this CSV.
+     *
+     * @return The list of sorted indexes on this CSV.
+     */
+    std::vector<std::shared_ptr<SortedIndex>> getSortedIndexes() {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        std::vector<std::shared_ptr<SortedIndex>> list;
+        for (const auto& entry : sortedIndexes) {
+            list.push_back(entry.second);
+        }
+        return list;
+    }
+
+    /**
+     * Add (or replace) the sorted index on a column.
+     *
+     * @param index The fully built index to be added.
+     */
+    void addSortedIndex(std::shared_ptr<SortedIndex> index) {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        sortedIndexes[index->getColumnIndex()] = index;
+    }
+
+    /**
+     * Obtain the trigram index on a given column, if one has been created.
+     *
+     * @param colIdx The index of the column whose trigram index is needed.
+     *
+     * @return The index on the column. If the column does not have a
+     * trigram index this method returns nullptr.
+     */
+    std::shared_ptr<TrigramIndex> getTrigramIndex(const int colIdx) {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        const auto entry = trigramIndexes.find(colIdx);
+        return (entry != trigramIndexes.end() ? entry->second : nullptr);
+    }
+
+    /**
+     * Obtain all the trigram indexes on the columns in this CSV.
+     *
+     * @return The list of trigram indexes on this CSV.
+     */
+    std::vector<std::shared_ptr<TrigramIndex>> getTrigramIndexes() {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        std::vector<std::shared_ptr<TrigramIndex>> list;
+        for (const auto& entry : trigramIndexes) {
+            list.push_back(entry.second);
+        }
+        return list;
+    }
+
+    /**
+     * Add (or replace) the trigram index on a column.
+     *
+     * @param index The fully built index to be added.
+     */
+    void addTrigramIndex(std::shared_ptr<TrigramIndex> index) {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        trigramIndexes[index->getColumnIndex()] = index;
+    }
+
+    /**
+     * Lock this CSV for reading. Many threads can hold the read lock at
+     * the same time. The read lock is all that is needed to change values
+     * in existing rows, as each segment in the column store has its own
+     * reader-writer lock. This method, together with unlock_shared(),
+     * enables using std::shared_lock<CSV>.
+     *
+     * Threads waiting for the write lock are given preference over new
+     * readers, so that a steady stream of selects cannot starve them.
+     */
+    void lock_shared() {
+        std::unique_lock<std::mutex> lock(csvMutex);
+        rwCondVar.wait(lock, [this] { return numWriteThreads == 0; });
+        numReadThreads++;
+    }
+
+    /**
+     * Release the read lock obtained via lock_shared().
+     */
+    void unlock_shared() {
+        std::lock_guard<std::mutex> lock(csvMutex);
+        if (--numReadThreads == 0) {
+            rwCondVar.notify_all();
+        }
+    }
+
+    /**
+     * Lock this CSV for exclusive access. This lock is needed for changes
+     * to the structure of the CSV, such as building an index. This method,
+     * together with unlock(), enables using std::unique_lock<CSV>.
+     */
+    void lock() {
+        std::unique_lock<std::mutex> lock(csvMutex);
+        numWriteThreads++;  // Blocks new readers
+        rwCondVar.wait(lock, [this] {
+            return numReadThreads == 0 && !isWriting; });
+        isWriting = true;
+    }
+
+    /**
+     * Release the exclusive lock obtained via lock().
+     */
+    void unlock() {
+        std::lock_guard<std::mutex> lock(csvMutex);
+        isWriting = false;
+        numWriteThreads--;
+        rwCondVar.notify_all();
+    }
+
+private:
+    /** A condition variable used by the reader-writer lock methods above.
+     * It is separate from csvCondVar, which is used by queries that wait
+     * for rows to change.
+     */
+    std::condition_variable rwCondVar;
+
+    /** Flag to indicate if a thread holds the exclusive lock. */
+    bool isWriting = false;
+
+    /**
+     * The hash indexes (created via "create index" statements) on columns
+     * in this CSV. The key is the index of the column in colNames.
+     */
+    std::unordered_map<int, std::shared_ptr<HashIndex>> indexes;
+
+    /**
+     * The sorted indexes (created via "create sorted index" statements) on
+     * columns in this CSV. The key is the index of the column in colNames.
+     */
+    std::unordered_map<int, std::shared_ptr<SortedIndex>> sortedIndexes;
+
+    /**
+     * The trigram indexes (created via "create trigram index" statements)
+     * on columns in this CSV. The key is the index of the column in
+     * colNames.
+     */
+    std::unordered_map<int, std::shared_ptr<TrigramIndex>> trigramIndexes;
+
+    /** A mutex to enable MT-safe access to the index maps. */
+    std::mutex indexMutex;
 };
 
 #endif
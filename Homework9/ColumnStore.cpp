@@ -0,0 +1,716 @@
+/*
+ * Implementation of the column-major storage engine used by SQLAir.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <exception>
+#include "ColumnStore.h"
+#include "CSV.h"
+#include "StrSearch.h"
+
+void
+Column::append(std::string_view val) {
+    if (!codes.empty()) {
+        decode();
+    }
+    start.push_back(data.size());
+    len.push_back(val.size());
+    data.append(val.data(), val.size());
+}
+
+void
+Column::appendMapped(std::string_view val) {
+    const size_t offset = val.data() - mapped;
+    if (offset >= MappedFlag || !codes.empty()) {
+        append(val);  // Too far from the base pointer to be encoded
+        return;
+    }
+    start.push_back(offset | MappedFlag);
+    len.push_back(val.size());
+    numMapped++;
+}
+
+/**
+ * Helper method to look up a value in an open addressing hash table of
+ * distinct values. The table is used to dictionary encode a column.
+ *
+ * @param slots The hash table. Each slot is the index of a value in
+ * values, or -1 if the slot is free. The size must be a power of 2.
+ *
+ * @param values The distinct values in the table.
+ *
+ * @param val The value to look for.
+ *
+ * @return The slot with the value, or the free slot where it goes.
+ */
+static int&
+findSlot(std::vector<int>& slots, const std::vector<std::string_view>& values,
+         std::string_view val) {
+    const size_t mask = slots.size() - 1;
+    size_t i = std::hash<std::string_view>()(val) & mask;
+    while (slots[i] != -1 && values[slots[i]] != val) {
+        i = (i + 1) & mask;
+    }
+    return slots[i];
+}
+
+void
+Column::encode() {
+    const size_t numRows = size();
+    if (!codes.empty() || numRows < 2) {
+        return;
+    }
+    // Estimate the number of distinct values from evenly spaced rows. Most
+    // of the sampled values must repeat for encoding to be worth trying.
+    const size_t step = std::max<size_t>(1, numRows / SampleRows);
+    std::vector<int> slots(SampleRows * 4, -1);
+    std::vector<std::string_view> values;
+    values.reserve(std::min(numRows, SampleRows * 2));
+    size_t numSampled = 0;
+    for (size_t row = 0; (row < numRows); row += step, numSampled++) {
+        int& slot = findSlot(slots, values, at(row));
+        if (slot == -1) {
+            slot = values.size();
+            values.push_back(at(row));
+        }
+    }
+    if (values.size() * 4 > numSampled * 3) {
+        return;
+    }
+    // Assign a code to each distinct value, giving up if there are too
+    // many of them for the codes to save memory.
+    const size_t maxEntries = std::min(MaxDictSize, numRows / 2);
+    slots.assign(MaxDictSize * 2, -1);
+    values.clear();
+    values.reserve(maxEntries);
+    std::vector<uint16_t> rowCodes(numRows);
+    for (size_t row = 0; (row < numRows); row++) {
+        int& slot = findSlot(slots, values, at(row));
+        if (slot == -1) {
+            if (values.size() == maxEntries) {
+                return;
+            }
+            slot = values.size();
+            values.push_back(at(row));
+        }
+        rowCodes[row] = slot;
+    }
+    // Keep just the distinct values in the buffer. Codes were assigned in
+    // row order, so each value is taken from the first row with its code.
+    std::vector<uint32_t> entryStart(values.size()), entryLen(values.size());
+    std::string entryData;
+    numMapped = 0;
+    for (size_t row = 0, code = 0; (code < values.size()); row++) {
+        if (rowCodes[row] != code) {
+            continue;
+        }
+        if (start[row] & MappedFlag) {
+            entryStart[code] = start[row];
+            numMapped++;
+        } else {
+            entryStart[code] = entryData.size();
+            entryData.append(data, start[row], len[row]);
+        }
+        entryLen[code++] = len[row];
+    }
+    data.swap(entryData);
+    start.swap(entryStart);
+    len.swap(entryLen);
+    codes.swap(rowCodes);
+    garbage = 0;
+    inOrder = true;
+}
+
+void
+Column::decode() {
+    std::string rowData;
+    std::vector<uint32_t> rowStart, rowLen;
+    rowStart.reserve(codes.size());
+    rowLen.reserve(codes.size());
+    numMapped = 0;
+    for (const uint16_t code : codes) {
+        if (start[code] & MappedFlag) {
+            rowStart.push_back(start[code]);
+            numMapped++;
+        } else {
+            rowStart.push_back(rowData.size());
+            rowData.append(data, start[code], len[code]);
+        }
+        rowLen.push_back(len[code]);
+    }
+    data.swap(rowData);
+    start.swap(rowStart);
+    len.swap(rowLen);
+    codes = std::vector<uint16_t>();
+    garbage = 0;
+    inOrder = true;
+}
+
+int
+Column::findCode(std::string_view val) const {
+    for (size_t code = 0; (code < start.size()); code++) {
+        if (valueAt(code) == val) {
+            return code;
+        }
+    }
+    return -1;
+}
+
+void
+Column::findCodes(const std::vector<bool>& matches, RowList& rows) const {
+    for (size_t row = 0; (row < codes.size()); row++) {
+        if (matches[codes[row]]) {
+            rows.push_back(row);
+        }
+    }
+}
+
+void
+Column::set(const size_t row, std::string_view val) {
+    if (!codes.empty()) {
+        const int code = findCode(val);
+        if (code != -1) {
+            codes[row] = code;
+            return;
+        } else if (start.size() < MaxDictSize) {
+            // Add the value to the dictionary. The old value stays in
+            // the dictionary, as other rows may still use it.
+            codes[row] = start.size();
+            start.push_back(data.size());
+            len.push_back(val.size());
+            data.append(val.data(), val.size());
+            return;
+        }
+        decode();  // The dictionary is full. Change the row as usual.
+    }
+    if (start[row] & MappedFlag) {
+        // Copy-on-write: The old value stays in the mapped file.
+        numMapped--;
+        inOrder = false;
+        start[row] = data.size();
+        data.append(val.data(), val.size());
+    } else if (val.size() <= len[row]) {
+        // The new value fits in place of the old one. Overwrite it.
+        std::memcpy(&data[start[row]], val.data(), val.size());
+        garbage += len[row] - val.size();
+    } else {
+        // Add the new value to the end and leave the old bytes as garbage
+        garbage += len[row];
+        inOrder  = false;
+        start[row] = data.size();
+        data.append(val.data(), val.size());
+    }
+    len[row] = val.size();
+    // Don't let the garbage take over the buffer
+    if (garbage > data.size() / 2) {
+        compact();
+    }
+}
+
+void
+Column::compact() {
+    std::string packed;
+    packed.reserve(data.size() - garbage);
+    for (size_t row = 0; (row < start.size()); row++) {
+        if (start[row] & MappedFlag) {
+            continue;  // Value is not in data
+        }
+        const uint32_t newStart = packed.size();
+        packed.append(data, start[row], len[row]);
+        start[row] = newStart;
+    }
+    data.swap(packed);
+    garbage = 0;
+    inOrder = true;
+}
+
+void
+Column::findMatches(const std::string& cond, const std::string& value,
+                    RowList& rows) const {
+    const size_t numRows = size();
+    if (cond == "like") {
+        findLike(value, rows);
+        return;
+    }
+    const bool wantEqual = (cond == "=");
+    if (!codes.empty()) {
+        // Compare each row's code with the value's code. A value that is
+        // not in the dictionary (code -1) does not equal any row.
+        const int code = findCode(value);
+        for (size_t row = 0; (row < numRows); row++) {
+            if ((codes[row] == code) == wantEqual) {
+                rows.push_back(row);
+            }
+        }
+        return;
+    }
+    // Check for equality by comparing lengths first and then bytes. This
+    // tight loop only touches the len array and rarely the values.
+    const uint32_t valLen = value.size();
+    for (size_t row = 0; (row < numRows); row++) {
+        const bool isEqual = (len[row] == valLen) &&
+            (std::memcmp(at(row).data(), value.data(), valLen) == 0);
+        if (isEqual == wantEqual) {
+            rows.push_back(row);
+        }
+    }
+}
+
+void
+Column::findLike(const std::string& value, RowList& rows) const {
+    const size_t numRows = size();
+    if (value.empty()) {
+        // An empty string is a substring of every value.
+        for (size_t row = 0; (row < numRows); row++) {
+            rows.push_back(row);
+        }
+        return;
+    }
+    if (!codes.empty()) {
+        // Search each distinct value just once
+        std::vector<bool> matches(start.size());
+        for (size_t code = 0; (code < start.size()); code++) {
+            const std::string_view val = valueAt(code);
+            matches[code] = StrSearch::find(val.data(), val.data() +
+                                            val.size(), value) != nullptr;
+        }
+        findCodes(matches, rows);
+        return;
+    }
+    const char *buf = data.data();
+    if (!inOrder || garbage != 0 || numMapped != 0) {
+        // The values are not back-to-back in row order. Search each value.
+        for (size_t row = 0; (row < numRows); row++) {
+            const char *val = at(row).data();
+            if (StrSearch::find(val, val + len[row], value) != nullptr) {
+                rows.push_back(row);
+            }
+        }
+        return;
+    }
+    // Otherwise the values are back-to-back in row order. So search
+    // the whole buffer in one go and map each hit back to its row. A hit
+    // that spans two values is not a match.
+    const char *end = buf + data.size();
+    size_t row = 0;
+    for (const char *pos = buf; (pos < end && row < numRows);) {
+        const char *hit = StrSearch::find(pos, end, value);
+        if (hit == nullptr) {
+            break;  // No more matches in this column
+        }
+        const uint32_t offset = hit - buf;
+        // Skip over the rows that end before the hit
+        while (start[row] + len[row] <= offset) {
+            row++;
+        }
+        const uint32_t rowEnd = start[row] + len[row];
+        if (offset + value.size() <= rowEnd) {
+            // Found a match. Continue the search from the next row.
+            rows.push_back(row);
+            pos = buf + rowEnd;
+            row++;
+        } else {
+            pos = hit + 1;  // Hit spans two values
+        }
+    }
+}
+
+void
+Column::findMatches(const Range& range, RowList& rows) const {
+    if (!codes.empty()) {
+        // Check each distinct value just once
+        std::vector<bool> matches(start.size());
+        for (size_t code = 0; (code < start.size()); code++) {
+            matches[code] = range.contains(valueAt(code));
+        }
+        findCodes(matches, rows);
+        return;
+    }
+    for (size_t row = 0; (row < start.size()); row++) {
+        if (range.contains(at(row))) {
+            rows.push_back(row);
+        }
+    }
+}
+
+//-------------------------------------------------------------------------
+
+void
+Segment::findMatches(const int colIdx, const std::string& cond,
+                     const std::string& value, RowList& rows) const {
+    if (colIdx == -1) {
+        // No where clause. All rows in this segment match.
+        for (size_t row = 0; (row < getRowCount()); row++) {
+            rows.push_back(row);
+        }
+    } else {
+        cols.at(colIdx).findMatches(cond, value, rows);
+    }
+    dropDeleted(rows);
+}
+
+void
+Segment::findMatches(const int colIdx, const Range& range,
+                     RowList& rows) const {
+    cols.at(colIdx).findMatches(range, rows);
+    dropDeleted(rows);
+}
+
+void
+Segment::dropDeleted(RowList& rows) const {
+    if (numDeleted != 0) {
+        rows.erase(std::remove_if(rows.begin(), rows.end(),
+            [this](const uint32_t row) { return deleted[row]; }), rows.end());
+    }
+}
+
+void
+Segment::erase(const size_t row) {
+    changed();
+    if (deleted.empty()) {
+        deleted.resize(getRowCount(), false);
+    }
+    if (!deleted[row]) {
+        deleted[row] = true;
+        numDeleted++;
+    }
+}
+
+//-------------------------------------------------------------------------
+
+ColumnStore&
+ColumnStore::operator=(ColumnStore&& other) {
+    segments       = std::move(other.segments);
+    file           = std::move(other.file);
+    snapshotSource = other.snapshotSource;
+    snapshotFile   = other.snapshotFile;
+    colTypes       = std::move(other.colTypes);
+    return *this;
+}
+
+void
+ColumnStore::build(const std::vector<CSVRow>& rows, const int numCols) {
+    segments.clear();
+    file.reset();
+    snapshotSource = false;
+    snapshotFile = MappedFile::FileId(0, 0);
+    colTypes.clear();
+    for (size_t i = 0; (i < rows.size()); i++) {
+        if (i % SegmentRows == 0) {
+            segments.push_back(std::make_unique<Segment>(numCols));
+        }
+        Segment& seg = *segments.back();
+        for (int col = 0; (col < numCols); col++) {
+            seg.cols[col].append(rows[i].at(col));
+        }
+    }
+    for (auto& seg : segments) {
+        seg->encode();
+    }
+}
+
+/**
+ * Helper method to split a line from a CSV into values. The values are
+ * split the same way as CSV::load: values are separated by commas and may
+ * be enclosed in double or single quotes. In quoted values, a backslash
+ * escapes the next character and a doubled quote is a single quote.
+ *
+ * @param pos Pointer to the first character in the line.
+ *
+ * @param end Pointer to the end of the line (the newline is not included).
+ *
+ * @param numCols The expected number of values in the line.
+ *
+ * @param vals The values in the line. Where possible, each value is a view
+ * into the line. Values that needed unescaping refer to strings in scratch.
+ *
+ * @param scratch Buffers for values that needed unescaping. This vector
+ * must have numCols entries.
+ *
+ * @exception std::runtime_error This method throws an exception if the
+ * line has more than numCols values.
+ */
+static void
+splitLine(const char* pos, const char* end, const size_t numCols,
+          std::vector<std::string_view>& vals, StrVec& scratch) {
+    vals.clear();
+    for (;;) {
+        if (vals.size() == numCols) {
+            throw std::runtime_error("inconsistent number of columns in CSV");
+        }
+        if (pos == end || (*pos != '"' && *pos != '\'')) {
+            // Common case: an unquoted value that ends at the next comma.
+            const char *valEnd = static_cast<const char*>(
+                std::memchr(pos, ',', end - pos));
+            valEnd = (valEnd == nullptr) ? end : valEnd;
+            vals.emplace_back(pos, valEnd - pos);
+            pos = valEnd;
+        } else {
+            const char quote = *pos++;
+            const char *close = static_cast<const char*>(
+                std::memchr(pos, quote, end - pos));
+            const char *next  = (close == nullptr) ? end : close + 1;
+            if (close != nullptr && (next == end || *next == ',') &&
+                std::memchr(pos, '\\', close - pos) == nullptr) {
+                // A quoted value without any escapes. Use it as is.
+                vals.emplace_back(pos, close - pos);
+                pos = next;
+            } else {
+                // Unescape the value into a scratch buffer.
+                std::string& val = scratch[vals.size()];
+                val.clear();
+                for (; (pos < end); pos++) {
+                    if (*pos == '\\' && pos + 1 < end) {
+                        pos++;  // Add the escaped character as is
+                    } else if (*pos == quote) {
+                        if (pos + 1 == end || pos[1] != quote) {
+                            break;  // Found the closing quote
+                        }
+                        pos++;  // Doubled quote
+                    }
+                    val += *pos;
+                }
+                // Skip the closing quote and keep any text after it
+                pos += (pos < end);
+                for (; (pos < end && *pos != ','); pos++) {
+                    val += *pos;
+                }
+                vals.emplace_back(val);
+            }
+        }
+        if (pos == end) {
+            break;  // This was the last value in the line
+        }
+        pos++;  // Skip over the comma
+    }
+}
+
+void
+ColumnStore::load(std::shared_ptr<MappedFile> src, const size_t offset,
+                  const int numCols) {
+    segments.clear();
+    file = src;
+    snapshotSource = false;
+    snapshotFile = MappedFile::FileId(0, 0);
+    colTypes.clear();
+    // Rows never span lines. So the rows of each segment can be found by
+    // just counting lines. Find where each segment starts in the file.
+    std::vector<const char*> bounds;
+    std::vector<size_t> numRows;
+    const char *end = file->end();
+    for (const char *pos = file->begin() + offset; (pos < end);) {
+        bounds.push_back(pos);
+        size_t row = 0;
+        for (; (row < SegmentRows && pos < end); row++) {
+            const char *eol = static_cast<const char*>(
+                std::memchr(pos, '\n', end - pos));
+            pos = (eol == nullptr) ? end : eol + 1;
+        }
+        numRows.push_back(row);
+    }
+    bounds.push_back(end);
+    segments.resize(bounds.size() - 1);
+    // Parse the segments using multiple threads. Each thread parses every
+    // numThreads'th segment. Errors are reported after all threads finish.
+    const size_t numThreads = std::min<size_t>(segments.size(),
+        std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::exception_ptr> errors(numThreads);
+    auto parse = [&](const size_t thr) {
+        try {
+            for (size_t s = thr; (s < segments.size()); s += numThreads) {
+                segments[s] = parseSegment(bounds[s], bounds[s + 1],
+                                           numRows[s], numCols);
+            }
+        } catch (...) {
+            errors[thr] = std::current_exception();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t thr = 1; (thr < numThreads); thr++) {
+        threads.emplace_back(parse, thr);
+    }
+    if (numThreads > 0) {
+        parse(0);  // This thread does its share too
+    }
+    for (auto& thr : threads) {
+        thr.join();
+    }
+    for (const auto& err : errors) {
+        if (err != nullptr) {
+            segments.clear();
+            std::rethrow_exception(err);
+        }
+    }
+}
+
+std::unique_ptr<Segment>
+ColumnStore::parseSegment(const char* pos, const char* end,
+                          const size_t numRows, const int numCols) const {
+    auto seg = std::make_unique<Segment>(numCols);
+    seg->setSource(std::string_view(pos, end - pos));
+    // The values in this segment are at offsets from its first line. The
+    // arrays are sized up front, rather than grown one row at a time.
+    for (auto& col : seg->cols) {
+        col.setMappedBase(pos);
+        col.reserve(numRows);
+    }
+    std::vector<std::string_view> vals;
+    StrVec scratch(numCols);
+    while (pos < end) {
+        // Find the end of this line, ignoring any carriage return
+        const char *eol = static_cast<const char*>(
+            std::memchr(pos, '\n', end - pos));
+        eol = (eol == nullptr) ? end : eol;
+        const char *lineEnd = (eol > pos && eol[-1] == '\r') ? eol - 1 : eol;
+        if (lineEnd == pos) {
+            pos = eol + 1;
+            continue;  // Blank lines are skipped, as CSV::load does
+        }
+        splitLine(pos, lineEnd, numCols, vals, scratch);
+        if (vals.size() != static_cast<size_t>(numCols)) {
+            throw std::runtime_error("inconsistent number of columns in CSV");
+        }
+        for (int col = 0; (col < numCols); col++) {
+            if (file->contains(vals[col].data())) {
+                seg->cols[col].appendMapped(vals[col]);
+            } else {
+                seg->cols[col].append(vals[col]);
+            }
+        }
+        pos = eol + 1;
+    }
+    seg->encode();
+    return seg;
+}
+
+bool
+ColumnStore::isUnsaved() const {
+    for (const auto& seg : segments) {
+        if (seg->isUnsaved()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void
+ColumnStore::setUnsaved() {
+    for (const auto& seg : segments) {
+        seg->setUnsaved(true);
+    }
+}
+
+ColumnType
+ColumnStore::getColumnType(const int colIdx) {
+    std::lock_guard<std::mutex> guard(typeMutex);
+    if (segments.empty()) {
+        return ColumnType::String;  // No values to go by
+    } else if (colTypes.empty()) {
+        colTypes.resize(segments.front()->cols.size(), ColumnType::Unknown);
+    }
+    if (colTypes.at(colIdx) == ColumnType::Unknown) {
+        // The most general type of the values decides the column's type
+        ColumnType type = ColumnType::Unknown;
+        for (size_t s = 0; (s < segments.size() &&
+                            type != ColumnType::String); s++) {
+            Segment& seg = *segments[s];
+            std::shared_lock<std::shared_mutex> lock(seg.segMutex);
+            const Column& col = seg.cols[colIdx];
+            for (size_t row = 0; (row < col.size() &&
+                                  type != ColumnType::String); row++) {
+                if (!seg.isDeleted(row)) {
+                    type = std::max(type, Range::typeOf(col.at(row)));
+                }
+            }
+        }
+        colTypes[colIdx] = (type == ColumnType::Unknown) ?
+            ColumnType::String : type;
+    }
+    return colTypes[colIdx];
+}
+
+size_t
+ColumnStore::getRowCount() const {
+    size_t count = 0;
+    for (const auto& seg : segments) {
+        count += seg->getLiveRowCount();
+    }
+    return count;
+}
+
+size_t
+ColumnStore::getMemoryUsage() {
+    size_t bytes = (file != nullptr) ? file->size() : 0;
+    for (const auto& seg : segments) {
+        std::shared_lock<std::shared_mutex> lock(seg->segMutex);
+        bytes += sizeof(Segment) + seg->getMemoryUsage();
+    }
+    return bytes;
+}
+
+void
+ColumnStore::save(std::ostream& os, const StrVec& colNames,
+                  const std::string& delim, bool quote,
+                  const std::string& nl, const RowFilter& filter) const {
+    if (!os.good()) {
+        throw std::runtime_error("The supplied stream was not good.");
+    }
+    // Helper lambda to write a value, escaping quotes and backslashes (as
+    // std::quoted does) if needed, so that it reads back the same.
+    auto write = [&os, quote](std::string_view val) {
+        if (!quote) {
+            os << val;
+            return;
+        }
+        os << '"';
+        for (const char c : val) {
+            if (c == '"' || c == '\\') {
+                os << '\\';
+            }
+            os << c;
+        }
+        os << '"';
+    };
+    // First write the header with column names
+    std::string sep = "";
+    for (const auto& name : colNames) {
+        os << sep;
+        write(name);
+        sep = delim;
+    }
+    os << nl;
+    // The lines of unchanged segments can be copied from the CSV file the
+    // table was loaded from, if this is the same format.
+    const bool copySource = !snapshotSource && delim == "," && nl == "\n";
+    // Write each row, segment-by-segment.
+    for (size_t s = 0; (s < segments.size()); s++) {
+        const auto& seg = segments[s];
+        std::shared_lock<std::shared_mutex> lock(seg->segMutex);
+        seg->setUnsaved(false);
+        const std::string_view src = seg->getSource();
+        if (copySource && !src.empty()) {
+            os.write(src.data(), src.size());
+            if (src.back() != '\n') {
+                os << nl;  // The last line in the file had no newline
+            }
+            continue;
+        }
+        for (size_t row = 0; (row < seg->getRowCount()); row++) {
+            if (filter ? !filter(s, row) : seg->isDeleted(row)) {
+                continue;
+            }
+            sep = "";
+            for (const auto& col : seg->cols) {
+                os << sep;
+                write(col.at(row));
+                sep = delim;
+            }
+            os << nl;
+        }
+    }
+}
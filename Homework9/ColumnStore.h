@@ -0,0 +1,771 @@
+#ifndef COLUMN_STORE_H
+#define COLUMN_STORE_H
+
+/*
+ * A column-major storage engine for the data in a CSV. Instead of storing
+ * each row as a vector-of-strings (with one heap allocation per value), the
+ * values of each column are packed into a single contiguous buffer. A scan
+ * over a "where" clause only touches the buffer of the column being checked,
+ * which is much more cache-friendly for large tables.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <iostream>
+#include "MappedFile.h"
+#include "Range.h"
+
+// Forward declaration to avoid circular include with CSV.h
+class CSVRow;
+
+/** A short cut to refer to a vector of strings */
+using StrVec = std::vector<std::string>;
+
+/** A short cut to refer to a list of row numbers (in a segment) */
+using RowList = std::vector<uint32_t>;
+
+/** A row number in a table. See ColumnStore::toRowId */
+using RowId = uint32_t;
+
+/**
+ * A method that selects the rows to be written out when saving a table. The
+ * parameters are the index of a segment and a row within it. It returns true
+ * if the row is to be written.
+ */
+using RowFilter = std::function<bool(const size_t, const size_t)>;
+
+/**
+ * The values of one column (in one segment) of a table. All the values are
+ * stored back-to-back in a single buffer. The start and length of each value
+ * are stored in two parallel arrays so that the i'th value can be accessed
+ * in constant time.
+ *
+ * Values can also refer directly to a memory-mapped file (see
+ * ColumnStore::load). Such values are copied into the buffer only when they
+ * are changed via set() (copy-on-write).
+ *
+ * A column with few distinct values (e.g., a country) can be dictionary
+ * encoded (see encode). Then the buffer and the two arrays hold just the
+ * distinct values and each row only stores a small code: the index of its
+ * value in the dictionary.
+ */
+class Column {
+public:
+    /**
+     * Obtain the value of this column in a given row.
+     *
+     * @param row The zero-based row (within the segment) whose value is to
+     * be returned.
+     *
+     * @return A view into the buffer of this column (or the mapped file).
+     * The view is valid only until this column is modified.
+     */
+    std::string_view at(const size_t row) const {
+        return valueAt(codes.empty() ? row : codes[row]);
+    }
+
+    /**
+     * Add a value to the end of this column. An encoded column is decoded
+     * first.
+     *
+     * @param val The value to be added.
+     */
+    void append(std::string_view val);
+
+    /**
+     * Add a value that lives in a memory-mapped file to the end of this
+     * column, without copying it. If the value is too far from the base
+     * pointer (set via setMappedBase) it is copied instead.
+     *
+     * @param val The value to be added. It must be at or after the base
+     * pointer of this column.
+     */
+    void appendMapped(std::string_view val);
+
+    /**
+     * Set the base pointer for values added via appendMapped. This method
+     * must be called before the first call to appendMapped.
+     *
+     * @param base Pointer into a memory-mapped file. The file must remain
+     * mapped as long as this column exists.
+     */
+    void setMappedBase(const char* base) { mapped = base; }
+
+    /**
+     * Reserve space for a given number of values, e.g., before adding the
+     * values in a segment one at a time.
+     *
+     * @param numRows The number of values this column will have.
+     */
+    void reserve(const size_t numRows) {
+        start.reserve(numRows);
+        len.reserve(numRows);
+    }
+
+    /**
+     * Dictionary encode this column if it has few distinct values. The
+     * number of distinct values is first estimated from a sample of the
+     * rows, so that columns with mostly unique values (e.g., names) are
+     * skipped cheaply. This method is called once the rows of a segment
+     * have been loaded.
+     */
+    void encode();
+
+    /**
+     * Check if this column is dictionary encoded (see encode).
+     *
+     * @return This method returns true if the rows store codes.
+     */
+    bool isEncoded() const { return !codes.empty(); }
+
+    /**
+     * Change the value of this column in a given row. If the new value fits
+     * in place of the old one, it is overwritten. Otherwise the new value is
+     * appended to the buffer and the old bytes become garbage. The buffer is
+     * compacted once garbage exceeds half the buffer. Values in a mapped
+     * file are never overwritten; the new value is added to the buffer. In
+     * an encoded column, the row's code is changed instead, adding the
+     * value to the dictionary if needed. Once the dictionary is full, the
+     * column is decoded.
+     *
+     * @param row The zero-based row (within the segment) to be changed.
+     *
+     * @param val The new value for the row.
+     */
+    void set(const size_t row, std::string_view val);
+
+    /**
+     * Obtain the number of values in this column.
+     *
+     * @return The number of values in this column.
+     */
+    size_t size() const {
+        return codes.empty() ? start.size() : codes.size();
+    }
+
+    /**
+     * Obtain the number of bytes of memory allocated for this column,
+     * not counting values in a mapped file.
+     *
+     * @return The capacity of the buffer and of the arrays, in bytes.
+     */
+    size_t getMemoryUsage() const {
+        return data.capacity() + codes.capacity() * sizeof(uint16_t) +
+            (start.capacity() + len.capacity()) * sizeof(uint32_t);
+    }
+
+    /**
+     * Add the rows whose value satisfies a given condition to a list. This
+     * method scans just this column's buffer. In an encoded column, "="
+     * and "<>" compare codes instead of strings.
+     *
+     * @param cond The condition to check. This is one of "=", "<>", or
+     * "like" (substring). See findLike for how "like" is checked.
+     *
+     * @param value The value specified by the user in the where clause.
+     *
+     * @param rows The list to which the matching row numbers are appended.
+     */
+    void findMatches(const std::string& cond, const std::string& value,
+                     RowList& rows) const;
+
+    /**
+     * Add the rows whose value is in a given range to a list.
+     *
+     * @param range The range of values to look for.
+     *
+     * @param rows The list to which the matching row numbers are appended.
+     */
+    void findMatches(const Range& range, RowList& rows) const;
+
+private:
+    /**
+     * Obtain the i'th value in the buffer: the value of a row, or a
+     * dictionary entry if this column is encoded.
+     *
+     * @param idx The index into the start and len arrays.
+     *
+     * @return A view into the buffer of this column (or the mapped file).
+     */
+    std::string_view valueAt(const size_t idx) const {
+        const uint32_t pos = start[idx];
+        const char *base = (pos & MappedFlag) ? mapped : data.data();
+        return std::string_view(base + (pos & ~MappedFlag), len[idx]);
+    }
+
+    /**
+     * Find the code of a value in the dictionary of an encoded column.
+     *
+     * @param val The value to look for.
+     *
+     * @return The code of the value, or -1 if it is not in the dictionary.
+     */
+    int findCode(std::string_view val) const;
+
+    /**
+     * Add the rows of an encoded column whose code is flagged to a list.
+     *
+     * @param matches Flag for each dictionary entry to indicate if rows
+     * with that value are to be added.
+     *
+     * @param rows The list to which the matching row numbers are appended.
+     */
+    void findCodes(const std::vector<bool>& matches, RowList& rows) const;
+
+    /**
+     * Convert an encoded column back to one value per row. Values that
+     * are in the buffer are copied for each row, so that set() can
+     * overwrite them in place.
+     */
+    void decode();
+
+    /**
+     * Add the rows whose value contains a given string to a list. When all
+     * the values are back-to-back in row order in data, the whole buffer
+     * is searched (using the vectorized StrSearch::find) rather than one
+     * value at a time.
+     *
+     * @param value The substring to look for.
+     *
+     * @param rows The list to which the matching row numbers are appended.
+     */
+    void findLike(const std::string& value, RowList& rows) const;
+
+    /**
+     * Rewrite the buffer so that it only contains the current values
+     * (in row order), dropping any garbage left behind by set().
+     */
+    void compact();
+
+    /** The values in this column stored back-to-back. */
+    std::string data;
+
+    /** The starting offset of each row's value in data. */
+    std::vector<uint32_t> start;
+
+    /** The length of each row's value in data. */
+    std::vector<uint32_t> len;
+
+    /** Number of bytes in data that are no longer referenced. */
+    size_t garbage = 0;
+
+    /** Flag to indicate if the values in data are in row order. This flag
+     * is cleared when set() moves a value to the end of the buffer.
+     */
+    bool inOrder = true;
+
+    /** The bit in start that indicates the value is in the mapped file
+     * (at an offset from the mapped pointer) rather than in data.
+     */
+    static constexpr uint32_t MappedFlag = 0x80000000u;
+
+    /** The base pointer for values in a mapped file. */
+    const char *mapped = nullptr;
+
+    /** The number of values that are in the mapped file. */
+    size_t numMapped = 0;
+
+    /** The code of each row's value, if this column is encoded. Then
+     * start and len have one entry per distinct value (the dictionary).
+     * This vector is empty if the column is not encoded.
+     */
+    std::vector<uint16_t> codes;
+
+    /** The most distinct values an encoded column can have. */
+    static constexpr size_t MaxDictSize = 1024;
+
+    /** The number of rows sampled to estimate the distinct values. */
+    static constexpr size_t SampleRows = 256;
+};
+
+/**
+ * A fixed-size block of consecutive rows in a table. Each segment has its
+ * own set of columns. Splitting a table into segments keeps each column
+ * buffer to a reasonable size (so compacting after an update is cheap) and
+ * gives a convenient unit for locking.
+ */
+class Segment {
+public:
+    /**
+     * Create an empty segment.
+     *
+     * @param numCols The number of columns in the table.
+     */
+    explicit Segment(const int numCols) : cols(numCols) {}
+
+    /**
+     * Obtain the number of rows in this segment, including deleted rows.
+     *
+     * @return The number of rows in this segment.
+     */
+    size_t getRowCount() const { return cols.empty() ? 0 : cols[0].size(); }
+
+    /**
+     * Obtain the number of rows in this segment that have not been deleted.
+     *
+     * @return The number of rows in this segment that are not deleted.
+     */
+    size_t getLiveRowCount() const { return getRowCount() - numDeleted; }
+
+    /**
+     * Obtain the number of bytes of memory allocated for the rows in this
+     * segment (see Column::getMemoryUsage). The caller must hold a lock on
+     * the segment.
+     *
+     * @return The bytes used by the columns and the deleted flags.
+     */
+    size_t getMemoryUsage() const {
+        size_t bytes = deleted.capacity() / 8;
+        for (const auto& col : cols) {
+            bytes += col.getMemoryUsage();
+        }
+        return bytes;
+    }
+
+    /**
+     * Check if a row in this segment has been deleted.
+     *
+     * @param row The zero-based row (within the segment) to check.
+     *
+     * @return This method returns true if the row was deleted.
+     */
+    bool isDeleted(const size_t row) const {
+        return numDeleted != 0 && deleted[row];
+    }
+
+    /**
+     * Delete a row in this segment. Deleted rows are only marked as
+     * deleted (rather than removed) so that the row numbers of the
+     * remaining rows (used by indexes) do not change.
+     *
+     * @param row The zero-based row (within the segment) to delete.
+     */
+    void erase(const size_t row);
+
+    /**
+     * Change the value of a column in a given row (see Column::set). Rows
+     * must be changed via this method (rather than on the column) so that
+     * the segment is known to differ from its source.
+     *
+     * @param row The zero-based row (within the segment) to be changed.
+     *
+     * @param colIdx The column to be changed.
+     *
+     * @param val The new value.
+     */
+    void set(const size_t row, const int colIdx, std::string_view val) {
+        cols[colIdx].set(row, val);
+        changed();
+    }
+
+    /**
+     * Obtain the bytes in the file this segment was loaded from that hold
+     * exactly the rows of this segment. Saving the table to a file of the
+     * same format can copy these bytes instead of writing out each row.
+     *
+     * @return The rows of this segment in the file. The view is empty if
+     * the segment was not loaded from a mapped file or has been changed
+     * since it was loaded.
+     */
+    std::string_view getSource() const { return source; }
+
+    /**
+     * Set the bytes in a mapped file that hold the rows of this segment.
+     *
+     * @param src The rows of this segment in the file. The file must stay
+     * mapped as long as this segment exists.
+     */
+    void setSource(std::string_view src) { source = src; }
+
+    /**
+     * Check if this segment has changed since it was last saved (or loaded).
+     *
+     * @return This method returns true if the segment has changed.
+     */
+    bool isUnsaved() const { return unsaved; }
+
+    /**
+     * Set if this segment differs from the file it was last saved to.
+     *
+     * @param flag The new value for the flag.
+     */
+    void setUnsaved(const bool flag) { unsaved = flag; }
+
+    /**
+     * Obtain the offset of this segment's blocks in the snapshot file the
+     * table was last saved to or loaded from (see
+     * ColumnStore::getSnapshotFile). The value is meaningful only if this
+     * segment is not unsaved.
+     *
+     * @return The offset of the blocks from the start of the file.
+     */
+    uint64_t getFileOffset() const { return fileOffset; }
+
+    /**
+     * Obtain the number of bytes in this segment's blocks in the snapshot
+     * file (see getFileOffset).
+     *
+     * @return The size of the blocks.
+     */
+    uint64_t getFileBytes() const { return fileBytes; }
+
+    /**
+     * Set where this segment's blocks are in the snapshot file.
+     *
+     * @param offset The offset of the blocks from the start of the file.
+     *
+     * @param bytes The size of the blocks.
+     */
+    void setFileBlocks(const uint64_t offset, const uint64_t bytes) {
+        fileOffset = offset;
+        fileBytes  = bytes;
+    }
+
+    /**
+     * Add the rows in this segment that satisfy an optional condition to a
+     * given list.
+     *
+     * @param colIdx The column to be checked. If this value is -1, then all
+     * the rows in this segment are added to the list.
+     *
+     * @param cond The condition to check: "=", "<>", or "like".
+     *
+     * @param value The value specified by the user.
+     *
+     * @param rows The list to which the matching row numbers are appended.
+     */
+    void findMatches(const int colIdx, const std::string& cond,
+                     const std::string& value, RowList& rows) const;
+
+    /**
+     * Add the rows in this segment whose value in a column is in a given
+     * range to a list.
+     *
+     * @param colIdx The column to be checked.
+     *
+     * @param range The range of values to look for.
+     *
+     * @param rows The list to which the matching row numbers are appended.
+     */
+    void findMatches(const int colIdx, const Range& range,
+                     RowList& rows) const;
+
+    /**
+     * Dictionary encode the columns in this segment that have few
+     * distinct values (see Column::encode).
+     */
+    void encode() {
+        for (auto& col : cols) {
+            col.encode();
+        }
+    }
+
+    /** The columns in this segment. */
+    std::vector<Column> cols;
+
+    /** A reader-writer lock to enable MT-safe operations on the rows in this
+     * segment. Queries that only read rows share the lock.
+     */
+    std::shared_mutex segMutex;
+
+private:
+    /**
+     * Remove the deleted rows from a list of rows.
+     *
+     * @param rows The list of rows in this segment.
+     */
+    void dropDeleted(RowList& rows) const;
+
+    /** Flag for each row to indicate if it has been deleted. This vector
+     * is empty until the first row in this segment is deleted.
+     */
+    std::vector<bool> deleted;
+
+    /** The number of deleted rows in this segment. */
+    size_t numDeleted = 0;
+
+    /** See getSource. */
+    std::string_view source;
+
+    /** See isUnsaved. This flag is cleared (while holding a shared lock)
+     * by the methods that save a table.
+     */
+    std::atomic<bool> unsaved = {false};
+
+    /** See getFileOffset. Guarded by ColumnStore::getSaveMutex. */
+    uint64_t fileOffset = 0;
+
+    /** See getFileBytes. Guarded by ColumnStore::getSaveMutex. */
+    uint64_t fileBytes = 0;
+
+    /**
+     * Note that the rows in this segment have changed.
+     */
+    void changed() {
+        source  = {};
+        unsaved = true;
+    }
+};
+
+/**
+ * The column-major representation of all the rows in a table.
+ */
+class ColumnStore {
+public:
+    /** The maximum number of rows stored in each segment */
+    static constexpr size_t SegmentRows = 4096;
+
+    /** Create an empty column store. */
+    ColumnStore() {}
+
+    /**
+     * Move the rows of another column store into this one. The save mutex
+     * is not moved, so neither store may be in the middle of a save.
+     *
+     * @param other The store whose rows are to be moved into this one.
+     *
+     * @return A reference to this store.
+     */
+    ColumnStore& operator=(ColumnStore&& other);
+
+    /**
+     * Replace the contents of this store with the given rows.
+     *
+     * @param rows The rows (typically loaded by CSV::load) to be stored.
+     *
+     * @param numCols The number of columns in each row.
+     */
+    void build(const std::vector<CSVRow>& rows, const int numCols);
+
+    /**
+     * Replace the contents of this store with the rows in a memory-mapped
+     * CSV file. Values are referred to directly in the file (rather than
+     * copied) unless they need unescaping. The rows are parsed the same way
+     * as CSV::load: one row per line (blank lines are skipped), with values
+     * separated by commas and optionally enclosed in double or single
+     * quotes. The segments are parsed in parallel, using one thread per
+     * core.
+     *
+     * @param file The mapped file. This store keeps the file mapped as long
+     * as it needs it.
+     *
+     * @param offset The offset in the file where the first row (i.e., the
+     * line after the header) starts.
+     *
+     * @param numCols The number of columns in each row.
+     *
+     * @exception std::runtime_error This method throws an exception if a
+     * row does not have numCols columns.
+     */
+    void load(std::shared_ptr<MappedFile> file, const size_t offset,
+              const int numCols);
+
+    /**
+     * Replace the contents of this store with segments that have already
+     * been filled in by Snapshot::load.
+     *
+     * @param segs The segments of the table. The source of each segment
+     * (if any) is in the snapshot format.
+     *
+     * @param src The mapped file that values in the segments refer to, if
+     * any. This store keeps the file mapped as long as it needs it.
+     */
+    void assign(std::vector<std::unique_ptr<Segment>> segs,
+                std::shared_ptr<MappedFile> src) {
+        segments = std::move(segs);
+        file = std::move(src);
+        snapshotSource = true;
+        snapshotFile = MappedFile::FileId(0, 0);
+        colTypes.clear();
+    }
+
+    /**
+     * Obtain the snapshot file whose segment directory lists where the
+     * saved version of each segment is (see Segment::getFileOffset).
+     * Changes can then be saved by appending just the unsaved segments to
+     * the file (see Snapshot::append).
+     *
+     * @return The identity of the file, or {0, 0} if there is no such file.
+     */
+    MappedFile::FileId getSnapshotFile() const { return snapshotFile; }
+
+    /**
+     * Set the snapshot file the segments were saved to (see
+     * getSnapshotFile).
+     *
+     * @param id The identity of the file, or {0, 0} if there is none.
+     */
+    void setSnapshotFile(const MappedFile::FileId id) { snapshotFile = id; }
+
+    /**
+     * Obtain the mutex that is used to save this table one at a time.
+     *
+     * @return The mutex to be held while saving this table.
+     */
+    std::mutex& getSaveMutex() { return saveMutex; }
+
+    /**
+     * Check if the sources of the segments (see Segment::getSource) are in
+     * the binary snapshot format rather than CSV text.
+     *
+     * @return This method returns true if the table was loaded from a
+     * snapshot.
+     */
+    bool hasSnapshotSource() const { return snapshotSource; }
+
+    /**
+     * Check if any rows have changed since the table was last saved (or
+     * loaded).
+     *
+     * @return This method returns true if any segment is unsaved.
+     */
+    bool isUnsaved() const;
+
+    /**
+     * Mark all the segments as unsaved, e.g., because saving the table
+     * failed.
+     */
+    void setUnsaved();
+
+    /**
+     * Convert a row in a segment to a row number in the table.
+     *
+     * @param segIdx The index of the segment.
+     *
+     * @param row The zero-based row within the segment.
+     *
+     * @return The row number in the table.
+     */
+    static RowId toRowId(const size_t segIdx, const size_t row) {
+        return segIdx * SegmentRows + row;
+    }
+
+    /**
+     * Obtain the number of rows in this store.
+     *
+     * @return The total number of (non-deleted) rows in all the segments.
+     */
+    size_t getRowCount() const;
+
+    /**
+     * Obtain the number of bytes of memory used by the rows in this store,
+     * including the mapped file that values may refer to. This method
+     * locks each segment in turn, so it must not be called while holding
+     * a segment's lock.
+     *
+     * @return The approximate memory used by this store, in bytes.
+     */
+    size_t getMemoryUsage();
+
+    /**
+     * Obtain the number of segments in this store.
+     *
+     * @return The number of segments in this store.
+     */
+    size_t getSegmentCount() const { return segments.size(); }
+
+    /**
+     * Obtain the type of the values in a column. The type is inferred from
+     * the values in the column when it is first needed (e.g., for a range
+     * condition) and stays the same until the table is reloaded, even if
+     * the values change. Empty values are ignored. This method must not
+     * be called while holding a segment's lock.
+     *
+     * @param colIdx The index of the column.
+     *
+     * @return Int if all the values are integers, Double if they are all
+     * numbers, and String otherwise.
+     */
+    ColumnType getColumnType(const int colIdx);
+
+    /**
+     * Obtain a segment in this store.
+     *
+     * @param segIdx The zero-based index of the segment.
+     *
+     * @return A reference to the segment.
+     */
+    Segment& getSegment(const size_t segIdx) { return *segments[segIdx]; }
+
+    /**
+     * Writes all the rows in this store to a given stream in the same
+     * format as CSV::save. The rows of segments that have not changed since
+     * they were loaded from a CSV file are copied from the file as they
+     * are, rather than written out one value at a time.
+     *
+     * @param os The output stream to where the data is to be written.
+     *
+     * @param colNames The names of the columns to be written as the header.
+     *
+     * @param delim The delimiter to use between each column.
+     *
+     * @param quote If this flag is true then each value is quoted.
+     *
+     * @param nl The string to be used for new lines.
+     *
+     * @param filter The rows to be written. If this is nullptr, all the
+     * rows that are not deleted are written.
+     */
+    void save(std::ostream& os, const StrVec& colNames,
+              const std::string& delim = ",", bool quote = true,
+              const std::string& nl = "\n",
+              const RowFilter& filter = nullptr) const;
+
+private:
+    /**
+     * Parse the rows for one segment from a memory-mapped CSV file. This
+     * method is called from multiple threads by load().
+     *
+     * @param pos Pointer to the start of the first line for the segment.
+     *
+     * @param end Pointer just past the last line for the segment.
+     *
+     * @param numRows The number of lines for the segment.
+     *
+     * @param numCols The number of columns in each row.
+     *
+     * @return The segment with the parsed rows.
+     *
+     * @exception std::runtime_error This method throws an exception if a
+     * row does not have numCols columns.
+     */
+    std::unique_ptr<Segment> parseSegment(const char* pos, const char* end,
+                                          const size_t numRows,
+                                          const int numCols) const;
+
+    /** The segments in this table. Segments are not movable (as they
+     * have a mutex), so they are held via pointers.
+     */
+    std::vector<std::unique_ptr<Segment>> segments;
+
+    /** The mapped file that values may refer to, if any. */
+    std::shared_ptr<MappedFile> file;
+
+    /** See hasSnapshotSource. */
+    bool snapshotSource = false;
+
+    /** See getSnapshotFile. Guarded by saveMutex. */
+    MappedFile::FileId snapshotFile = MappedFile::FileId(0, 0);
+
+    /** See getSaveMutex. */
+    std::mutex saveMutex;
+
+    /** The type of each column (see getColumnType). Unknown until the
+     * type is inferred. Guarded by typeMutex.
+     */
+    std::vector<ColumnType> colTypes;
+
+    /** The mutex used to infer the type of each column just once. */
+    std::mutex typeMutex;
+};
+
+#endif /* COLUMN_STORE_H */
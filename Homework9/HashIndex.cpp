@@ -0,0 +1,66 @@
+/*
+ * Implementation of the hash index on a column of a CSV.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <algorithm>
+#include <mutex>
+#include "HashIndex.h"
+
+void
+HashIndex::add(const Segment& seg, const size_t segIdx) {
+    // Group the rows of the segment by value first. The rows of a segment
+    // are consecutive, so each group goes into its list in one piece.
+    const Column& col = seg.cols.at(colIdx);
+    std::unordered_map<std::string_view, std::vector<RowId>> groups;
+    for (size_t row = 0; (row < seg.getRowCount()); row++) {
+        if (!seg.isDeleted(row)) {
+            groups[col.at(row)].push_back(ColumnStore::toRowId(segIdx, row));
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(indexMutex);
+    for (const auto& [value, rows] : groups) {
+        std::vector<RowId>& ids = entries[std::string(value)];
+        ids.insert(std::lower_bound(ids.begin(), ids.end(), rows.front()),
+                   rows.begin(), rows.end());
+    }
+}
+
+std::vector<RowId>
+HashIndex::find(const std::string& value) const {
+    std::shared_lock<std::shared_mutex> lock(indexMutex);
+    const auto entry = entries.find(value);
+    return (entry != entries.end()) ? entry->second : std::vector<RowId>();
+}
+
+void
+HashIndex::insert(std::string_view value, const RowId id) {
+    std::unique_lock<std::shared_mutex> lock(indexMutex);
+    std::vector<RowId>& ids = entries[std::string(value)];
+    if (ids.empty() || ids.back() < id) {
+        ids.push_back(id);  // Common case when the index is built
+        return;
+    }
+    const auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+    if (pos == ids.end() || *pos != id) {
+        ids.insert(pos, id);
+    }
+}
+
+void
+HashIndex::erase(std::string_view value, const RowId id) {
+    std::unique_lock<std::shared_mutex> lock(indexMutex);
+    const auto entry = entries.find(std::string(value));
+    if (entry == entries.end()) {
+        return;  // Value is not in the index.
+    }
+    std::vector<RowId>& ids = entry->second;
+    const auto pos = std::lower_bound(ids.begin(), ids.end(), id);
+    if (pos != ids.end() && *pos == id) {
+        ids.erase(pos);
+    }
+    if (ids.empty()) {
+        entries.erase(entry);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+/*
+ * A hash index on a column of a CSV. The index maps each distinct value in
+ * the column to the list of rows that have that value. This enables
+ * "where col = value" clauses to find matching rows without scanning the
+ * whole table.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include "ColumnStore.h"
+
+/**
+ * A hash index on one column of a ColumnStore. The index is MT-safe. The
+ * rows returned by the index must be re-checked against the column store
+ * (while holding the segment's lock) as the rows may change after the index
+ * has been looked up.
+ */
+class HashIndex {
+public:
+    /**
+     * Create an index on a given column.
+     *
+     * @param colIdx The index of the column on which this index is built.
+     */
+    explicit HashIndex(const int colIdx) : colIdx(colIdx) {}
+
+    /**
+     * Add all the rows in a given segment to this index. The caller must
+     * ensure the segment does not change, e.g., by locking the CSV.
+     *
+     * @param seg The segment whose rows are to be added.
+     *
+     * @param segIdx The index of the segment in the column store.
+     */
+    void add(const Segment& seg, const size_t segIdx);
+
+    /**
+     * Obtain the rows that have a given value, in ascending order.
+     *
+     * @param value The value to look for.
+     *
+     * @return The rows that had the value when this method was called.
+     */
+    std::vector<RowId> find(const std::string& value) const;
+
+    /**
+     * Record that a row has been added with a given value.
+     *
+     * @param value The value of the indexed column in the row.
+     *
+     * @param id The row that has the value.
+     */
+    void insert(std::string_view value, const RowId id);
+
+    /**
+     * Record that a row no longer has a given value (because it was
+     * updated or deleted).
+     *
+     * @param value The old value of the indexed column in the row.
+     *
+     * @param id The row that no longer has the value.
+     */
+    void erase(std::string_view value, const RowId id);
+
+    /**
+     * Obtain the column on which this index was built.
+     *
+     * @return The index of the column on which this index was built.
+     */
+    int getColumnIndex() const { return colIdx; }
+
+private:
+    /** The column on which this index is built. */
+    const int colIdx;
+
+    /** The map from each distinct value to the rows with the value. The
+     * rows are kept in ascending order, so that a lookup can return them
+     * as they are and a row can be found by binary search.
+     */
+    std::unordered_map<std::string, std::vector<RowId>> entries;
+
+    /** Reader-writer lock to enable MT-safe lookups and changes. */
+    mutable std::shared_mutex indexMutex;
+};
+
+#endif /* HASH_INDEX_H */
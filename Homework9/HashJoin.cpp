@@ -0,0 +1,87 @@
+/*
+ * Implementation of the hash join between two CSVs.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <algorithm>
+#include "HashJoin.h"
+
+HashJoin::HashJoin(const int buildKey, const int probeKey,
+                   const std::vector<Output>& outputs) :
+    buildKey(buildKey), probeKey(probeKey), outputs(outputs) {
+    for (const auto& output : outputs) {
+        if (output.build) {
+            buildCols.push_back(output.colIdx);
+        }
+    }
+}
+
+void
+HashJoin::add(const Segment& seg, const size_t segIdx, const RowList& rows) {
+    // Copy the values of the rows without holding the table's lock, as the
+    // rows may change once the segment is unlocked.
+    std::vector<std::pair<std::string_view, BuildRow>> copies;
+    copies.reserve(rows.size());
+    for (const auto row : rows) {
+        const std::string_view key = seg.cols[buildKey].at(row);
+        if (key.empty()) {
+            continue;
+        }
+        BuildRow copy{ColumnStore::toRowId(segIdx, row), StrVec()};
+        copy.values.reserve(buildCols.size());
+        for (const int colIdx : buildCols) {
+            copy.values.emplace_back(seg.cols[colIdx].at(row));
+        }
+        copies.emplace_back(key, std::move(copy));
+    }
+    std::lock_guard<std::mutex> lock(tableMutex);
+    for (auto& [key, copy] : copies) {
+        auto entry = table.find(key);
+        if (entry == table.end()) {
+            keys.emplace_back(key);
+            entry = table.emplace(keys.back(), std::vector<BuildRow>()).first;
+        }
+        entry->second.push_back(std::move(copy));
+    }
+}
+
+void
+HashJoin::finish() {
+    // The segments may have been added in any order
+    for (auto& entry : table) {
+        std::sort(entry.second.begin(), entry.second.end(),
+                  [](const BuildRow& lhs, const BuildRow& rhs) {
+                      return lhs.id < rhs.id;
+                  });
+    }
+}
+
+void
+HashJoin::probe(const Segment& seg, const RowList& rows,
+                const size_t maxLines, std::string& out) const {
+    size_t numLines = 0;
+    for (const auto row : rows) {
+        const auto entry = table.find(seg.cols[probeKey].at(row));
+        if (entry == table.end()) {
+            continue;
+        }
+        for (const BuildRow& match : entry->second) {
+            if (numLines++ == maxLines) {
+                return;
+            }
+            size_t value = 0;
+            const char* delim = "";
+            for (const auto& output : outputs) {
+                out += delim;
+                if (output.build) {
+                    out += match.values[value++];
+                } else {
+                    out += seg.cols[output.colIdx].at(row);
+                }
+                delim = "\t";
+            }
+            out += '\n';
+        }
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef HASH_JOIN_H
+#define HASH_JOIN_H
+
+/*
+ * An equi-join between two CSVs that are loaded in memory, e.g.:
+ *
+ *     select r.src, a.name from routes.csv r join airports.csv a
+ *         on r.dst = a.iata;
+ *
+ * The join builds a hash table on the smaller CSV (the build side), keyed
+ * by the value of its join column. Only the columns of the build side that
+ * are printed are kept in the table. The larger CSV (the probe side) is
+ * then scanned (in parallel, like a select), looking up the join column of
+ * each row in the hash table and writing one line for each match.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include "ColumnStore.h"
+
+/**
+ * The hash table and output columns of a join. Rows are added to the
+ * hash table (from many threads) first and then probed (from many
+ * threads). Adding and probing must not overlap.
+ */
+class HashJoin {
+public:
+    /** A column printed by the join. */
+    struct Output {
+        /** Flag to indicate if the column is in the build side CSV. */
+        bool build;
+        /** The index of the column in its CSV. */
+        int colIdx;
+    };
+
+    /**
+     * Create a join with an empty hash table.
+     *
+     * @param buildKey The join column in the build side CSV.
+     *
+     * @param probeKey The join column in the probe side CSV.
+     *
+     * @param outputs The columns printed for each pair of matching rows.
+     */
+    HashJoin(const int buildKey, const int probeKey,
+             const std::vector<Output>& outputs);
+
+    /**
+     * Add rows of the build side to the hash table. Rows whose join column
+     * is empty do not match any row and are not added. This method is
+     * MT-safe. The caller must hold a lock on the segment.
+     *
+     * @param seg The segment that contains the rows.
+     *
+     * @param segIdx The index of the segment in the column store.
+     *
+     * @param rows The rows to be added.
+     */
+    void add(const Segment& seg, const size_t segIdx, const RowList& rows);
+
+    /**
+     * Put the rows with each key in table order. This method must be called
+     * once all the rows have been added.
+     */
+    void finish();
+
+    /**
+     * Write one line for each pair of matching rows, for the given rows of
+     * the probe side. The caller must hold a lock on the segment.
+     *
+     * @param seg The segment that contains the rows.
+     *
+     * @param rows The rows of the probe side.
+     *
+     * @param maxLines The maximum number of lines to be written.
+     *
+     * @param out The string to which the lines are added.
+     */
+    void probe(const Segment& seg, const RowList& rows, const size_t maxLines,
+               std::string& out) const;
+
+private:
+    /** A row of the build side: the row and the values that are printed. */
+    struct BuildRow {
+        RowId id;
+        StrVec values;
+    };
+
+    /** The join column in the build side CSV. */
+    const int buildKey;
+
+    /** The join column in the probe side CSV. */
+    const int probeKey;
+
+    /** The columns printed for each pair of matching rows. */
+    const std::vector<Output> outputs;
+
+    /** The build side columns in outputs, in order. */
+    std::vector<int> buildCols;
+
+    /** The distinct keys in the hash table. A deque does not move them, so
+     * the table refers to them without copying them.
+     */
+    std::deque<std::string> keys;
+
+    /** The rows of the build side with each key. */
+    std::unordered_map<std::string_view, std::vector<BuildRow>> table;
+
+    /** Mutex to add rows from many threads. */
+    std::mutex tableMutex;
+};
+
+#endif /* HASH_JOIN_H */
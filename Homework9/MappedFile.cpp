@@ -0,0 +1,58 @@
+/*
+ * Implementation of the read-only memory-mapped file.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdexcept>
+#include "MappedFile.h"
+
+MappedFile::MappedFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        throw std::runtime_error("Unable to open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) == -1 || !S_ISREG(info.st_mode) ||
+        info.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Unable to map " + path);
+    }
+    void *ptr = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the file descriptor is closed.
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        throw std::runtime_error("Unable to map " + path);
+    }
+    addr   = static_cast<const char*>(ptr);
+    length = info.st_size;
+    fileId = FileId(info.st_dev, info.st_ino);
+}
+
+MappedFile::MappedFile(std::istream& is) : inMemory(true) {
+    char buf[64 * 1024];
+    while (is.read(buf, sizeof(buf)) || is.gcount() > 0) {
+        contents.append(buf, is.gcount());
+    }
+    addr   = contents.data();
+    length = contents.size();
+}
+
+MappedFile::FileId
+MappedFile::getFileId(const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) == -1) {
+        return FileId(0, 0);
+    }
+    return FileId(info.st_dev, info.st_ino);
+}
+
+MappedFile::~MappedFile() {
+    if (!inMemory) {
+        munmap(const_cast<char*>(addr), length);
+    }
+}
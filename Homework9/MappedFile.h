@@ -0,0 +1,127 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+/*
+ * A read-only, memory-mapped view of a file. Mapping a file (instead of
+ * reading it via a stream) lets the column store refer to values directly
+ * in the file's pages, without copying each value into its own string.
+ * Data that can only be read via a stream (e.g., a CSV downloaded from a
+ * web server) is read into a single buffer instead, which the column store
+ * uses the same way. All the values then come from that one allocation,
+ * which is freed in one go when the table is dropped.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <string>
+#include <istream>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/**
+ * A file mapped into memory for reading. The mapping is private, so changes
+ * made to the file by other programs may (or may not) be visible. SQLAir
+ * never writes to a mapped file. Instead, saveQuery writes a new file and
+ * renames it over the old one, which leaves the mapping intact.
+ */
+class MappedFile {
+public:
+    /** Identifies a file (rather than a path): its device and inode. */
+    using FileId = std::pair<uint64_t, uint64_t>;
+
+    /**
+     * Map the contents of a given file into memory.
+     *
+     * @param path The path to the file to be mapped.
+     *
+     * @exception Exp This constructor throws an exception if the file
+     * could not be opened or mapped (for example, if the file is empty).
+     */
+    explicit MappedFile(const std::string& path);
+
+    /**
+     * Read the rest of a given stream into memory. The data is not a file,
+     * so its identity (see getFileId) is {0, 0}.
+     *
+     * @param is The stream to be read. The data may be empty.
+     */
+    explicit MappedFile(std::istream& is);
+
+    /** The destructor unmaps the file. */
+    ~MappedFile();
+
+    /** A mapping cannot be copied */
+    MappedFile(const MappedFile&) = delete;
+
+    /** A mapping cannot be copied */
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+     * Obtain a pointer to the first byte of the file.
+     *
+     * @return Pointer to the first byte of the file.
+     */
+    const char* begin() const { return addr; }
+
+    /**
+     * Obtain a pointer just past the last byte of the file.
+     *
+     * @return Pointer just past the last byte of the file.
+     */
+    const char* end() const { return addr + length; }
+
+    /**
+     * Obtain the size of the file.
+     *
+     * @return The number of bytes in the file.
+     */
+    size_t size() const { return length; }
+
+    /**
+     * Check if a given pointer points into this file.
+     *
+     * @param ptr The pointer to be checked.
+     *
+     * @return This method returns true if ptr is within this file.
+     */
+    bool contains(const char* ptr) const {
+        return ptr >= begin() && ptr < end();
+    }
+
+    /**
+     * Obtain the identity of the mapped file. It can be compared with
+     * getFileId(path) to check if a path still refers to this file.
+     *
+     * @return The device and inode of the file.
+     */
+    FileId getFileId() const { return fileId; }
+
+    /**
+     * Obtain the identity of the file at a given path.
+     *
+     * @param path The path to the file.
+     *
+     * @return The device and inode of the file, or {0, 0} if there is no
+     * such file.
+     */
+    static FileId getFileId(const std::string& path);
+
+private:
+    /** The address at which the file is mapped. */
+    const char* addr = nullptr;
+
+    /** The number of bytes mapped. */
+    size_t length = 0;
+
+    /** See getFileId. */
+    FileId fileId = FileId(0, 0);
+
+    /** The data read from a stream, if this is not a mapped file. */
+    std::string contents;
+
+    /** Flag to indicate if the data is in contents rather than mapped. */
+    bool inMemory = false;
+};
+
+#endif /* MAPPED_FILE_H */
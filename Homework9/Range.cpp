@@ -0,0 +1,102 @@
+/*
+ * Implementation of range conditions in where clauses.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "Range.h"
+
+bool
+Range::isRange(const std::string& cond) {
+    return cond == "<" || cond == "<=" || cond == ">" || cond == ">=" ||
+        cond == "between";
+}
+
+bool
+Range::toInt(std::string_view val, int64_t& num) {
+    const char *end = val.data() + val.size();
+    const auto result = std::from_chars(val.data(), end, num);
+    return !val.empty() && result.ec == std::errc() && result.ptr == end;
+}
+
+bool
+Range::toDouble(std::string_view val, double& num) {
+    const char *end = val.data() + val.size();
+    const auto result = std::from_chars(val.data(), end, num);
+    return !val.empty() && result.ec == std::errc() && result.ptr == end &&
+        std::isfinite(num);
+}
+
+ColumnType
+Range::typeOf(std::string_view val) {
+    int64_t intVal;
+    double doubleVal;
+    if (val.empty()) {
+        return ColumnType::Unknown;
+    } else if (toInt(val, intVal)) {
+        return ColumnType::Int;
+    } else if (toDouble(val, doubleVal)) {
+        return ColumnType::Double;
+    }
+    return ColumnType::String;
+}
+
+Range::Range(const std::string& cond, const std::string& value,
+             const ColumnType type) :
+    low(-std::numeric_limits<double>::infinity()),
+    high(std::numeric_limits<double>::infinity()) {
+    if (cond == "between") {
+        const size_t sep = value.find(Separator);
+        if (sep == std::string::npos) {
+            throw std::runtime_error("Invalid between condition");
+        }
+        lowText  = value.substr(0, sep);
+        highText = value.substr(sep + 1);
+        hasLowEnd = hasHighEnd = lowIncluded = highIncluded = true;
+    } else if (cond == "<" || cond == "<=") {
+        highText     = value;
+        hasHighEnd   = true;
+        highIncluded = (cond == "<=");
+    } else if (cond == ">" || cond == ">=") {
+        lowText     = value;
+        hasLowEnd   = true;
+        lowIncluded = (cond == ">=");
+    } else {
+        throw std::runtime_error("Invalid range condition " + cond);
+    }
+    // Compare as numbers only if the column and the ends are numbers
+    if (type != ColumnType::Int && type != ColumnType::Double) {
+        return;
+    }
+    if ((hasLowEnd && !toDouble(lowText, low)) ||
+        (hasHighEnd && !toDouble(highText, high))) {
+        return;
+    }
+    kind = Real;
+    if (type == ColumnType::Int && (!hasLowEnd || toInt(lowText, lowInt)) &&
+        (!hasHighEnd || toInt(highText, highInt))) {
+        kind = Integer;
+    }
+}
+
+bool
+Range::contains(std::string_view val) const {
+    int64_t intVal;
+    double doubleVal;
+    switch (kind) {
+    case Integer:
+        if (toInt(val, intVal)) {
+            return inRange(intVal, lowInt, highInt);
+        }
+        return toDouble(val, doubleVal) && inRange(doubleVal, low, high);
+    case Real:
+        return toDouble(val, doubleVal) && inRange(doubleVal, low, high);
+    default:
+        return inRange(val, std::string_view(lowText),
+                       std::string_view(highText));
+    }
+}
@@ -0,0 +1,184 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+/*
+ * Range conditions ("<", "<=", ">", ">=", and "between") in where clauses.
+ * Values are compared according to the type of the column: in a column of
+ * numbers, values are compared as numbers (so "9" < "10"), and values that
+ * are not numbers (e.g., empty values) are not in any range. Otherwise
+ * values are compared as strings.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * The types of the values in a column. The type of a column is inferred
+ * from its values (see ColumnStore::getColumnType). The types are in order
+ * of generality: a column with Int and Double values is of type Double.
+ */
+enum class ColumnType { Unknown, Int, Double, String };
+
+/**
+ * A range of values from a where clause, such as "latitude > 40" or
+ * "altitude between 0 and 100".
+ */
+class Range {
+public:
+    /** The character separating the low and high values of a "between"
+     * condition in the value of a where clause.
+     */
+    static constexpr char Separator = '\x1f';
+
+    /**
+     * Check if the condition in a where clause is a range condition.
+     *
+     * @param cond The condition in the where clause.
+     *
+     * @return This method returns true if cond is "<", "<=", ">", ">=", or
+     * "between".
+     */
+    static bool isRange(const std::string& cond);
+
+    /**
+     * Obtain the type of a value.
+     *
+     * @param val The value to be checked.
+     *
+     * @return Int or Double if the whole value is a number, String if it
+     * is not, and Unknown if the value is empty.
+     */
+    static ColumnType typeOf(std::string_view val);
+
+    /**
+     * Convert a value to an integer.
+     *
+     * @param val The value to be converted.
+     *
+     * @param num Set to the integer, if the whole value is an integer.
+     *
+     * @return This method returns true if the value is an integer.
+     */
+    static bool toInt(std::string_view val, int64_t& num);
+
+    /**
+     * Convert a value to a (finite) number.
+     *
+     * @param val The value to be converted.
+     *
+     * @param num Set to the number, if the whole value is a number.
+     *
+     * @return This method returns true if the value is a number.
+     */
+    static bool toDouble(std::string_view val, double& num);
+
+    /**
+     * Create a range from the condition in a where clause.
+     *
+     * @param cond The range condition (see isRange).
+     *
+     * @param value The value in the where clause. For "between" this is
+     * the low and high values separated by Separator.
+     *
+     * @param type The type of the column in the where clause. Values are
+     * compared as numbers if the column and the value(s) are numbers.
+     *
+     * @exception std::runtime_error This constructor throws an exception
+     * if the condition is not a range condition.
+     */
+    Range(const std::string& cond, const std::string& value,
+          const ColumnType type);
+
+    /**
+     * Check if a value in the column is in this range.
+     *
+     * @param val The value to be checked.
+     *
+     * @return This method returns true if the value is in the range.
+     */
+    bool contains(std::string_view val) const;
+
+    /**
+     * Check if values are compared as numbers (rather than strings).
+     *
+     * @return This method returns true for numeric ranges.
+     */
+    bool isNumeric() const { return kind != Text; }
+
+    /**
+     * Obtain the low end of a numeric range. The range may exclude it.
+     *
+     * @return The low end, or -infinity if there is none.
+     */
+    double getLow() const { return low; }
+
+    /**
+     * Obtain the high end of a numeric range. The range may exclude it.
+     *
+     * @return The high end, or +infinity if there is none.
+     */
+    double getHigh() const { return high; }
+
+    /**
+     * Obtain the low end of a string range. The range may exclude it.
+     *
+     * @return The low end. An empty string if there is none.
+     */
+    const std::string& getLowText() const { return lowText; }
+
+    /**
+     * Obtain the high end of a string range. The range may exclude it.
+     *
+     * @return The high end. Check hasHigh to see if there is one.
+     */
+    const std::string& getHighText() const { return highText; }
+
+    /**
+     * Check if the range has a high end.
+     *
+     * @return This method returns false for ">" and ">=" conditions.
+     */
+    bool hasHigh() const { return hasHighEnd; }
+
+private:
+    /** How values are compared: as integers, numbers, or strings. */
+    enum Kind { Integer, Real, Text };
+
+    /**
+     * Helper method to check if a value is between the ends of this range.
+     *
+     * @param val The value to be checked.
+     *
+     * @param lo The low end of the range.
+     *
+     * @param hi The high end of the range.
+     */
+    template <typename T>
+    bool inRange(const T& val, const T& lo, const T& hi) const {
+        return (!hasLowEnd || (lowIncluded ? !(val < lo) : lo < val)) &&
+            (!hasHighEnd || (highIncluded ? !(hi < val) : val < hi));
+    }
+
+    /** How values are compared. */
+    Kind kind = Text;
+
+    /** Flags to indicate which ends the range has. */
+    bool hasLowEnd = false, hasHighEnd = false;
+
+    /** Flags to indicate if the ends are in the range. */
+    bool lowIncluded = false, highIncluded = false;
+
+    /** The ends of an Integer range. */
+    int64_t lowInt = 0, highInt = 0;
+
+    /** The ends of a numeric range (also set for Integer ranges). */
+    double low, high;
+
+    /** The ends of a Text range. */
+    std::string lowText, highText;
+};
+
+#endif /* RANGE_H */
@@ -0,0 +1,56 @@
+/*
+ * Implementation of the stream buffer that sends HTTP responses in chunks.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include "ResponseBuffer.h"
+
+ResponseBuffer::ResponseBuffer(std::ostream& os, const std::string& headers) :
+    os(os), headers(headers), buffer(BufferSize) {
+    setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+ResponseBuffer::int_type
+ResponseBuffer::overflow(int_type c) {
+    sendChunk();
+    if (!os) {
+        return traits_type::eof();  // The client has gone away
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+void
+ResponseBuffer::sendChunk() {
+    if (!chunked) {
+        // The body is larger than the buffer. So its length is not known
+        // when the headers have to be sent.
+        os << headers << "Transfer-Encoding: chunked\r\n\r\n";
+        chunked = true;
+    }
+    const size_t size = pptr() - pbase();
+    if (size > 0) {
+        os << std::hex << size << std::dec << "\r\n";
+        os.write(pbase(), size) << "\r\n";
+        os.flush();
+    }
+    setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+void
+ResponseBuffer::finish() {
+    if (chunked) {
+        sendChunk();
+        os << "0\r\n\r\n";  // The last chunk
+    } else {
+        // The whole body is in the buffer. Send it in one go.
+        os << headers << "Content-Length: " << (pptr() - pbase())
+           << "\r\n\r\n";
+        os.write(pbase(), pptr() - pbase());
+    }
+    setp(buffer.data(), buffer.data() + buffer.size());
+}
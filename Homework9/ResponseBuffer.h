@@ -0,0 +1,83 @@
+#ifndef RESPONSE_BUFFER_H
+#define RESPONSE_BUFFER_H
+
+/*
+ * A stream buffer that sends the results of a query to a web-client as
+ * they are produced. Rows are formatted directly into a fixed-size buffer.
+ * When the buffer fills up, its contents are sent to the client as a HTTP
+ * chunk (with "Transfer-Encoding: chunked") and the buffer is reused. So a
+ * large result does not have to be held in memory before it is sent.
+ * Results that fit in the buffer are sent with a "Content-Length" header,
+ * as before.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+/**
+ * A std::streambuf that writes a HTTP response body to another stream.
+ * Use it via a std::ostream and call finish() once the body is complete.
+ */
+class ResponseBuffer : public std::streambuf {
+public:
+    /** The number of bytes buffered before a chunk is sent. */
+    static constexpr size_t BufferSize = 64 * 1024;
+
+    /**
+     * Create the buffer. Nothing is written until the buffer is full or
+     * finish() is called.
+     *
+     * @param os The stream (e.g., socket) to which the response is written.
+     *
+     * @param headers The status line and headers of the response, each
+     * ending with "\r\n". The length (or chunked transfer encoding) header
+     * and the blank line are added by this class.
+     */
+    ResponseBuffer(std::ostream& os, const std::string& headers);
+
+    /**
+     * Send the remaining data and end the response. This method must be
+     * called exactly once, after the body has been written.
+     */
+    void finish();
+
+protected:
+    /**
+     * Send the buffered data as a chunk to make room for more data.
+     *
+     * @param c The character that did not fit in the buffer.
+     *
+     * @return The character, or EOF on errors.
+     */
+    int_type overflow(int_type c) override;
+
+    /**
+     * Flushing does not send a chunk, so that std::endl or std::flush on
+     * the result stream does not result in many tiny chunks.
+     *
+     * @return This method always returns 0 (success).
+     */
+    int sync() override { return 0; }
+
+private:
+    /** Send the buffered data (if any) as a chunk. */
+    void sendChunk();
+
+    /** The stream to which the response is written. */
+    std::ostream& os;
+
+    /** The status line and headers of the response. */
+    const std::string headers;
+
+    /** The buffer into which the body is written. */
+    std::vector<char> buffer;
+
+    /** Flag to indicate if the headers (and hence chunks) have been sent. */
+    bool chunked = false;
+};
+
+#endif /* RESPONSE_BUFFER_H */
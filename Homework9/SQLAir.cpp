@@ -9,18 +9,416 @@
 #include <fstream>
 #include <tuple>
 #include <algorithm>
+#include <functional>
+#include <shared_mutex>
+#include <sstream>
+#include <cstdio>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <limits>
+#include <cctype>
 #include "SQLAir.h"
 #include "HTTPFile.h"
+#include "AsyncServer.h"
+#include "ResponseBuffer.h"
+#include "Snapshot.h"
 
 /**
  * A fixed HTTP response header that is used by the runServer method below.
- * Note that this a constant (and not a global variable)
+ * Note that this a constant (and not a global variable). The value of the
+ * "Connection" header is written after this string.
  */
 const std::string HTTPRespHeader = "HTTP/1.1 200 OK\r\n"
     "Server: localhost\r\n"
-    "Connection: Close\r\n"
     "Content-Type: text/plain\r\n"
-    "Content-Length: ";
+    "Connection: ";
+
+/**
+ * The HTTP headers used when sending a data file over a persistent
+ * connection. These are the same as http::DefaultHttpHeaders except for
+ * the "Connection" header.
+ */
+const std::string HTTPFileKeepAliveHeaders = "HTTP/1.1 200 OK\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Type: ";
+
+/**
+ * The statement that the base class is parsing on this thread (if any). The
+ * query methods record their arguments (i.e., the parsed statement) in it so
+ * that SQLAir::process can cache it.
+ */
+static thread_local Statement* parsing = nullptr;
+
+/**
+ * The CSVs pinned (see SQLAir::pinCSV) by the statement being processed on
+ * this thread. A CSV appears once for each time the statement used it.
+ */
+static thread_local std::vector<CSV*> pinnedCSVs;
+
+/**
+ * A query set aside by SQLAir::waitFor. It holds the query's subscription
+ * and the CSVs it pinned (so that they are not evicted while it waits).
+ */
+struct ParkedQuery {
+    std::unique_ptr<WaitRegistry::Subscription> waiting;
+    std::vector<CSV*> pinned;
+};
+
+/**
+ * Thrown by SQLAir::waitFor to unwind a query that it parked. It is not a
+ * std::exception, so that it is not reported to the client as an error.
+ */
+struct QueryParked {};
+
+/**
+ * The function to be called to run a query parked on this thread again, or
+ * nullptr if queries processed on this thread wait instead of being parked
+ * (see SQLAir::processOrPark).
+ */
+static thread_local const SQLAir::WakeHandler* wakeHandler = nullptr;
+
+/**
+ * Record the parsed form of the statement that the base class is processing
+ * on this thread, if any. Only the first query method called while
+ * processing a statement records it.
+ *
+ * @return The statement in which the remaining details (e.g., column
+ * names) are to be recorded, or nullptr if no statement is being parsed.
+ */
+static Statement*
+recordParsed(const Statement::Kind kind, const CSV& csv, const bool mustWait,
+             const int whereColIdx, const std::string& cond,
+             const std::string& value) {
+    Statement* stmt = parsing;
+    parsing = nullptr;
+    if (stmt != nullptr) {
+        stmt->kind        = kind;
+        stmt->schemaId    = csv.schemaId;
+        stmt->mustWait    = mustWait;
+        stmt->whereColIdx = whereColIdx;
+        stmt->cond        = cond;
+        stmt->value       = value;
+    }
+    return stmt;
+}
+
+/**
+ * The range condition and value in the where clause of the statement that
+ * the base class is processing on this thread (if any). The base class
+ * accepts only "=", "<>", and "like" in where clauses. So a range
+ * condition is replaced with "=" before the statement is passed to the
+ * base class (see takeRangeClause) and put back by the query methods (see
+ * whereClause).
+ */
+static thread_local std::pair<std::string, std::string> rangeClause;
+
+/**
+ * Note the range condition (if any) in the where clause of a statement
+ * in rangeClause and replace it with a condition the base class accepts.
+ * The where clause is of the form "where col < value" (or "<=", ">",
+ * ">=") or "where col between low and high".
+ *
+ * @param sql The tokens in the statement.
+ *
+ * @return The tokens to be passed to the base class.
+ */
+static StrVec
+takeRangeClause(const StrVec& sql) {
+    rangeClause = {};
+    const size_t where = std::find(sql.begin(), sql.end(), "where") -
+        sql.begin();
+    if (where + 4 > sql.size() || !Range::isRange(sql[where + 2])) {
+        return sql;
+    }
+    const std::string& cond = sql[where + 2];
+    if (cond == "between") {
+        if (sql.size() != where + 6 || sql[where + 4] != "and") {
+            throw Exp("Invalid between clause in query");
+        }
+        rangeClause = {cond, sql[where + 3] + Range::Separator +
+                       sql[where + 5]};
+    } else {
+        if (sql.size() != where + 4) {
+            throw Exp("Invalid where clause in query");
+        }
+        rangeClause = {cond, sql[where + 3]};
+    }
+    // Leave just "where col = value" for the base class to check
+    StrVec tokens(sql.begin(), sql.begin() + where + 2);
+    tokens.insert(tokens.end(), {"=", rangeClause.second});
+    return tokens;
+}
+
+/**
+ * Obtain the condition and value in the where clause passed to a query
+ * method by the base class, putting back the range condition (if any)
+ * noted by takeRangeClause.
+ *
+ * @param cond The condition passed by the base class.
+ *
+ * @param value The value passed by the base class.
+ *
+ * @return The condition and value in the where clause of the statement.
+ */
+static std::pair<std::string, std::string>
+whereClause(const std::string& cond, const std::string& value) {
+    auto clause = std::move(rangeClause);
+    rangeClause = {};
+    return clause.first.empty() ? std::make_pair(cond, value) : clause;
+}
+
+/**
+ * Obtain the type of the column in a where clause, as needed to compare
+ * values with a range condition.
+ *
+ * @param csv The CSV that is being queried.
+ *
+ * @param whereColIdx The column in the where clause, or -1 if none.
+ *
+ * @param cond The condition in the where clause.
+ *
+ * @return The type of the column for range conditions, and String
+ * otherwise.
+ */
+static ColumnType
+whereType(CSV& csv, const int whereColIdx, const std::string& cond) {
+    return (whereColIdx != -1 && Range::isRange(cond)) ?
+        csv.columns.getColumnType(whereColIdx) : ColumnType::String;
+}
+
+/**
+ * The aggregate functions and group by clause in the select statement that
+ * the base class is processing on this thread (if any). The base class
+ * does not know about them. So they are removed from the statement before
+ * it is passed to the base class (see takeAggregates) and applied by
+ * selectQuery (see makeAggregation).
+ */
+static thread_local struct {
+    /** The function ("" for a plain column) and column ("*" for count(*))
+     * of each item in the select list.
+     */
+    std::vector<std::pair<std::string, std::string>> items;
+    /** The columns in the group by clause. */
+    StrVec groupBy;
+} aggregateClause;
+
+/**
+ * Note the aggregate functions and group by clause (if any) in a select
+ * statement in aggregateClause and replace them with a select list the
+ * base class accepts. The statement is of the form
+ * "select item, ... from <csv> [where ...] [group by col, ...]" where each
+ * item is a column or "func ( col )".
+ *
+ * @param sql The tokens in the select statement.
+ *
+ * @return The tokens to be passed to the base class.
+ */
+static StrVec
+takeAggregates(const StrVec& sql) {
+    aggregateClause = {};
+    const size_t from = std::find(sql.begin(), sql.end(), "from") -
+        sql.begin();
+    size_t end = sql.size();
+    for (size_t i = from; (i + 1 < sql.size()); i++) {
+        if (sql[i] == "group" && sql[i + 1] == "by") {
+            end = i;
+        }
+    }
+    if (from == sql.size() || (end == sql.size() &&
+        std::find(sql.begin(), sql.begin() + from, "(") ==
+        sql.begin() + from)) {
+        return sql;  // No aggregates
+    }
+    for (size_t i = 1; (i < from);) {
+        Aggregation::Function func;
+        if (i + 1 < from && sql[i + 1] == "(") {
+            if (i + 3 >= from || sql[i + 3] != ")" ||
+                !Aggregation::toFunction(sql[i], func) ||
+                (sql[i + 2] == "*" && func != Aggregation::Count)) {
+                throw Exp("Invalid aggregate in query");
+            }
+            aggregateClause.items.emplace_back(sql[i], sql[i + 2]);
+            i += 4;
+        } else {
+            aggregateClause.items.emplace_back("", sql[i++]);
+        }
+    }
+    aggregateClause.groupBy.assign(sql.begin() + std::min(end + 2,
+                                                          sql.size()),
+                                   sql.end());
+    if (aggregateClause.items.empty() ||
+        (end != sql.size() && aggregateClause.groupBy.empty())) {
+        throw Exp("Invalid aggregate in query");
+    }
+    // Leave just "select * from <csv> [where ...]" for the base class
+    StrVec tokens{sql[0], "*"};
+    tokens.insert(tokens.end(), sql.begin() + from, sql.begin() + end);
+    return tokens;
+}
+
+/**
+ * Create the aggregation noted in aggregateClause by takeAggregates.
+ *
+ * @param csv The CSV that is being queried.
+ *
+ * @return The aggregation, or nullptr if the statement has no aggregates.
+ *
+ * @exception Exp This method throws an exception if a column is not in the
+ * CSV or a plain column in the select list is not in the group by clause.
+ */
+static std::shared_ptr<const Aggregation>
+makeAggregation(CSV& csv) {
+    if (aggregateClause.items.empty()) {
+        return nullptr;
+    }
+    auto clause = std::move(aggregateClause);
+    aggregateClause = {};
+    auto colIndex = [&csv](const std::string& colName) {
+        const int colIdx = csv.getColumnIndex(colName);
+        if (colIdx == -1) {
+            throw Exp("Column " + colName + " not found in CSV");
+        }
+        return colIdx;
+    };
+    std::vector<int> groupCols;
+    for (const auto& colName : clause.groupBy) {
+        groupCols.push_back(colIndex(colName));
+    }
+    std::vector<Aggregation::Item> items;
+    std::vector<ColumnType> types;
+    for (const auto& [funcName, colName] : clause.items) {
+        Aggregation::Item item{Aggregation::Value, -1, colName};
+        if (!funcName.empty()) {
+            Aggregation::toFunction(funcName, item.func);
+            item.name = funcName + "(" + colName + ")";
+        }
+        if (colName != "*") {
+            item.colIdx = colIndex(colName);
+        }
+        if (item.func == Aggregation::Value &&
+            std::find(groupCols.begin(), groupCols.end(), item.colIdx) ==
+            groupCols.end()) {
+            throw Exp("Column " + colName + " must be in group by clause");
+        }
+        // Counts do not depend on the type of the column
+        types.push_back(item.func != Aggregation::Count ?
+                        csv.columns.getColumnType(item.colIdx) :
+                        ColumnType::String);
+        items.push_back(item);
+    }
+    return std::make_shared<Aggregation>(items, groupCols, types);
+}
+
+/**
+ * The order by and limit clauses of the select statement that the base
+ * class is processing on this thread (if any). They are removed from the
+ * statement before it is passed to the base class (see takeOrderLimit) and
+ * applied by selectQuery (see makeOrder).
+ */
+static thread_local struct {
+    /** The column (or aggregate) in the order by clause, if any. */
+    std::string column;
+    /** The order by and limit clauses, except for the column. */
+    OrderBy order;
+} orderClause;
+
+/**
+ * Helper method to convert the number in a limit clause.
+ *
+ * @param token The token that should be a number.
+ *
+ * @return The number.
+ *
+ * @exception Exp This method throws an exception if token is not a number
+ * that is zero or more.
+ */
+static size_t
+toCount(const std::string& token) {
+    int64_t num;
+    if (!Range::toInt(token, num) || num < 0) {
+        throw Exp("Invalid limit clause in query");
+    }
+    return num;
+}
+
+/**
+ * Note the order by and limit clauses (if any) at the end of a select
+ * statement in orderClause and remove them. The clauses are of the form
+ * "order by <col> [asc|desc]" and "limit <n> [offset <m>]", where the
+ * column may also be an aggregate such as "count(*)".
+ *
+ * @param sql The tokens in the select statement.
+ *
+ * @return The tokens without the order by and limit clauses.
+ */
+static StrVec
+takeOrderLimit(const StrVec& sql) {
+    orderClause = {};
+    const size_t from = std::find(sql.begin(), sql.end(), "from") -
+        sql.begin();
+    size_t end = sql.size();
+    if (end >= from + 4 && sql[end - 4] == "limit" &&
+        sql[end - 2] == "offset") {
+        orderClause.order.limit  = toCount(sql[end - 3]);
+        orderClause.order.offset = toCount(sql[end - 1]);
+        end -= 4;
+    } else if (end >= from + 2 && sql[end - 2] == "limit") {
+        orderClause.order.limit = toCount(sql[end - 1]);
+        end -= 2;
+    }
+    size_t order = end;
+    for (size_t i = from; (i + 1 < end); i++) {
+        if (sql[i] == "order" && sql[i + 1] == "by") {
+            order = i;
+        }
+    }
+    if (order != end) {
+        size_t last = end;
+        if (sql[end - 1] == "asc" || sql[end - 1] == "desc") {
+            orderClause.order.descending = (sql[--last] == "desc");
+        }
+        for (size_t i = order + 2; (i < last); i++) {
+            orderClause.column += sql[i];
+        }
+        if (orderClause.column.empty()) {
+            throw Exp("Invalid order by clause in query");
+        }
+    }
+    return StrVec(sql.begin(), sql.begin() + order);
+}
+
+/**
+ * Create the order by and limit clauses noted in orderClause by
+ * takeOrderLimit.
+ *
+ * @param csv The CSV that is being queried.
+ *
+ * @param aggregation The aggregates in the statement, if any. The rows of
+ * an aggregate query are sorted by an item in the select list.
+ *
+ * @return The order by and limit clauses.
+ *
+ * @exception Exp This method throws an exception if the column in the
+ * order by clause is not in the CSV (or the select list).
+ */
+static OrderBy
+makeOrder(CSV& csv, const Aggregation* aggregation) {
+    auto clause = std::move(orderClause);
+    orderClause = {};
+    if (!clause.column.empty()) {
+        clause.order.colIdx = (aggregation != nullptr) ?
+            aggregation->findItem(clause.column) :
+            csv.getColumnIndex(clause.column);
+        if (clause.order.colIdx == -1) {
+            throw Exp("Column " + clause.column + " not found in " +
+                      (aggregation != nullptr ? "select list" : "CSV"));
+        }
+    }
+    return clause.order;
+}
 
 // API method to perform operations associated with a "select" statement
 // to print columns that match an optional condition.
@@ -30,109 +428,332 @@ void SQLAir::selectQuery(CSV& csv, bool mustWait, StrVec colNames,
     // Convert any "*" to suitable column names.
     // With a wildcard column name, we print all of the columns in CSV
     colNames = colNames[0] == "*" ? csv.getColumnNames() : colNames;
-    // Set counter to 0
-    int numSelects = 0;
+    // Look up the index of each column once, instead of once per row
+    std::vector<int> colIdxs;
+    for (const auto& colName : colNames) {
+        colIdxs.push_back(csv.getColumnIndex(colName));
+    }
+    std::string whereCond, whereValue;
+    std::tie(whereCond, whereValue) = whereClause(cond, value);
+    const auto aggregation = makeAggregation(csv);
+    const OrderBy order = makeOrder(csv, aggregation.get());
+    if (aggregation != nullptr) {
+        if (mustWait) {
+            throw Exp("Aggregates cannot be used with wait");
+        }
+        if (Statement* stmt = recordParsed(Statement::Aggregate, csv,
+                                false, whereColIdx, whereCond, whereValue)) {
+            stmt->aggregation = aggregation;
+            stmt->order       = order;
+        }
+        aggregateRows(csv, *aggregation, whereColIdx, whereCond, whereValue,
+                      order, os);
+        return;
+    }
+    if (Statement* stmt = recordParsed(Statement::Select, csv, mustWait,
+                                       whereColIdx, whereCond, whereValue)) {
+        stmt->colNames = colNames;
+        stmt->colIdxs  = colIdxs;
+        stmt->order    = order;
+    }
+    selectRows(csv, mustWait, colNames, colIdxs, whereColIdx, whereCond,
+               whereValue, order, os);
+}
+
+/**
+ * Helper method to skip over a number of lines in a string.
+ *
+ * @param out The string with the lines.
+ *
+ * @param pos The position at which the first line starts.
+ *
+ * @param count The number of lines to be skipped. It is reduced by the
+ * number of lines actually skipped.
+ *
+ * @return The position just past the lines skipped.
+ */
+static size_t
+skipLines(const std::string& out, size_t pos, size_t& count) {
+    for (; (count > 0 && pos < out.size()); count--) {
+        pos = out.find('\n', pos) + 1;
+    }
+    return pos;
+}
+
+/**
+ * Helper method to print the rows output for a segment, skipping the rows
+ * before the offset and stopping after the limit.
+ *
+ * @param out The rows output for the segment, one per line.
+ *
+ * @param colNames The header, which is printed before the first row.
+ *
+ * @param toSkip The number of rows still to be skipped. It is reduced by
+ * the number of rows skipped.
+ *
+ * @param toPrint The number of rows still to be printed. It is reduced by
+ * the number of rows printed.
+ *
+ * @param printedHeader Flag to indicate if the header has been printed.
+ *
+ * @param os The output stream to where the rows are to be written.
+ *
+ * @return This method returns true if more rows are needed.
+ */
+static bool
+printLines(const std::string& out, const StrVec& colNames, size_t& toSkip,
+           size_t& toPrint, bool& printedHeader, std::ostream& os) {
+    const size_t start = skipLines(out, 0, toSkip);
+    const size_t end   = skipLines(out, start, toPrint);
+    if (start < end) {
+        // print colNames before the first row since they are our headers
+        if (!printedHeader) {
+            os << colNames << '\n';
+            printedHeader = true;
+        }
+        os.write(out.data() + start, end - start);
+    }
+    return toPrint > 0;
+}
+
+void
+SQLAir::selectRows(CSV& csv, bool mustWait, const StrVec& colNames,
+        const std::vector<int>& colIdxs, const int whereColIdx,
+        const std::string& cond, const std::string& value,
+        const OrderBy& order, std::ostream& os) {
+    size_t numSelects = 0;
+    // If we may have to wait, register the where clause before looking for
+    // rows so that we don't miss a change made just after we looked
+    CSV* table = &csv;
+    auto subscribe = [&] {
+        return mustWait ? table->waiters.subscribe(whereColIdx, cond, value,
+            whereType(*table, whereColIdx, cond)) : nullptr;
+    };
+    auto waiting = subscribe();
     // do while so that code executes once before checking to see if mustWait is
     // true in which case we keep looping until a row is printed
     do {
-        // loop through all rows in the file database
-        for (auto& row : csv) {
-            // Determine if this row matches "where" clause condition, if 
-            // any, and lock rows for checking
-            row.rowMutex.lock();
-            const bool isMatch = (whereColIdx == -1) ? true :
-                    matches(row.at(whereColIdx), cond, value);
-            // unlock rows after we check them
-            row.rowMutex.unlock();
-            // if there is a match, increment counter and print the output
-            if (isMatch) { 
-                numSelects++;
-                // call method to create query to be printed
-                std::string line = getOutput(csv, colNames, row, numSelects, 
-                        os);
-                // print query results
-                os << line << std::endl;
-            }
+        if (order.colIdx != -1) {
+            numSelects = selectTopRows(*table, colNames, colIdxs, whereColIdx,
+                                       cond, value, order, os);
+        } else {
+            numSelects = selectFirstRows(*table, colNames, colIdxs,
+                                         whereColIdx, cond, value, order, os);
         }
-        // if no rows were printed and mustWait is true, then we lock the method
-        // until a row is updated in the csv
+        // if no rows were printed and mustWait is true, then we wait (see
+        // waitFor) until a row is changed to match the where clause. If the
+        // CSV was replaced by a refresh (see refreshCSV), we look in the new
+        // one.
         if (numSelects == 0 && mustWait) {
-            std::unique_lock<std::mutex> lock(csv.csvMutex);
-            csv.csvCondVar.wait(lock);
+            if (CSV* replacement = getReplacement(*table)) {
+                table = replacement;
+                waiting = subscribe();
+            } else {
+                waitFor(waiting);
+            }
         }
     } while (numSelects == 0 && mustWait);
     // print how many rows were selected
     os << numSelects << " row(s) selected.\n";
 }
 
+size_t
+SQLAir::selectFirstRows(CSV& csv, const StrVec& colNames,
+        const std::vector<int>& colIdxs, const int whereColIdx,
+        const std::string& cond, const std::string& value,
+        const OrderBy& order, std::ostream& os) {
+    // No segment contributes more rows than are needed in all
+    const size_t needed = order.getNeeded();
+    size_t toSkip = order.offset, toPrint = order.limit;
+    bool printedHeader = false;
+    // format each matching row. forEachMatch holds a shared lock on the
+    // segment so rows aren't changed while we format them. The rows
+    // are printed in their original order, segment by segment.
+    forEachMatch(csv, whereColIdx, cond, value, false,
+        [&](Segment& seg, const size_t, const RowList& rows,
+            std::string& out) {
+            const size_t numRows = std::min(rows.size(), needed);
+            for (size_t i = 0; (i < numRows); i++) {
+                // format the row straight from the column store
+                writeRow(colIdxs, seg, rows[i], out);
+            }
+        },
+        [&](const std::string& out) {
+            return printLines(out, colNames, toSkip, toPrint, printedHeader,
+                              os);
+        });
+    return order.limit - toPrint;
+}
+
+size_t
+SQLAir::selectTopRows(CSV& csv, const StrVec& colNames,
+        const std::vector<int>& colIdxs, const int whereColIdx,
+        const std::string& cond, const std::string& value,
+        const OrderBy& order, std::ostream& os) {
+    // Each segment keeps its own top k without any locking, formatting
+    // only the rows that make it into its top k. These are then merged.
+    const ColumnType type = csv.columns.getColumnType(order.colIdx);
+    TopK top(order.getNeeded(), type, order.descending);
+    std::mutex topMutex;
+    forEachMatch(csv, whereColIdx, cond, value, false,
+        [&](Segment& seg, const size_t segIdx, const RowList& rows,
+            std::string&) {
+            TopK segTop(order.getNeeded(), type, order.descending);
+            const Column& col = seg.cols[order.colIdx];
+            std::string line;
+            for (const auto row : rows) {
+                const RowId id = ColumnStore::toRowId(segIdx, row);
+                if (segTop.accepts(col.at(row), id)) {
+                    line.clear();
+                    writeRow(colIdxs, seg, row, line);
+                    segTop.push(col.at(row), id, line);
+                }
+            }
+            std::lock_guard<std::mutex> lock(topMutex);
+            top.merge(segTop);
+        });
+    const std::vector<TopK::Entry> entries = top.take();
+    if (entries.size() > order.offset) {
+        os << colNames << '\n';
+    }
+    for (size_t i = order.offset; (i < entries.size()); i++) {
+        os << entries[i].line;
+    }
+    return entries.size() - std::min(order.offset, entries.size());
+}
+
+void
+SQLAir::aggregateRows(CSV& csv, const Aggregation& aggregation,
+        const int whereColIdx, const std::string& cond,
+        const std::string& value, const OrderBy& order, std::ostream& os) {
+    // Each segment is aggregated into its own partial result without any
+    // locking. The partial results are then merged one at a time.
+    Aggregation::Partial result;
+    std::mutex resultMutex;
+    forEachMatch(csv, whereColIdx, cond, value, false,
+        [&](Segment& seg, const size_t segIdx, const RowList& rows,
+            std::string&) {
+            Aggregation::Partial partial;
+            aggregation.add(seg, segIdx, rows, partial);
+            std::lock_guard<std::mutex> lock(resultMutex);
+            aggregation.merge(result, partial);
+        }, nullptr);
+    std::string out;
+    aggregation.writeHeader(out);
+    const size_t numGroups = aggregation.write(result, order, out);
+    os << out << numGroups << " row(s) selected.\n";
+}
+
 void
 SQLAir::updateQuery(CSV& csv,  bool mustWait, StrVec colNames, StrVec values, 
         const int whereColIdx, const std::string& cond, 
         const std::string& value, std::ostream& os)  {
-    // Update each row that matches an optional condition.
-    int count = 0;
-    // This is a partial implementation to show the simple logic of updating
-    // user-specified columns in a given row(s).  You can further modify the
-    // implementation as you see fit.
+    // Get the index number of the columns the user wants to update
+    std::vector<int> colIdxs;
+    for (const auto& colName : colNames) {
+        colIdxs.push_back(csv.getColumnIndex(colName));
+    }
+    std::string whereCond, whereValue;
+    std::tie(whereCond, whereValue) = whereClause(cond, value);
+    if (Statement* stmt = recordParsed(Statement::Update, csv, mustWait,
+                                       whereColIdx, whereCond, whereValue)) {
+        stmt->colIdxs = colIdxs;
+        stmt->values  = values;
+    }
+    updateRows(csv, mustWait, colIdxs, values, whereColIdx, whereCond,
+               whereValue, os);
+}
+
+void
+SQLAir::updateRows(CSV& csv, bool mustWait, const std::vector<int>& colIdxs,
+        const StrVec& values, const int whereColIdx, const std::string& cond,
+        const std::string& value, std::ostream& os) {
+    // Update each row that matches an optional condition. Segments may be
+    // updated on several threads.
+    std::atomic<int> count = {0};
+    // Register the where clause before looking for rows, if needed
+    CSV* table = &csv;
+    auto subscribe = [&] {
+        return mustWait ? table->waiters.subscribe(whereColIdx, cond, value,
+            whereType(*table, whereColIdx, cond)) : nullptr;
+    };
+    auto waiting = subscribe();
+    bool scanned;
     do {
-        // loop through all rows to see if a matching row needs updated
-        for (auto& row : csv) {
-            // lock thread so that we can carefully check to see if the rows
-            // match what we are looking for and aren't changed by another
-            // thread while we are checking
-            std::lock_guard<std::mutex> lock(row.rowMutex);
-            if (whereColIdx == -1 || matches(row.at(whereColIdx), cond, 
-                    value)) { 
-                count++;
-                // In the row, update values for each column specified by 
-                // the user
-                for (size_t i = 0; (i < colNames.size()); i++) {
-                    // lock during updates
-                    // Guard lock(CSV.csvMutex);
-                    // Get the index number of the column the user want's to
-                    // update
-                    const int colIdx = csv.getColumnIndex(colNames.at(i));
-                    // Update the corresponding column-value in the current 
-                    // row
-                    row.at(colIdx) = values.at(i);
+        // forEachMatch locks each segment exclusively so that the matching
+        // rows aren't read or changed by another thread while we update them
+        scanned = forEachMatch(*table, whereColIdx, cond, value, true,
+            [&](Segment& seg, const size_t segIdx, const RowList& rows,
+                std::string&) {
+                count += rows.size();
+                // In each matching row, update values for each column
+                // specified by the user
+                for (size_t i = 0; (i < colIdxs.size()); i++) {
+                    const Column& col = seg.cols.at(colIdxs[i]);
+                    // Keep the indexes on the column (if any) up to date
+                    const auto index  = table->getIndex(colIdxs[i]);
+                    const auto sorted = table->getSortedIndex(colIdxs[i]);
+                    const auto trigrams = table->getTrigramIndex(colIdxs[i]);
+                    for (const auto row : rows) {
+                        const RowId id = ColumnStore::toRowId(segIdx, row);
+                        // The indexes stay as they are if the value does
+                        // not change
+                        const bool changed = (col.at(row) != values.at(i));
+                        if (changed && index != nullptr) {
+                            index->erase(col.at(row), id);
+                            index->insert(values.at(i), id);
+                        }
+                        if (changed && sorted != nullptr) {
+                            sorted->erase(col.at(row), id);
+                            sorted->insert(values.at(i), id);
+                        }
+                        if (changed && trigrams != nullptr) {
+                            trigrams->erase(col.at(row), id);
+                            trigrams->insert(values.at(i), id);
+                        }
+                        seg.set(row, colIdxs[i], values.at(i));
+                        if (table->wal != nullptr) {
+                            table->wal->logUpdate(segIdx, row, colIdxs[i],
+                                               values.at(i));
+                        }
+                    }
                 }
-            }
-        }
-        // if nothing was printed and mustWait is true, then we sleep this
-        // thread and wait for another thread to finish before checking again
-        // until we finally get a row to print
-        if (count == 0 && mustWait) {
-            std::unique_lock<std::mutex> lock(csv.csvMutex);
-            csv.csvCondVar.wait(lock);
+                // Wake up waiting queries that these rows now match
+                table->waiters.notify(seg, rows);
+            });
+        if (!scanned) {
+            // The CSV was replaced by a refresh (see refreshCSV) and the
+            // changes would be lost. Make them to the new CSV instead.
+            table = getReplacement(*table);
+            waiting = subscribe();
+        } else if (count == 0 && mustWait) {
+            // if nothing was updated and mustWait is true, then we wait
+            // (see waitFor) until another thread changes a row to match our
+            // where clause, and then check again
+            waitFor(waiting);
         }
         // do once and keep doing if nothing is printed and mustWait is true
-    } while (count == 0 && mustWait);
-    // print and notify other threads that this thread is completed
+    } while (!scanned || (count == 0 && mustWait));
+    // Make the changes durable before reporting them
+    if (count != 0) {
+        commitChanges(*table);
+    }
+    // print how many rows were updated
     os << count << " row(s) updated." << std::endl;
-    csv.csvCondVar.notify_all();
-}
-
-std::string
-SQLAir::getOutput(CSV& csv, StrVec colNames, CSVRow row, int numSelects,
-                std::ostream& os) {
-    // print colNames if this is our first time through the loop
-    // since they are our headers
-    if (numSelects == 1) {
-        os << colNames << std::endl;
-    }
-    // lock the program so that when we are accessing the file, no values are 
-    // changed
-    std::lock_guard<std::mutex> lock(row.rowMutex);
-    // create beginner delimiter and query
-    std::string delim = "", query = "";
-    // loop through the columns we plan on printing and add their values from
-    // the row to our string output
-    for (const auto& colName : colNames) {
-        query += (delim + row.at(csv.getColumnIndex(colName)));
+}
+
+void
+SQLAir::writeRow(const std::vector<int>& colIdxs, const Segment& seg,
+                 const size_t row, std::string& out) {
+    // loop through the columns we plan on printing and append their values
+    // from the row. The caller holds the segment's lock.
+    const char* delim = "";
+    for (const auto colIdx : colIdxs) {
+        out += delim;
+        out += seg.cols[colIdx].at(row);
         delim = "\t";
-    } 
-    // return string output
-    return query;
+    }
+    out += '\n';
 }
 
 
@@ -145,7 +766,591 @@ SQLAir::insertQuery(CSV& csv, bool mustWait, StrVec colNames,
 void 
 SQLAir::deleteQuery(CSV& csv, bool mustWait, const int whereColIdx, 
         const std::string& cond, const std::string& value, std::ostream& os) {
-    throw Exp("delete is not yet implemented.");
+    std::string whereCond, whereValue;
+    std::tie(whereCond, whereValue) = whereClause(cond, value);
+    recordParsed(Statement::Delete, csv, mustWait, whereColIdx, whereCond,
+                 whereValue);
+    // Delete each row that matches an optional condition. Segments may be
+    // processed on several threads.
+    std::atomic<int> count = {0};
+    // Register the where clause before looking for rows, if needed
+    CSV* table = &csv;
+    auto subscribe = [&] {
+        return mustWait ? table->waiters.subscribe(whereColIdx, whereCond,
+            whereValue, whereType(*table, whereColIdx, whereCond)) : nullptr;
+    };
+    auto waiting = subscribe();
+    bool scanned;
+    do {
+        scanned = forEachMatch(*table, whereColIdx, whereCond, whereValue,
+                               true,
+            [&](Segment& seg, const size_t segIdx, const RowList& rows,
+                std::string&) {
+                count += rows.size();
+                // Remove the rows from all the indexes before deleting them
+                for (const auto& index : table->getIndexes()) {
+                    const Column& col = seg.cols.at(index->getColumnIndex());
+                    for (const auto row : rows) {
+                        index->erase(col.at(row),
+                                     ColumnStore::toRowId(segIdx, row));
+                    }
+                }
+                for (const auto& index : table->getSortedIndexes()) {
+                    const Column& col = seg.cols.at(index->getColumnIndex());
+                    for (const auto row : rows) {
+                        index->erase(col.at(row),
+                                     ColumnStore::toRowId(segIdx, row));
+                    }
+                }
+                for (const auto& index : table->getTrigramIndexes()) {
+                    const Column& col = seg.cols.at(index->getColumnIndex());
+                    for (const auto row : rows) {
+                        index->erase(col.at(row),
+                                     ColumnStore::toRowId(segIdx, row));
+                    }
+                }
+                for (const auto row : rows) {
+                    seg.erase(row);
+                    if (table->wal != nullptr) {
+                        table->wal->logDelete(segIdx, row);
+                    }
+                }
+            });
+        if (!scanned) {
+            // Delete the rows from the CSV that replaced this one (see
+            // refreshCSV) instead
+            table = getReplacement(*table);
+            waiting = subscribe();
+        } else if (count == 0 && mustWait) {
+            // Wait for another thread to change a row to match before
+            // checking again
+            waitFor(waiting);
+        }
+    } while (!scanned || (count == 0 && mustWait));
+    if (count != 0) {
+        commitChanges(*table);
+    }
+    // Deleted rows cannot satisfy any where clause. So there is no need to
+    // wake up waiting queries.
+    os << count << " row(s) deleted." << std::endl;
+}
+
+SQLAir::SQLAir() {
+    // The degree of parallelism for scans can be set via the environment.
+    // By default all the cores are used.
+    const char* dop = std::getenv("SQLAIR_SCAN_THREADS");
+    setScanThreads(dop != nullptr ? std::max(1, std::atoi(dop)) :
+                   std::thread::hardware_concurrency());
+    // Changes to tables are logged only if enabled via the environment
+    const char* wal = std::getenv("SQLAIR_WAL");
+    useWal = (wal != nullptr && std::atoi(wal) != 0);
+    // So is the asynchronous server (see runServer)
+    const char* async = std::getenv("SQLAIR_ASYNC");
+    useAsync = (async != nullptr && std::atoi(async) != 0);
+    // The memory budget (in megabytes) for CSVs is also set this way
+    const char* budget = std::getenv("SQLAIR_MEMORY_MB");
+    setMemoryBudget(budget != nullptr ?
+                    std::max(0.0, std::atof(budget)) * 1024 * 1024 : 0);
+    if (useWal) {
+        checkpointer = std::thread(&SQLAir::checkpointThread, this);
+    }
+    // CSVs loaded from URLs are refreshed once they are this many seconds
+    // old, if set via the environment
+    const char* ttl = std::getenv("SQLAIR_URL_TTL");
+    refreshInterval = std::chrono::duration<double>(
+        ttl != nullptr ? std::max(0.0, std::atof(ttl)) : 0);
+    if (refreshInterval.count() > 0) {
+        refresher = std::thread(&SQLAir::refreshThread, this);
+    }
+}
+
+SQLAir::~SQLAir() {
+    if (checkpointer.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(checkpointMutex);
+            stopCheckpoints = true;
+        }
+        checkpointCond.notify_one();
+        checkpointer.join();
+    }
+    if (refresher.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(refreshMutex);
+            stopRefresh = true;
+        }
+        refreshCond.notify_one();
+        refresher.join();
+    }
+    // Changes spilled by evicted CSVs are lost along with the others that
+    // were not saved
+    for (const auto& entry : evicted) {
+        if (!entry.second.spillFile.empty()) {
+            std::remove(entry.second.spillFile.c_str());
+        }
+    }
+}
+
+bool
+SQLAir::process(const std::string& sql, std::ostream& os) {
+    // The CSVs used by the statement may be evicted once it is done, even
+    // if it failed.
+    bool result;
+    try {
+        result = processStatement(sql, os);
+    } catch (...) {
+        unpinCSVs();
+        throw;
+    }
+    unpinCSVs();
+    return result;
+}
+
+bool
+SQLAir::processStatement(const std::string& sql, std::ostream& os) {
+    // Repeated statements are run without parsing them again
+    const std::string key = StatementCache::normalize(sql);
+    const StatementPtr cached = stmtCache.find(key);
+    if (cached != nullptr && runCached(*cached, os)) {
+        return true;
+    }
+    StrVec tokens;
+    bool mustWait;
+    int cmd;
+    std::tie(tokens, mustWait, cmd) = preprocess(sql);
+    // The base class does not know about the "create" and "convert"
+    // statements
+    if (!tokens.empty() && tokens[0] == "create") {
+        validateAndProcessCreate(tokens, mustWait, os);
+        return true;
+    } else if (!tokens.empty() && tokens[0] == "convert") {
+        validateAndProcessConvert(tokens, mustWait, os);
+        return true;
+    }
+    // Have the base class parse and run the statement. The query methods
+    // record the parsed statement (see recordParsed) for the cache.
+    auto stmt = std::make_shared<Statement>();
+    parsing = stmt.get();
+    bool result;
+    try {
+        result = SQLAirBase::process(sql, os);
+    } catch (...) {
+        parsing = nullptr;
+        rangeClause = {};
+        aggregateClause = {};
+        orderClause = {};
+        throw;
+    }
+    parsing = nullptr;
+    rangeClause = {};
+    aggregateClause = {};
+    orderClause = {};
+    if (stmt->kind != Statement::None) {
+        stmtCache.insert(key, stmt);
+    }
+    return result;
+}
+
+bool
+SQLAir::runCached(const Statement& stmt, std::ostream& os) {
+    CSV& csv = loadAndGet(stmt.fileOrURL);
+    if (csv.schemaId != stmt.schemaId) {
+        // A different CSV (or a reload of it) may have different columns.
+        // So the statement must be parsed again.
+        return false;
+    }
+    switch (stmt.kind) {
+    case Statement::Select:
+        selectRows(csv, stmt.mustWait, stmt.colNames, stmt.colIdxs,
+                   stmt.whereColIdx, stmt.cond, stmt.value, stmt.order, os);
+        break;
+    case Statement::Update:
+        updateRows(csv, stmt.mustWait, stmt.colIdxs, stmt.values,
+                   stmt.whereColIdx, stmt.cond, stmt.value, os);
+        break;
+    case Statement::Aggregate:
+        aggregateRows(csv, *stmt.aggregation, stmt.whereColIdx, stmt.cond,
+                      stmt.value, stmt.order, os);
+        break;
+    default:
+        deleteQuery(csv, stmt.mustWait, stmt.whereColIdx, stmt.cond,
+                    stmt.value, os);
+    }
+    return true;
+}
+
+void
+SQLAir::validateAndProcessSelect(const StrVec& sql, bool mustWait,
+        std::ostream& os) {
+    const StrVec tokens = takeOrderLimit(sql);
+    // The base class does not know about joins: "from <csv> [alias] join"
+    const size_t from = std::find(tokens.begin(), tokens.end(), "from") -
+        tokens.begin();
+    if ((from + 2 < tokens.size() && tokens[from + 2] == "join") ||
+        (from + 3 < tokens.size() && tokens[from + 3] == "join")) {
+        validateAndProcessJoin(tokens, mustWait, os);
+        return;
+    }
+    SQLAirBase::validateAndProcessSelect(
+        takeRangeClause(takeAggregates(tokens)), mustWait, os);
+}
+
+void
+SQLAir::validateAndProcessJoin(const StrVec& sql, bool mustWait,
+        std::ostream& os) {
+    // The tokens must be: select <cols> from <csv> [alias] join <csv>
+    // [alias] on <col> = <col> [where <col> <cond> <value>]
+    const size_t from = std::find(sql.begin(), sql.end(), "from") -
+        sql.begin();
+    const size_t join = std::find(sql.begin() + from, sql.end(), "join") -
+        sql.begin();
+    const size_t on = std::find(sql.begin() + join, sql.end(), "on") -
+        sql.begin();
+    if (on > join + 3 || on + 4 > sql.size() || sql[on + 2] != "=" ||
+        (on + 4 < sql.size() && sql[on + 4] != "where")) {
+        throw Exp("Invalid join in query");
+    }
+    if (mustWait) {
+        throw Exp("Joins cannot be used with wait");
+    }
+    const OrderBy order = orderClause.order;
+    if (!orderClause.column.empty()) {
+        throw Exp("Order by cannot be used with join");
+    }
+    orderClause = {};
+    // A column is referred to as <table>.<col> (where the table is the
+    // alias, or the name of the file with or without its extension) or
+    // just <col> if only one of the CSVs has the column.
+    CSV* csvs[2] = {&loadAndGet(sql[from + 1]), &loadAndGet(sql[join + 1])};
+    auto tableNames = [](const std::string& path, const std::string& alias) {
+        const std::string file = path.substr(path.rfind('/') + 1);
+        return StrVec{file, file.substr(0, file.rfind('.')), alias};
+    };
+    const StrVec tables[2] = {
+        tableNames(sql[from + 1], (join == from + 3) ? sql[from + 2] : ""),
+        tableNames(sql[join + 1], (on == join + 3) ? sql[join + 2] : "")};
+    auto resolve = [&](const std::string& name) {
+        const size_t dot = name.rfind('.');
+        for (int side = 0; (dot != std::string::npos && side < 2); side++) {
+            const auto& names = tables[side];
+            if (std::find(names.begin(), names.end(), name.substr(0, dot)) !=
+                names.end()) {
+                const int colIdx = csvs[side]->getColumnIndex(
+                    name.substr(dot + 1));
+                if (colIdx != -1) {
+                    return HashJoin::Output{side == 1, colIdx};
+                }
+            }
+        }
+        const int left = csvs[0]->getColumnIndex(name);
+        const int right = csvs[1]->getColumnIndex(name);
+        if (left != -1 && right != -1) {
+            throw Exp("Column " + name + " is in both CSVs");
+        } else if (left == -1 && right == -1) {
+            throw Exp("Column " + name + " not found in CSV");
+        }
+        return HashJoin::Output{left == -1, (left == -1) ? right : left};
+    };
+    // The columns to be printed. The build flag is set for the right CSV.
+    StrVec colNames;
+    std::vector<HashJoin::Output> outputs;
+    if (from == 2 && sql[1] == "*") {
+        for (int side = 0; (side < 2); side++) {
+            const StrVec names = csvs[side]->getColumnNames();
+            for (size_t colIdx = 0; (colIdx < names.size()); colIdx++) {
+                colNames.push_back(names[colIdx]);
+                outputs.push_back({side == 1, int(colIdx)});
+            }
+        }
+    } else {
+        colNames.assign(sql.begin() + 1, sql.begin() + from);
+        for (const auto& colName : colNames) {
+            outputs.push_back(resolve(colName));
+        }
+    }
+    if (colNames.empty()) {
+        throw Exp("Column names not specified");
+    }
+    // The join columns, in left and right order
+    HashJoin::Output keys[2] = {resolve(sql[on + 1]), resolve(sql[on + 3])};
+    if (keys[0].build == keys[1].build) {
+        throw Exp("Invalid join in query");
+    } else if (keys[0].build) {
+        std::swap(keys[0], keys[1]);
+    }
+    // The where clause applies to the rows of one of the CSVs
+    HashJoin::Output whereCol{false, -1};
+    std::string cond, value;
+    if (on + 4 < sql.size()) {
+        if (on + 8 == sql.size() && Range::isRange(sql[on + 6]) &&
+            sql[on + 6] != "between") {
+            value = sql[on + 7];
+        } else if (on + 8 == sql.size() &&
+                   (sql[on + 6] == "=" || sql[on + 6] == "<>" ||
+                    sql[on + 6] == "like")) {
+            value = sql[on + 7];
+        } else if (on + 10 == sql.size() && sql[on + 6] == "between" &&
+                   sql[on + 8] == "and") {
+            value = sql[on + 7] + Range::Separator + sql[on + 9];
+        } else {
+            throw Exp("Invalid where clause in query");
+        }
+        whereCol = resolve(sql[on + 5]);
+        cond = sql[on + 6];
+    }
+    // Build the hash table on the smaller CSV and stream the larger one
+    const bool buildLeft = (csvs[0]->columns.getRowCount() <
+                            csvs[1]->columns.getRowCount());
+    if (buildLeft) {
+        for (auto& output : outputs) {
+            output.build = !output.build;
+        }
+        whereCol.build = !whereCol.build;
+    }
+    HashJoin hashJoin(keys[buildLeft ? 0 : 1].colIdx,
+                      keys[buildLeft ? 1 : 0].colIdx, outputs);
+    joinRows(*csvs[buildLeft ? 0 : 1], *csvs[buildLeft ? 1 : 0], hashJoin,
+             colNames, whereCol.build, whereCol.colIdx, cond, value, order,
+             os);
+}
+
+void
+SQLAir::joinRows(CSV& build, CSV& probe, HashJoin& hashJoin,
+        const StrVec& colNames, const bool whereOnBuild,
+        const int whereColIdx, const std::string& cond,
+        const std::string& value, const OrderBy& order, std::ostream& os) {
+    // The where clause (if any) applies to one of the sides only
+    const std::string none;
+    // Add the matching rows of the build side to the hash table
+    forEachMatch(build, whereOnBuild ? whereColIdx : -1,
+        whereOnBuild ? cond : none, value, false,
+        [&](Segment& seg, const size_t segIdx, const RowList& rows,
+            std::string&) {
+            hashJoin.add(seg, segIdx, rows);
+        });
+    hashJoin.finish();
+    // Look up the matching rows of the probe side in the hash table. The
+    // pairs are printed in the order of the probe side.
+    const size_t needed = order.getNeeded();
+    size_t toSkip = order.offset, toPrint = order.limit;
+    bool printedHeader = false;
+    forEachMatch(probe, whereOnBuild ? -1 : whereColIdx,
+        whereOnBuild ? none : cond, value, false,
+        [&](Segment& seg, const size_t, const RowList& rows,
+            std::string& out) {
+            hashJoin.probe(seg, rows, needed, out);
+        },
+        [&](const std::string& out) {
+            return printLines(out, colNames, toSkip, toPrint, printedHeader,
+                              os);
+        });
+    os << (order.limit - toPrint) << " row(s) selected.\n";
+}
+
+void
+SQLAir::validateAndProcessUpdate(const StrVec& sql, bool mustWait,
+        std::ostream& os) {
+    SQLAirBase::validateAndProcessUpdate(takeRangeClause(sql), mustWait, os);
+}
+
+void
+SQLAir::validateAndProcessDelete(const StrVec& sql, bool mustWait,
+        std::ostream& os) {
+    SQLAirBase::validateAndProcessDelete(takeRangeClause(sql), mustWait, os);
+}
+
+void
+SQLAir::validateAndProcessCreate(const StrVec& sql, bool mustWait,
+        std::ostream& os) {
+    // The tokens must be: create [sorted|trigram] index on <csv> ( <col> )
+    IndexKind kind = IndexKind::Hash;
+    if (sql.size() > 1 && sql[1] == "sorted") {
+        kind = IndexKind::Sorted;
+    } else if (sql.size() > 1 && sql[1] == "trigram") {
+        kind = IndexKind::Trigram;
+    }
+    const size_t i = (kind == IndexKind::Hash) ? 1 : 2;
+    if (sql.size() != i + 6 || sql[i] != "index" || sql[i + 1] != "on" ||
+        sql[i + 3] != "(" || sql[i + 5] != ")") {
+        throw Exp("Invalid create index statement");
+    }
+    CSV& csv = loadAndGet(sql[i + 2]);
+    const int colIdx = csv.getColumnIndex(sql[i + 4]);
+    if (colIdx == -1) {
+        throw Exp("Column " + sql[i + 4] + " not found in CSV");
+    }
+    createIndexQuery(csv, colIdx, kind, os);
+}
+
+void
+SQLAir::validateAndProcessConvert(const StrVec& sql, bool mustWait,
+        std::ostream& os) {
+    // The tokens must be: convert <file> to <file>
+    if (sql.size() != 4 || sql[2] != "to") {
+        throw Exp("Invalid convert statement");
+    }
+    if (sql[1].find("http://") == 0 || sql[3].find("http://") == 0) {
+        throw Exp("Convert works only with local files");
+    }
+    // The file is converted without adding it to the in-memory CSVs
+    CSV csv;
+    loadFromFile(csv, sql[1]);
+    saveToFile(csv, sql[3]);
+    os << sql[1] << " converted to " << sql[3] << ".\n";
+}
+
+void
+SQLAir::createIndexQuery(CSV& csv, const int colIdx, const IndexKind kind,
+                         std::ostream& os) {
+    // A sorted index orders the values according to the column's type,
+    // which is inferred before the CSV is locked.
+    const ColumnType type = (kind == IndexKind::Sorted) ?
+        csv.columns.getColumnType(colIdx) : ColumnType::String;
+    // Get exclusive access to the CSV so that no rows change until the
+    // index has been added to the CSV.
+    std::unique_lock<CSV> csvLock(csv);
+    if (csv.retired) {
+        // Add the index to the CSV that replaced this one instead
+        csvLock.unlock();
+        createIndexQuery(*getReplacement(csv), colIdx, kind, os);
+        return;
+    }
+    // Helper lambda to add all the rows to a new index
+    auto build = [&csv](auto index) {
+        for (size_t s = 0; (s < csv.columns.getSegmentCount()); s++) {
+            index->add(csv.columns.getSegment(s), s);
+        }
+        return index;
+    };
+    if (kind == IndexKind::Sorted) {
+        csv.addSortedIndex(build(std::make_shared<SortedIndex>(colIdx,
+                                                               type)));
+        os << "Sorted index";
+    } else if (kind == IndexKind::Trigram) {
+        csv.addTrigramIndex(build(std::make_shared<TrigramIndex>(colIdx)));
+        os << "Trigram index";
+    } else {
+        csv.addIndex(build(std::make_shared<HashIndex>(colIdx)));
+        os << "Index";
+    }
+    os << " created on " << csv.getColumnNames().at(colIdx) << ".\n";
+}
+
+bool
+SQLAir::forEachMatch(CSV& csv, const int whereColIdx, const std::string& cond,
+        const std::string& value, const bool exclusive,
+        const MatchHandler& handler, const OutputHandler& output) {
+    // Many queries can work on the CSV at the same time. Only changes to
+    // the structure of the CSV (see createIndexQuery) need it to themselves.
+    std::shared_lock<CSV> csvLock(csv);
+    if (csv.retired) {
+        return false;  // Changes made to it now would be lost
+    }
+    // Helper lambda to lock a segment, use findRows to fill in the matching
+    // rows in it, and call the handler. Queries that only read rows share
+    // the segment's lock. Queries that change rows lock it exclusively.
+    auto visit = [&](const size_t segIdx, RowList& rows, std::string& out,
+                     auto findRows) {
+        Segment& seg = csv.columns.getSegment(segIdx);
+        std::shared_lock<std::shared_mutex> readLock(seg.segMutex,
+                                                     std::defer_lock);
+        std::unique_lock<std::shared_mutex> writeLock(seg.segMutex,
+                                                      std::defer_lock);
+        exclusive ? writeLock.lock() : readLock.lock();
+        rows.clear();
+        findRows(seg, rows);
+        if (!rows.empty()) {
+            handler(seg, segIdx, rows, out);
+        }
+    };
+    // A range condition compares values according to the column's type
+    const std::unique_ptr<Range> range = Range::isRange(cond) ?
+        std::make_unique<Range>(cond, value,
+                                csv.columns.getColumnType(whereColIdx)) :
+        nullptr;
+    // Look for an index that can find the matching rows
+    std::vector<RowId> ids;
+    bool useIndex = false;
+    if (range != nullptr) {
+        const auto sorted = csv.getSortedIndex(whereColIdx);
+        if (sorted != nullptr && sorted->canFind(*range)) {
+            ids = sorted->find(*range);
+            useIndex = true;
+        }
+    } else if (whereColIdx != -1 && cond == "=") {
+        const auto index = csv.getIndex(whereColIdx);
+        if (index != nullptr) {
+            ids = index->find(value);
+            useIndex = true;
+        }
+    } else if (whereColIdx != -1 && cond == "like") {
+        const auto trigrams = csv.getTrigramIndex(whereColIdx);
+        if (trigrams != nullptr && TrigramIndex::canFind(value)) {
+            ids = trigrams->find(value);
+            useIndex = true;
+        }
+    }
+    if (!useIndex) {
+        // No suitable index. Scan the column in each segment, spreading the
+        // segments over the scan pool. Each worker reuses its own list of
+        // rows. The output of each segment is kept until it can be passed
+        // on in order.
+        const size_t numSegs = csv.columns.getSegmentCount();
+        std::vector<RowList> rowLists(scanPool->getThreads());
+        std::vector<std::string> outs(numSegs);
+        scanPool->run(numSegs,
+            [&](const size_t segIdx, const size_t worker) {
+                visit(segIdx, rowLists[worker], outs[segIdx],
+                    [&](Segment& seg, RowList& rows) {
+                        if (range != nullptr) {
+                            seg.findMatches(whereColIdx, *range, rows);
+                        } else {
+                            seg.findMatches(whereColIdx, cond, value, rows);
+                        }
+                    });
+            },
+            [&](const size_t segIdx) {
+                const bool more = (!output || outs[segIdx].empty() ||
+                                   output(outs[segIdx]));
+                std::string().swap(outs[segIdx]);  // Free the memory
+                return more;
+            });
+        return true;
+    }
+    // The ids from the index are in ascending order, so the rows in each
+    // segment are next to each other. There are few such rows. So the
+    // segments are simply visited on this thread.
+    RowList rows;
+    std::string out;
+    for (size_t i = 0; (i < ids.size());) {
+        const size_t segIdx = ids[i] / ColumnStore::SegmentRows;
+        visit(segIdx, rows, out, [&](Segment& seg, RowList& rows) {
+            for (; (i < ids.size() &&
+                    ids[i] / ColumnStore::SegmentRows == segIdx); i++) {
+                // Recheck the row, as it may have changed since the look up.
+                // Rows from a trigram index are only candidates.
+                const size_t row = ids[i] % ColumnStore::SegmentRows;
+                const std::string_view colVal = seg.cols[whereColIdx].at(row);
+                if (seg.isDeleted(row)) {
+                    continue;
+                }
+                if (range != nullptr ? range->contains(colVal) :
+                    (cond == "like" ? colVal.find(value) != colVal.npos :
+                     colVal == value)) {
+                    rows.push_back(row);
+                }
+            }
+        });
+        if (output && !out.empty() && !output(out)) {
+            return true;  // No more output is needed
+        }
+        out.clear();
+    }
+    return true;
+}
+
+void
+SQLAir::setScanThreads(const size_t numThreads) {
+    scanPool = std::make_unique<ScanPool>(numThreads);
 }
 
 //-------------------------------------------------------------------------
@@ -153,23 +1358,115 @@ SQLAir::deleteQuery(CSV& csv, bool mustWait, const int whereColIdx,
 // Convenience helper method to return the CSV object for a given
 // file or URL.
 CSV& SQLAir::loadAndGet(std::string fileOrURL) {
-    // Check if the specified fileOrURL is already loaded in a thread-safe
-    // manner to avoid race conditions on the unordered_map
+    if (parsing != nullptr) {
+        // Record the CSV as given in the statement being parsed. A cached
+        // statement without a CSV must use the recent CSV when it is run.
+        parsing->fileOrURL = fileOrURL;
+    }
+    // Helper lambda to check if a CSV is not being evicted. The caller must
+    // hold recentCSVMutex.
+    auto notEvicting = [this, &fileOrURL] {
+        const auto entry = inMemoryCSV.find(fileOrURL);
+        return entry == inMemoryCSV.end() || !entry->second.evicting;
+    };
+    // Check if the specified fileOrURL is already loaded (or being loaded)
+    // in a thread-safe manner to avoid race conditions on the unordered_map
+    std::promise<void> done;
+    Evicted spilled;
     {
-        std::lock_guard<std::mutex> guard(recentCSVMutex);
+        std::unique_lock<std::mutex> guard(recentCSVMutex);
         // Use recent CSV if parameter was empty string.
         fileOrURL = (fileOrURL.empty() ? recentCSV : fileOrURL);
         // Update the most recently used CSV for the next round
         recentCSV = fileOrURL;
-        if (inMemoryCSV.find(fileOrURL) != inMemoryCSV.end()) {
-            // Requested CSV is already in memory. Just return it.
-            return inMemoryCSV.at(fileOrURL);
+        while (true) {
+            // A CSV being evicted may have to be loaded from its spill file
+            evictCond.wait(guard, notEvicting);
+            if (inMemoryCSV.find(fileOrURL) != inMemoryCSV.end()) {
+                // Requested CSV is already in memory. Just return it.
+                return pinCSV(inMemoryCSV.at(fileOrURL));
+            }
+            const auto loader = loading.find(fileOrURL);
+            if (loader == loading.end()) {
+                break;
+            }
+            // Another thread is loading the CSV. Wait for it and use its
+            // CSV (or report the same error). The loader's exception is
+            // shared by all the waiting threads, so each throws a copy.
+            const std::shared_future<void> loaded = loader->second;
+            guard.unlock();
+            try {
+                loaded.get();
+            } catch (const std::exception& e) {
+                throw Exp(e.what());
+            }
+            guard.lock();
+        }
+        // This thread loads the CSV, while the others wait for it
+        loading.emplace(fileOrURL, done.get_future().share());
+        if (evicted.find(fileOrURL) != evicted.end()) {
+            spilled = evicted.at(fileOrURL);
         }
     }
     // When control drops here, we need to load the CSV into memory.
     // Loading or I/O is being done outside critical sections
     CSV csv;   // Load data into this csv
-    if (fileOrURL.find("http://") == 0) {
+    try {
+        loadCSV(csv, fileOrURL, spilled.spillFile);
+    } catch (...) {
+        std::lock_guard<std::mutex> guard(recentCSVMutex);
+        loading.erase(fileOrURL);
+        done.set_exception(std::current_exception());
+        throw;
+    }
+    const size_t memUsage = (memoryBudget != 0) ?
+        csv.columns.getMemoryUsage() : 0;
+
+    // We get to this line of code only if the above load did not throw
+    // any exceptions. In this case we have a valid CSV to add to our
+    // inMemoryCSV list. We need to do that in a thread-safe manner.
+    std::unique_lock<std::mutex> guard(recentCSVMutex);
+    // Move (instead of copy) the CSV data into our in-memory CSVs
+    CSV& loaded = inMemoryCSV[fileOrURL];
+    loaded.move(csv);
+    loaded.columns = std::move(csv.columns);
+    loaded.wal = std::move(csv.wal);
+    loaded.schemaId = ++lastSchemaId;
+    loaded.memUsage = memUsage;
+    loaded.etag = csv.etag;
+    loaded.lastModified = csv.lastModified;
+    loaded.contentHash = csv.contentHash;
+    loaded.fetchedAt = std::chrono::steady_clock::now();
+    pinCSV(loaded);
+    evicted.erase(fileOrURL);
+    loading.erase(fileOrURL);
+    guard.unlock();
+    done.set_value();
+    if (!spilled.spillFile.empty()) {
+        // The file stays mapped as long as the CSV refers to it
+        std::remove(spilled.spillFile.c_str());
+    }
+    // Rebuild the indexes the CSV had when it was evicted
+    std::ostringstream discard;
+    for (const auto& index : spilled.indexes) {
+        createIndexQuery(loaded, index.second, index.first, discard);
+    }
+    // Make room for this CSV by evicting others, if needed
+    evictCSVs();
+    // Return a reference to the in-memory CSV (not temporary one)
+    return loaded;
+}
+
+void
+SQLAir::loadCSV(CSV& csv, const std::string& fileOrURL,
+                const std::string& spillFile) {
+    if (!spillFile.empty()) {
+        // The CSV had unsaved changes when it was evicted. They are still
+        // to be saved to the CSV's own file.
+        loadFromFile(csv, spillFile);
+        csv.columns.setUnsaved();
+        csv.columns.setSnapshotFile(MappedFile::FileId(0, 0));
+    } else if (fileOrURL.find("http://") == 0) {
         // This is an URL. We have to get the stream from a web-server
         // Implement this feature.
         std::string host, port, path;
@@ -179,32 +1476,450 @@ CSV& SQLAir::loadAndGet(std::string fileOrURL) {
         loadFromURL(csv, host, port, Helper::url_decode(path));
     } else {
         // We assume it is a local file on the server. Load that file.
-        std::ifstream data(fileOrURL);
         // This method may throw exceptions on errors.
-        csv.load(data);
+        if (useWal) {
+            WriteAheadLog::recover(fileOrURL);
+        }
+        loadFromFile(csv, fileOrURL);
+        if (useWal) {
+            // Apply the changes made since the file was last written
+            csv.wal = std::make_unique<WriteAheadLog>(fileOrURL);
+            csv.wal->replay(csv.columns);
+        }
     }
-    
-    // We get to this line of code only if the above if-else to load the
-    // CSV did not throw any exceptions. In this case we have a valid CSV
-    // to add to our inMemoryCSV list. We need to do that in a thread-safe
-    // manner.
-    std::lock_guard<std::mutex> guard(recentCSVMutex);
-    // Move (instead of copy) the CSV data into our in-memory CSVs
-    inMemoryCSV[fileOrURL].move(csv);
-    // Return a reference to the in-memory CSV (not temporary one)
-    return inMemoryCSV.at(fileOrURL);
+}
+
+void
+SQLAir::waitFor(std::unique_ptr<WaitRegistry::Subscription>& waiting) {
+    if (wakeHandler == nullptr) {
+        waiting->wait();
+        return;
+    }
+    // The parked query is complete before it is handed to the registry,
+    // which may wake it (on another thread) right away.
+    auto parked = std::make_shared<ParkedQuery>();
+    WaitRegistry::Subscription& subscription = *waiting;
+    parked->waiting = std::move(waiting);
+    parked->pinned.swap(pinnedCSVs);
+    const WakeHandler onWake = *wakeHandler;
+    if (!subscription.park([onWake, parked] { onWake(parked); })) {
+        // Rows changed since the query looked. So it looks again.
+        waiting = std::move(parked->waiting);
+        pinnedCSVs.swap(parked->pinned);
+        return;
+    }
+    throw QueryParked();
+}
+
+CSV&
+SQLAir::pinCSV(CSV& csv) {
+    csv.pins++;
+    csv.lastUsed = ++useCount;
+    pinnedCSVs.push_back(&csv);
+    return csv;
+}
+
+void
+SQLAir::unpinCSVs() {
+    std::vector<CSV*> pinned;
+    pinned.swap(pinnedCSVs);
+    for (CSV* csv : pinned) {
+        // The CSV is still pinned, so it can be measured without the lock
+        const size_t memUsage = (memoryBudget != 0) ?
+            csv->columns.getMemoryUsage() : 0;
+        decltype(inMemoryCSV)::node_type retired;
+        std::lock_guard<std::mutex> guard(recentCSVMutex);
+        csv->memUsage = memUsage;
+        if (--csv->pins == 0 && !retiredCSVs.empty()) {
+            // Free the CSV if it was replaced by a refresh (see refreshCSV)
+            const auto entry = std::find_if(retiredCSVs.begin(),
+                retiredCSVs.end(), [csv](const auto& node) {
+                    return &node.mapped() == csv; });
+            if (entry != retiredCSVs.end()) {
+                retired = std::move(*entry);
+                retiredCSVs.erase(entry);
+            }
+        }
+    }
+    evictCSVs();
+}
+
+void
+SQLAir::evictCSVs() {
+    if (memoryBudget == 0) {
+        return;
+    }
+    // Pick the CSVs to be evicted, least recently used first. The most
+    // recently used CSV stays, even if it alone is over the budget, as
+    // the next statement is likely to use it again.
+    std::vector<std::pair<std::string, CSV*>> victims;
+    {
+        std::lock_guard<std::mutex> guard(recentCSVMutex);
+        size_t memUsage = 0;
+        for (const auto& entry : inMemoryCSV) {
+            memUsage += entry.second.memUsage;
+        }
+        while (memUsage > memoryBudget) {
+            std::pair<const std::string, CSV>* lru = nullptr;
+            for (auto& entry : inMemoryCSV) {
+                const CSV& csv = entry.second;
+                if (csv.pins == 0 && !csv.evicting &&
+                    csv.lastUsed != useCount &&
+                    (lru == nullptr || csv.lastUsed < lru->second.lastUsed)) {
+                    lru = &entry;
+                }
+            }
+            if (lru == nullptr) {
+                break;  // The rest are in use
+            }
+            lru->second.evicting = true;
+            memUsage -= lru->second.memUsage;
+            victims.emplace_back(lru->first, &lru->second);
+        }
+    }
+    for (const auto& victim : victims) {
+        evictCSV(victim.first, *victim.second);
+    }
+}
+
+std::vector<std::pair<SQLAir::IndexKind, int>>
+SQLAir::getIndexKinds(CSV& csv) {
+    std::vector<std::pair<IndexKind, int>> indexes;
+    for (const auto& index : csv.getIndexes()) {
+        indexes.emplace_back(IndexKind::Hash, index->getColumnIndex());
+    }
+    for (const auto& index : csv.getSortedIndexes()) {
+        indexes.emplace_back(IndexKind::Sorted, index->getColumnIndex());
+    }
+    for (const auto& index : csv.getTrigramIndexes()) {
+        indexes.emplace_back(IndexKind::Trigram, index->getColumnIndex());
+    }
+    return indexes;
+}
+
+void
+SQLAir::evictCSV(const std::string& fileOrURL, CSV& csv) {
+    // No statement can use the CSV from here on (see loadAndGet)
+    Evicted info;
+    info.indexes = getIndexKinds(csv);
+    // Changes that are logged are replayed when the CSV is loaded again.
+    // Other changes are spilled to a snapshot.
+    if (csv.wal == nullptr && csv.columns.isUnsaved()) {
+        static std::atomic<unsigned long> spillCount = {0};
+        info.spillFile = std::string(P_tmpdir) + "/sqlair_" +
+            std::to_string(getpid()) + "_" + std::to_string(++spillCount) +
+            Snapshot::Extension;
+        try {
+            saveToFile(csv, info.spillFile);
+        } catch (const std::exception& e) {
+            std::cerr << "Unable to evict " << fileOrURL << ": " << e.what()
+                      << std::endl;
+            std::remove((info.spillFile + ".tmp").c_str());
+            std::lock_guard<std::mutex> guard(recentCSVMutex);
+            csv.evicting = false;
+            evictCond.notify_all();
+            return;
+        }
+    }
+    decltype(inMemoryCSV)::node_type node;
+    {
+        std::lock_guard<std::mutex> guard(recentCSVMutex);
+        evicted[fileOrURL] = std::move(info);
+        node = inMemoryCSV.extract(fileOrURL);
+    }
+    evictCond.notify_all();
+    // The CSV's memory is freed (when the node goes away) without holding
+    // the lock.
 }
 
 // Save the currently loaded CSV file to a local file.
 void 
 SQLAir::saveQuery(std::ostream& os) {
-    if (recentCSV.empty() || recentCSV.find("http://") == 0) {
+    std::unique_lock<std::mutex> guard(recentCSVMutex);
+    const std::string path = recentCSV;
+    if (path.empty() || path.find("http://") == 0) {
         throw Exp("Saving CSV to an URL using POST is not implemented");
     }
-    // Create a local file and have the CSV write itself.
-    std::ofstream csvData(recentCSV);
-    inMemoryCSV.at(recentCSV).save(csvData);
-    os << recentCSV << " saved.\n";
+    guard.unlock();
+    // The CSV may have been evicted, in which case it is loaded again
+    CSV& csv = loadAndGet(path);
+    if (csv.wal != nullptr) {
+        // Saving the file folds the log into it
+        checkpoint(csv);
+    } else if (csv.columns.isUnsaved()) {
+        // The file is written only if rows changed since it was written
+        try {
+            saveToFile(csv, path);
+        } catch (...) {
+            csv.columns.setUnsaved();
+            throw;
+        }
+    }
+    os << path << " saved.\n";
+}
+
+void
+SQLAir::commitChanges(CSV& csv) {
+    if (csv.wal == nullptr) {
+        return;
+    }
+    csv.wal->commit();
+    if (csv.wal->needsCheckpoint()) {
+        // Have the log folded into the file in the background
+        std::lock_guard<std::mutex> guard(checkpointMutex);
+        if (checkpointQueue.insert(&csv).second) {
+            // Keep the CSV in memory until the checkpoint is done
+            std::lock_guard<std::mutex> pinGuard(recentCSVMutex);
+            csv.pins++;
+        }
+        checkpointCond.notify_one();
+    }
+}
+
+void
+SQLAir::checkpoint(CSV& csv) {
+    WriteAheadLog& wal = *csv.wal;
+    std::lock_guard<std::mutex> guard(wal.getCheckpointMutex());
+    const std::string& path = wal.getFilePath();
+    const std::string tmpPath = path + ".tmp";
+    // Note the rows that go into the file while no rows can change. From
+    // here on, changes are logged for both the old and the new file. The
+    // other queries are held up only for this step (not while the file is
+    // written).
+    WriteAheadLog::RowMap rows;
+    {
+        std::unique_lock<CSV> csvLock(csv);
+        rows = WriteAheadLog::RowMap(csv.columns);
+        if (!std::ofstream(tmpPath)) {
+            throw Exp("Error writing " + tmpPath);
+        }
+        wal.beginCheckpoint(rows);
+    }
+    try {
+        saveToFile(csv, path, [&rows](const size_t segIdx, const size_t row) {
+            return rows.contains(segIdx, row);
+        });
+    } catch (...) {
+        wal.abortCheckpoint();
+        std::remove(tmpPath.c_str());
+        throw;
+    }
+    wal.endCheckpoint();
+}
+
+void
+SQLAir::checkpointThread() {
+    std::unique_lock<std::mutex> lock(checkpointMutex);
+    while (true) {
+        checkpointCond.wait(lock, [this] {
+            return stopCheckpoints || !checkpointQueue.empty(); });
+        if (stopCheckpoints) {
+            break;
+        }
+        CSV& csv = **checkpointQueue.begin();
+        checkpointQueue.erase(checkpointQueue.begin());
+        lock.unlock();
+        try {
+            checkpoint(csv);
+        } catch (const std::exception& e) {
+            // The log keeps growing and the checkpoint is tried again
+            // after the next change.
+            std::cerr << "Checkpoint failed: " << e.what() << std::endl;
+        }
+        {
+            std::lock_guard<std::mutex> pinGuard(recentCSVMutex);
+            csv.pins--;
+        }
+        lock.lock();
+    }
+}
+
+void
+SQLAir::refreshCSV(const std::string& url) {
+    // Pin the CSV now in use (the caller unpins it) and note its validators.
+    // A refresh does not count as a use of the CSV (see pinCSV).
+    CSV* current;
+    std::string etag, lastModified;
+    size_t contentHash;
+    {
+        std::lock_guard<std::mutex> guard(recentCSVMutex);
+        const auto entry = inMemoryCSV.find(url);
+        if (entry == inMemoryCSV.end() || entry->second.evicting) {
+            return;  // It will be loaded afresh when it is next used
+        }
+        current = &entry->second;
+        current->pins++;
+        pinnedCSVs.push_back(current);
+        etag = current->etag;
+        lastModified = current->lastModified;
+        contentHash = current->contentHash;
+    }
+    if (current->columns.isUnsaved()) {
+        return;  // Keep the changes made to it
+    }
+    // Get the data from the server, if it has changed
+    CSV csv;
+    std::string host, port, path;
+    std::tie(host, port, path) = Helper::breakDownURL(url);
+    if (!loadFromURL(csv, host, port, Helper::url_decode(path), etag,
+                     lastModified, contentHash)) {
+        // Keep the CSV, but use the server's latest validators (if any)
+        // for the next conditional GET
+        std::lock_guard<std::mutex> guard(recentCSVMutex);
+        current->fetchedAt = std::chrono::steady_clock::now();
+        if (!csv.etag.empty() || !csv.lastModified.empty()) {
+            current->etag = csv.etag;
+            current->lastModified = csv.lastModified;
+        }
+        return;
+    }
+    const size_t memUsage = (memoryBudget != 0) ?
+        csv.columns.getMemoryUsage() : 0;
+    // Replace the CSV, unless it was changed meanwhile. The write lock keeps
+    // statements from changing rows (or adding indexes) until it has been
+    // marked as retired. As it is pinned, it cannot have been evicted.
+    std::unique_lock<CSV> csvLock(*current);
+    const auto indexes = getIndexKinds(*current);
+    std::unique_lock<std::mutex> guard(recentCSVMutex);
+    if (current->columns.isUnsaved()) {
+        return;
+    }
+    // The old CSV is freed (by unpinCSVs) once no statement uses it
+    retiredCSVs.push_back(inMemoryCSV.extract(url));
+    CSV& loaded = inMemoryCSV[url];
+    loaded.move(csv);
+    loaded.columns = std::move(csv.columns);
+    loaded.schemaId = ++lastSchemaId;
+    loaded.memUsage = memUsage;
+    loaded.etag = csv.etag;
+    loaded.lastModified = csv.lastModified;
+    loaded.contentHash = csv.contentHash;
+    loaded.fetchedAt = std::chrono::steady_clock::now();
+    loaded.lastUsed = current->lastUsed;
+    loaded.pins++;
+    pinnedCSVs.push_back(&loaded);
+    current->retired = true;
+    guard.unlock();
+    csvLock.unlock();
+    // Statements use the new CSV from here on. Have the waiting ones look
+    // for rows in it, and rebuild its indexes.
+    current->waiters.notifyAll();
+    std::ostringstream discard;
+    for (const auto& index : indexes) {
+        createIndexQuery(loaded, index.second, index.first, discard);
+    }
+}
+
+CSV*
+SQLAir::getReplacement(CSV& csv) {
+    {
+        std::shared_lock<CSV> csvLock(csv);
+        if (!csv.retired) {
+            return nullptr;
+        }
+    }
+    // The CSV is pinned, so it is still in the list of retired CSVs
+    std::string url;
+    {
+        std::lock_guard<std::mutex> guard(recentCSVMutex);
+        const auto entry = std::find_if(retiredCSVs.begin(),
+            retiredCSVs.end(), [&csv](const auto& node) {
+                return &node.mapped() == &csv; });
+        url = entry->key();
+    }
+    // The statement was checked against the columns of the old CSV
+    CSV& loaded = loadAndGet(url);
+    if (loaded.getColumnNames() != csv.getColumnNames()) {
+        throw Exp("The columns of " + url + " changed during the query");
+    }
+    return &loaded;
+}
+
+void
+SQLAir::refreshThread() {
+    // Check for CSVs that are due to be refreshed every second (or more
+    // often, if they are refreshed more often than that)
+    const auto tick = std::min(refreshInterval,
+                               std::chrono::duration<double>(1));
+    std::unique_lock<std::mutex> lock(refreshMutex);
+    while (!refreshCond.wait_for(lock, tick, [this] { return stopRefresh; })) {
+        lock.unlock();
+        std::vector<std::string> urls;
+        {
+            std::lock_guard<std::mutex> guard(recentCSVMutex);
+            const auto now = std::chrono::steady_clock::now();
+            for (const auto& entry : inMemoryCSV) {
+                if (entry.first.find("http://") == 0 &&
+                    now - entry.second.fetchedAt >= refreshInterval) {
+                    urls.push_back(entry.first);
+                }
+            }
+        }
+        for (const auto& url : urls) {
+            try {
+                refreshCSV(url);
+            } catch (const std::exception& e) {
+                // The CSV in memory is used until the next try
+                std::cerr << "Refreshing " << url << " failed: " << e.what()
+                          << std::endl;
+            }
+            unpinCSVs();
+        }
+        lock.lock();
+    }
+}
+
+void
+SQLAir::saveToFile(CSV& csv, const std::string& path,
+                   const RowFilter& filter) {
+    std::lock_guard<std::mutex> saving(csv.columns.getSaveMutex());
+    const bool snapshot = Snapshot::hasExtension(path);
+    if (snapshot && !filter) {
+        // Just append the changed segments, if the table was saved to (or
+        // loaded from) this snapshot.
+        std::shared_lock<CSV> csvLock(csv);
+        if (Snapshot::append(path, csv.columns, csv.getColumnNames())) {
+            return;
+        }
+    }
+    // Write to a temporary file and then rename it over the file. The
+    // CSV's values may refer to the old file (which is memory-mapped), so
+    // it must not be overwritten in place.
+    csv.columns.setSnapshotFile(MappedFile::FileId(0, 0));
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream data(tmpPath, std::ios::binary);
+        std::shared_lock<CSV> csvLock(csv);
+        if (snapshot) {
+            Snapshot::save(data, csv.columns, csv.getColumnNames(), filter);
+        } else {
+            csv.columns.save(data, csv.getColumnNames(), ",", true, "\n",
+                             filter);
+        }
+        if (!data.flush()) {
+            throw Exp("Error writing " + tmpPath);
+        }
+    }
+    // The data must be on disk before the rename makes it the file
+    const int fd = open(tmpPath.c_str(), O_RDONLY);
+    if (fd == -1 || fsync(fd) != 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+        throw Exp("Error writing " + tmpPath);
+    }
+    close(fd);
+    // Keep the permissions of the existing file, if any
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0) {
+        chmod(tmpPath.c_str(), info.st_mode & 07777);
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw Exp("Unable to save " + path);
+    }
+    if (snapshot) {
+        csv.columns.setSnapshotFile(MappedFile::getFileId(path));
+    }
 }
 
 //--------------------[  HTTP/web related methods  ]-------------------
@@ -213,52 +1928,133 @@ SQLAir::saveQuery(std::ostream& os) {
 using namespace boost::asio;
 using namespace boost::asio::ip;
 
-// This method is called from a separate thread to process a single
-// HTTP request from a web-client
+// This method is called from a separate thread to process the HTTP
+// requests from a web-client
 void
 SQLAir::clientThread(TcpStreamPtr client) {
-    // Extract the SQL query from the first line for processing
+    // Keep processing requests on this connection until the client asks
+    // to close it or is idle for too long. Pipelined requests are simply
+    // read (and answered) in order from the stream.
     std::string req;
-    *client >> req >> req;
-    // Skip over all the HTTP request headers. Without this loop the 
-    // web-server will not operate correctly with all the web-browsers
-    for (std::string hdr; (std::getline(*client, hdr) && !hdr.empty() &&
-            hdr != "\r");) {}
-    
+    for (bool keepAlive = true; keepAlive;) {
+        client->expires_after(IdleTimeout);
+        if (!readRequest(*client, req, keepAlive)) {
+            break;  // Connection closed or timed out
+        }
+        // Queries (particularly ones that wait) may take a long time. So
+        // the idle timeout does not apply while processing the request.
+        client->expires_at(std::chrono::steady_clock::time_point::max());
+        // Have the helper method process the request and send the response
+        keepAlive = processRequest(req, *client, keepAlive);
+        client->flush();
+    }
+    // decrement thread counter as thread has finished, notify other threads
+    // that this thread is completed
+    numThreads--;
+    thrCond.notify_all();
+}
+
+// Read the request line and headers of a HTTP-GET request.
+bool
+SQLAir::readRequest(std::istream& is, std::string& req, bool& keepAlive) {
+    // Extract the path from the request line, e.g., "GET /path HTTP/1.1"
+    std::string method, version;
+    if (!(is >> method >> req >> version)) {
+        return false;
+    }
+    is.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    // HTTP/1.1 connections are persistent unless the client says otherwise
+    keepAlive = (version == "HTTP/1.1");
+    // Skip over all the HTTP request headers (except Connection). Without
+    // this loop the web-server will not operate correctly with all the
+    // web-browsers
+    for (std::string hdr; (std::getline(is, hdr) && !hdr.empty() &&
+            hdr != "\r");) {
+        std::transform(hdr.begin(), hdr.end(), hdr.begin(), ::tolower);
+        if (hdr.find("connection:") == 0) {
+            if (hdr.find("close") != std::string::npos) {
+                keepAlive = false;
+            } else if (hdr.find("keep-alive") != std::string::npos) {
+                keepAlive = true;
+            }
+        }
+    }
+    return !is.fail();
+}
+
+// Process a HTTP-GET request and write the full response to a stream.
+bool
+SQLAir::processRequest(std::string req, std::ostream& os, bool keepAlive) {
     // URL-decode the request to translate special/encoded characters
     req = Helper::url_decode(req);
     // Check and do the necessary processing based on type of request
     const std::string prefix = "/sql-air?query=";
     if (req.find(prefix) != 0) {
-        // This is request for a data file. So send the data file out.
-        *client << http::file("./" + req);
+        // This is request for a data file. So send the data file out. A
+        // missing file gets a 404 response that always closes the
+        // connection.
+        const std::string path = "./" + req;
+        keepAlive = keepAlive && std::ifstream(path).good();
+        os << (keepAlive ? http::file(path, HTTPFileKeepAliveHeaders) :
+               http::file(path));
     } else {
         // This is a sql-air query. Let's have the helper method do the 
-        // processing for us
-        std::ostringstream os;
+        // processing for us. The results are sent to the client as they
+        // are produced, instead of being collected in memory first.
+        ResponseBuffer respBuf(os, HTTPRespHeader +
+                               (keepAlive ? "keep-alive" : "Close") + "\r\n");
+        std::ostream resp(&respBuf);
         try {
             std::string sql = Helper::trim(req.substr(prefix.size()));
             if (sql.back() == ';') {
                 sql.pop_back();  // Remove trailing semicolon.
             }
-            process(sql, os);
+            process(sql, resp);
         } catch (const std::exception &exp) {
-            os << "Error: " << exp.what() << std::endl;
+            resp << "Error: " << exp.what() << std::endl;
         }
-        // Send HTTP response back to the client.
-        const std::string resp = os.str();
-        // Send response back to the client.
-        *client << HTTPRespHeader << resp.size() << "\r\n\r\n" << resp;
+        // Send the rest of the response back to the client.
+        respBuf.finish();
     }
-    // decrement thread counter as thread has finished, notify other threads
-    // that this thread is completed
-    numThreads--;
-    thrCond.notify_all();
+    return keepAlive;
+}
+
+// Process a request, parking a query that has to wait.
+bool
+SQLAir::processOrPark(const std::string& req, std::ostream& os,
+                      bool& keepAlive, const WakeHandler& onWake,
+                      std::shared_ptr<ParkedQuery> parked) {
+    if (parked != nullptr) {
+        // The query subscribes again as it runs. The CSVs it pinned stay
+        // pinned until it is done this time.
+        parked->waiting.reset();
+        pinnedCSVs.insert(pinnedCSVs.end(), parked->pinned.begin(),
+                          parked->pinned.end());
+        parked->pinned.clear();
+    }
+    wakeHandler = &onWake;
+    try {
+        keepAlive = processRequest(req, os, keepAlive);
+    } catch (const QueryParked&) {
+        wakeHandler = nullptr;
+        return false;
+    } catch (...) {
+        wakeHandler = nullptr;
+        throw;
+    }
+    wakeHandler = nullptr;
+    return true;
 }
 
 // The method to have this class run as a web-server. 
 void 
 SQLAir::runServer(boost::asio::ip::tcp::acceptor& server, const int maxThr) {
+    if (useAsync) {
+        // Use the asynchronous server that does not need a thread for each
+        // connection.
+        AsyncServer(*this, server).run();
+        return;
+    }
     for (bool done = false; !done;) {
         // Creates garbage-collected connection on heap 
         TcpStreamPtr client = std::make_shared<tcp::iostream>();
@@ -276,29 +2072,110 @@ SQLAir::runServer(boost::asio::ip::tcp::acceptor& server, const int maxThr) {
     }    
 }
 
-void 
+void
+SQLAir::loadFromFile(CSV& csv, const std::string& path) {
+    std::shared_ptr<MappedFile> file;
+    try {
+        file = std::make_shared<MappedFile>(path);
+    } catch (const std::exception&) {
+        // The file could not be mapped (e.g., it does not exist or is
+        // empty). Have the stream-based load report errors as usual.
+        std::ifstream data(path);
+        csv.load(data);
+        csv.toColumns();
+        return;
+    }
+    loadMapped(csv, file);
+}
+
+void
+SQLAir::loadMapped(CSV& csv, std::shared_ptr<MappedFile> file) {
+    if (Snapshot::isSnapshot(*file)) {
+        // A binary snapshot. Give the column names to the CSV class as a
+        // header line, and point the columns at the values in the file.
+        const StrVec colNames = Snapshot::load(file, csv.columns);
+        std::string header, delim;
+        for (const auto& name : colNames) {
+            header += delim + '"';
+            for (const char c : name) {
+                header += (c == '"' || c == '\\') ? "\\" : "";
+                header += c;
+            }
+            header += '"';
+            delim = ",";
+        }
+        std::istringstream is(header);
+        csv.load(is);
+        return;
+    }
+    // Have the CSV class process just the header line, so that the column
+    // names are handled exactly as before.
+    const char *eol = std::find(file->begin(), file->end(), '\n');
+    std::istringstream header(std::string(file->begin(), eol));
+    csv.load(header);
+    // The rows are parsed directly from the mapped file.
+    const size_t offset = (eol == file->end()) ? file->size() :
+        (eol - file->begin() + 1);
+    csv.columns.load(file, offset, csv.getColumnCount());
+}
+
+bool
 SQLAir::loadFromURL(CSV& csv, const std::string& hostName, 
-        const std::string& port, const std::string& path) {
+        const std::string& port, const std::string& path,
+        const std::string& etag, const std::string& lastModified,
+        const size_t contentHash) {
     // Setup a boost tcp stream to send an HTTP request to the web-server
     tcp::iostream client(hostName, port);
     if (!client.good()) {
         throw Exp("Unable to connect to " + hostName + " at port " + port);
     }
-    // Send an HTTP get request to get the data from the server
-    client << "GET " << path << " HTTP/1.1\r\nHost: " << hostName << "\r\n"
-           << "Connection: Close\r\n\r\n";
+    // Send an HTTP get request to get the data from the server. With the
+    // validators of the data loaded earlier, the server need not send the
+    // data again if it has not changed.
+    client << "GET " << path << " HTTP/1.1\r\nHost: " << hostName << "\r\n";
+    if (!etag.empty()) {
+        client << "If-None-Match: " << etag << "\r\n";
+    }
+    if (!lastModified.empty()) {
+        client << "If-Modified-Since: " << lastModified << "\r\n";
+    }
+    client << "Connection: Close\r\n\r\n";
     
     // Get response status from server to ensure we have a valid response.
     std::string status;  // To ensure it is 200 OK status code.
     std::getline(client, status);
-    // Read and skip over HTTP response headers
+    // Read the HTTP response headers, keeping the validators
     for (std::string hdr; std::getline(client, hdr) && !hdr.empty() 
-            && hdr != "\r"; ) {}
+            && hdr != "\r"; ) {
+        const size_t colon = hdr.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = hdr.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name == "etag") {
+            csv.etag = Helper::trim(hdr.substr(colon + 1));
+        } else if (name == "last-modified") {
+            csv.lastModified = Helper::trim(hdr.substr(colon + 1));
+        }
+    }
+    if (status.find(" 304 ") != std::string::npos &&
+        (!etag.empty() || !lastModified.empty())) {
+        return false;  // The data loaded earlier is still current
+    }
     // Double-check everything worked correctly so far...
     if (!client.good() || (status.find("200 OK") == std::string::npos)) {
         throw Exp("Error (" + Helper::trim(status) + ") getting " + path + 
                 " from " + hostName + " at port " + port);
     }
-    // Now have the CSV class do rest of the processing
-    csv.load(client);
+    // Read the data into one buffer and parse the rows from it, unless it
+    // is the same as the data loaded earlier
+    const auto data = std::make_shared<MappedFile>(client);
+    csv.contentHash = std::hash<std::string_view>()(
+        std::string_view(data->begin(), data->size()));
+    if (contentHash != 0 && csv.contentHash == contentHash) {
+        return false;
+    }
+    loadMapped(csv, data);
+    return true;
 }
@@ -16,12 +16,27 @@
 #include <tuple>
 #include <thread>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <future>
+#include <functional>
+#include <set>
 #include "SQLAirBase.h"
+#include "StatementCache.h"
+#include "ScanPool.h"
+#include "Aggregation.h"
+#include "HashJoin.h"
 
 // Shortcut to smart pointer with TcpStream
 using TcpStreamPtr = std::shared_ptr<boost::asio::ip::tcp::iostream>;
 
+/**
+ * A query with a "wait" clause that SQLAir::processOrPark set aside
+ * (instead of blocking a thread) until rows change to match its where
+ * clause.
+ */
+struct ParkedQuery;
+
 /**
  * The top-level class that facilitates processing SQL-like queries on CSV
  * files. The methods in this class override the default/dummy implementations
@@ -29,6 +44,63 @@ using TcpStreamPtr = std::shared_ptr<boost::asio::ip::tcp::iostream>;
  */
 class SQLAir : public SQLAirBase {
 public:
+    /**
+     * Create the SQLAir object. The number of threads used to scan a
+     * table is taken from the SQLAIR_SCAN_THREADS environment variable, if
+     * it is set. Otherwise it is the number of cores. If the SQLAIR_WAL
+     * environment variable is set to a non-zero value, changes to tables
+     * loaded from local files are logged (see WriteAheadLog). If the
+     * SQLAIR_ASYNC environment variable is set to a non-zero value,
+     * runServer uses an AsyncServer instead of a thread per connection.
+     */
+    SQLAir();
+
+    /** The destructor stops the threads that run checkpoints and refresh
+     * CSVs, if any, and removes the snapshots that evicted CSVs were
+     * spilled to.
+     */
+    ~SQLAir();
+
+    /**
+     * Set the number of threads that scan the segments of a table for a
+     * single select, update, or delete statement (the degree of
+     * parallelism). This method must not be called while statements are
+     * being processed.
+     *
+     * @param numThreads The number of threads. If this value is 1, tables
+     * are scanned only by the thread processing the statement.
+     */
+    void setScanThreads(const size_t numThreads);
+
+    /**
+     * Set the memory that the CSVs loaded by statements may use. Once the
+     * CSVs use more than this, the least recently used ones that are not
+     * in use by a statement are evicted from memory (see evictCSVs) and
+     * transparently loaded again when a statement next uses them. This
+     * method must not be called while statements are being processed.
+     *
+     * @param bytes The memory budget in bytes. If this value is 0, CSVs
+     * are never evicted.
+     */
+    void setMemoryBudget(const size_t bytes) { memoryBudget = bytes; }
+
+    /**
+     * Top-level method to process a SQL-air query. This method handles the
+     * "create index" statement (which is not known to the base class) and
+     * passes all other statements on to the base class. Select, update, and
+     * delete statements parsed by the base class are cached, so that
+     * repeated statements are run without being parsed again.
+     * 
+     * @param sql The SQL-air query to be processed by this method.
+     * 
+     * @param os The output stream to where results from the processing are
+     * to be written.
+     * 
+     * @return This method returns true if further queries are to be processed.
+     * This method returns false if the command was "exit;" 
+     */
+    bool process(const std::string& sql, std::ostream& os) override;
+
     /**
      * Method to perform the actual operations associated with printing a
      * given set of columns in a given CSV that match an optional condition.
@@ -199,6 +271,12 @@ public:
      * string. If the recent CSV was downloaded from an URL, then this method
      * throws an exception (as this feature is not yet implemented). If the CSV
      * was loaded from a a file, then the data in the file is overwritten.
+     * Files whose name ends with ".sqlair" are saved as binary snapshots
+     * (see Snapshot) instead of CSV text. The file is not written if no
+     * rows have changed since it was last written, and unchanged segments
+     * are copied from the file the CSV was loaded from. If the CSV's
+     * changes are being logged, saving it runs a checkpoint (which also
+     * empties the log).
      * 
      * @param os The output stream to where the result of saving (if any) is
      * to be written.
@@ -212,6 +290,16 @@ public:
      * inMemoryCSV map.  If the requested file is not present, then this
      * method loads the data into the inMemoryCSV.   
      * 
+     * If several threads need a CSV that is not loaded, only the first
+     * one loads it. The others wait for it and get the same CSV (or the
+     * same error).
+     * 
+     * The CSV is pinned (see CSV::pins) until the statement being
+     * processed on this thread is done, so that it is not evicted while
+     * the statement uses it. A CSV that was evicted is loaded again, from
+     * the snapshot it was spilled to if it had unsaved changes, and its
+     * indexes are rebuilt.
+     * 
      * @note Currently, this method is not MT-safe. So avoid calling this 
      * method from multiple threads simultaneously.
      * 
@@ -233,7 +321,9 @@ public:
      * keeps processing requests. This method does not do the core processing.
      * Instead, for each connection it starts a detached-thread to process the
      * request from the client. Hence, the task of processing HTTP-GET request
-     * is delegated to the clientThread method. 
+     * is delegated to the clientThread method. If enabled via the
+     * SQLAIR_ASYNC environment variable (see the constructor), the
+     * requests are processed by an AsyncServer instead.
      * 
      * @note This method uses detached threads to process each request.
      * 
@@ -241,26 +331,448 @@ public:
      * from clients.
      * 
      * @param maxThr An optional maximum number of threads to be used by this
-     * method.
+     * method. It is not used by the AsyncServer.
      */
     void runServer(boost::asio::ip::tcp::acceptor& server, const int maxThr);
+
+    /**
+     * The time after which a persistent connection with no new requests
+     * from the client is closed.
+     */
+    static constexpr std::chrono::seconds IdleTimeout{15};
+
+    /**
+     * Read the request line and headers of a HTTP-GET request from a
+     * web-client. This method is used by both clientThread and the
+     * AsyncServer.
+     *
+     * @param is The input stream from which the request is to be read.
+     *
+     * @param req The path in the HTTP-GET request is stored in this string.
+     *
+     * @param keepAlive This flag is set to true if the client wants the
+     * connection to stay open after the response is sent (the default for
+     * HTTP/1.1 unless the client sends "Connection: close").
+     *
+     * @return This method returns false if a request could not be read
+     * (e.g., because the client closed the connection).
+     */
+    static bool readRequest(std::istream& is, std::string& req,
+                            bool& keepAlive);
+
+    /**
+     * Process a single HTTP-GET request from a web-client and write the
+     * full HTTP response (including headers) to the given stream. This
+     * method is used by both clientThread and the AsyncServer.
+     *
+     * @param req The path in the HTTP-GET request (not yet URL-decoded).
+     *
+     * @param os The output stream to which the response is to be written.
+     *
+     * @param keepAlive If this flag is true, then the response tells the
+     * client that the connection stays open.
+     *
+     * @return This method returns true if the connection is to stay open
+     * after this response.
+     */
+    bool processRequest(std::string req, std::ostream& os,
+                        bool keepAlive = false);
+
+    /**
+     * The function called (by the thread that changed the rows) when a
+     * parked query is to be run again. It must not run the query itself,
+     * but hand it (e.g., post it) to another thread.
+     */
+    using WakeHandler = std::function<void(std::shared_ptr<ParkedQuery>)>;
+
+    /**
+     * Process a request like processRequest, except that a query with a
+     * "wait" clause that has to wait is parked instead of blocking this
+     * thread. Nothing is written to the stream for a parked query. Once
+     * rows change, onWake is called with the parked query, which is then
+     * to be passed to this method (along with the same request) to run it
+     * again.
+     *
+     * @param req The path in the HTTP-GET request (not yet URL-decoded).
+     *
+     * @param os The output stream to which the response is to be written.
+     *
+     * @param keepAlive If this flag is true, then the response tells the
+     * client that the connection stays open. It is set to false if the
+     * connection is to be closed after the response.
+     *
+     * @param onWake The function to be called when a parked query is to
+     * be run again.
+     *
+     * @param parked The query (parked by an earlier call) that is being
+     * run again, if any.
+     *
+     * @return This method returns false if the query was parked.
+     */
+    bool processOrPark(const std::string& req, std::ostream& os,
+                       bool& keepAlive, const WakeHandler& onWake,
+                       std::shared_ptr<ParkedQuery> parked = nullptr);
     
     
     /**
-     * Creates string output if there are applicable outputs from the query and 
-     * prints column names if applicable
-     * @param csv the file database
-     * @param colNames determines what part of a record will be included in 
-     *        output
-     * @param row the records in the file database
-     * @param numSelect the number of iteration the loop is on
-     * @param os output stream for colNames if applicable
-     * @return string to be printed
+     * Formats a row selected by a query straight from the column store,
+     * with the values separated by tabs
+     * @param colIdxs the index of each column to be included in output
+     * @param seg the segment of the column store that has the record
+     * @param row the row of the record in the segment
+     * @param out the string to which the row (and a newline) is appended
      */
-    std::string getOutput(CSV& csv, StrVec colNames, CSVRow row, int numSelect,
-                        std::ostream& os);
+    void writeRow(const std::vector<int>& colIdxs, const Segment& seg,
+                  const size_t row, std::string& out);
 
 protected:
+    /** The kinds of index that can be created on a column of a CSV. */
+    enum class IndexKind { Hash, Sorted, Trigram };
+
+    /**
+     * Run a statement from the cache of parsed statements.
+     *
+     * @param stmt The parsed statement to be run.
+     *
+     * @param os The output stream to where the results are to be written.
+     *
+     * @return This method returns false (without running the statement) if
+     * the CSV has been reloaded since the statement was parsed.
+     */
+    bool runCached(const Statement& stmt, std::ostream& os);
+
+    /**
+     * The core of selectQuery, which works with column indexes that have
+     * already been looked up.
+     *
+     * @param csv The CSV from which rows are to be selected.
+     *
+     * @param mustWait If this flag is true, keep trying until at least 1
+     * row is selected.
+     *
+     * @param colNames The columns to be printed ("*" already expanded).
+     *
+     * @param colIdxs The index of each column in colNames.
+     *
+     * @param whereColIdx The column in the where clause, or -1 if none.
+     *
+     * @param cond The condition in the where clause.
+     *
+     * @param value The value in the where clause.
+     *
+     * @param order The order by and limit clauses.
+     *
+     * @param os The output stream to where the results are to be written.
+     */
+    void selectRows(CSV& csv, bool mustWait, const StrVec& colNames,
+        const std::vector<int>& colIdxs, const int whereColIdx,
+        const std::string& cond, const std::string& value,
+        const OrderBy& order, std::ostream& os);
+
+    /**
+     * Print the matching rows in table order, skipping the rows before the
+     * offset. The scan stops as soon as limit rows have been printed. The
+     * parameters are the same as for selectRows.
+     *
+     * @return The number of rows printed.
+     */
+    size_t selectFirstRows(CSV& csv, const StrVec& colNames,
+        const std::vector<int>& colIdxs, const int whereColIdx,
+        const std::string& cond, const std::string& value,
+        const OrderBy& order, std::ostream& os);
+
+    /**
+     * Print the matching rows sorted by the column in the order by clause.
+     * Only the first offset + limit rows are kept (in a TopK) while the
+     * table is scanned. The parameters are the same as for selectRows.
+     *
+     * @return The number of rows printed.
+     */
+    size_t selectTopRows(CSV& csv, const StrVec& colNames,
+        const std::vector<int>& colIdxs, const int whereColIdx,
+        const std::string& cond, const std::string& value,
+        const OrderBy& order, std::ostream& os);
+
+    /**
+     * The core of updateQuery, which works with column indexes that have
+     * already been looked up.
+     *
+     * @param csv The CSV whose rows are to be updated.
+     *
+     * @param mustWait If this flag is true, keep trying until at least 1
+     * row is updated.
+     *
+     * @param colIdxs The index of each column to be changed.
+     *
+     * @param values The new value for each column in colIdxs.
+     *
+     * @param whereColIdx The column in the where clause, or -1 if none.
+     *
+     * @param cond The condition in the where clause.
+     *
+     * @param value The value in the where clause.
+     *
+     * @param os The output stream to where the results are to be written.
+     */
+    void updateRows(CSV& csv, bool mustWait, const std::vector<int>& colIdxs,
+        const StrVec& values, const int whereColIdx, const std::string& cond,
+        const std::string& value, std::ostream& os);
+
+    /**
+     * Compute the aggregates of a select statement with aggregate functions
+     * (and possibly a group by clause). The matching rows of each segment
+     * are aggregated (in parallel) and the partial results are merged.
+     *
+     * @param csv The CSV whose rows are to be aggregated.
+     *
+     * @param aggregation The aggregates to be computed.
+     *
+     * @param whereColIdx The column in the where clause, or -1 if none.
+     *
+     * @param cond The condition in the where clause.
+     *
+     * @param value The value in the where clause.
+     *
+     * @param order The order by and limit clauses. The column is an item in
+     * the select list (see Aggregation::findItem).
+     *
+     * @param os The output stream to where the results are to be written.
+     */
+    void aggregateRows(CSV& csv, const Aggregation& aggregation,
+        const int whereColIdx, const std::string& cond,
+        const std::string& value, const OrderBy& order, std::ostream& os);
+
+    /**
+     * Shortcut for the method called with the matching rows in each segment
+     * by forEachMatch. The parameters are the segment, the index of the
+     * segment, the matching rows in the segment, and a string to which
+     * any output for the segment is to be appended.
+     */
+    using MatchHandler = std::function<void(Segment&, const size_t,
+                                            const RowList&, std::string&)>;
+
+    /**
+     * Shortcut for the method called by forEachMatch with the output of
+     * each segment, in segment order. It returns false if no more output is
+     * needed, which stops the scan.
+     */
+    using OutputHandler = std::function<bool(const std::string&)>;
+
+    /**
+     * Checks if a select statement is valid and runs it. The base class
+     * accepts only "=", "<>", and "like" in where clauses. This method
+     * also accepts range conditions, such as:
+     *
+     *     select * from airports.csv where latitude > 40;
+     *     select * from airports.csv where altitude between 0 and 100;
+     *
+     * It also accepts the aggregate functions count, sum, avg, min, and max
+     * and a group by clause (see Aggregation), such as:
+     *
+     *     select country, count(*), avg(altitude) from airports.csv
+     *         group by country;
+     *
+     * and order by and limit clauses at the end (see TopK), such as:
+     *
+     *     select name from airports.csv order by altitude desc limit 10;
+     *
+     * Selects that join two CSVs are run by validateAndProcessJoin.
+     *
+     * @param sql The tokens in the select statement to be processed.
+     * @param mustWait Flag to indicate if the query must keep running until
+     * at least 1 matching row is found.
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessSelect(const StrVec& sql, bool mustWait,
+        std::ostream& os) override;
+
+    /**
+     * Checks if a select statement that joins two CSVs is valid and runs
+     * it (see HashJoin). The statement is of the form:
+     *
+     *     select r.src, a.name from routes.csv r join airports.csv a
+     *         on r.dst = a.iata where a.country = 'Canada' limit 50;
+     *
+     * Columns are referred to by the alias of their CSV, the name of the
+     * file (with or without its extension), or just by name if only one of
+     * the CSVs has the column. The where clause may refer to either CSV.
+     * A limit clause is accepted, but not an order by clause.
+     *
+     * @param sql The tokens in the select statement (without any order by
+     * and limit clauses, see takeOrderLimit).
+     * @param mustWait Flag to indicate if the query has a wait clause,
+     * which is not supported with joins.
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessJoin(const StrVec& sql, bool mustWait,
+        std::ostream& os);
+
+    /**
+     * Run a join: build the hash table from the rows of one CSV and print
+     * the pairs of matching rows as the other CSV is scanned.
+     *
+     * @param build The CSV on which the hash table is built (the smaller
+     * one).
+     *
+     * @param probe The CSV whose rows are looked up in the hash table.
+     *
+     * @param hashJoin The join, with an empty hash table.
+     *
+     * @param colNames The header to be printed.
+     *
+     * @param whereOnBuild Flag to indicate if the column in the where
+     * clause is in the build CSV (rather than the probe CSV).
+     *
+     * @param whereColIdx The column in the where clause, or -1 if none.
+     *
+     * @param cond The condition in the where clause.
+     *
+     * @param value The value in the where clause.
+     *
+     * @param order The limit clause (the column is always -1).
+     *
+     * @param os The output stream to where the results are to be written.
+     */
+    void joinRows(CSV& build, CSV& probe, HashJoin& hashJoin,
+        const StrVec& colNames, const bool whereOnBuild,
+        const int whereColIdx, const std::string& cond,
+        const std::string& value, const OrderBy& order, std::ostream& os);
+
+    /**
+     * Checks if an update statement is valid and runs it. Range conditions
+     * are accepted in the where clause (see validateAndProcessSelect).
+     *
+     * @param sql The tokens in the update statement to be processed.
+     * @param mustWait Flag to indicate if the query must keep running until
+     * at least 1 row is updated.
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessUpdate(const StrVec& sql, bool mustWait,
+        std::ostream& os) override;
+
+    /**
+     * Checks if a delete statement is valid and runs it. Range conditions
+     * are accepted in the where clause (see validateAndProcessSelect).
+     *
+     * @param sql The tokens in the delete statement to be processed.
+     * @param mustWait Flag to indicate if the query must keep running until
+     * at least 1 row is deleted.
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified SQL
+     */
+    void validateAndProcessDelete(const StrVec& sql, bool mustWait,
+        std::ostream& os) override;
+
+    /**
+     * Checks if a "convert" statement is valid and converts a file between
+     * the CSV and binary snapshot formats. The format of each file is
+     * chosen by its name (see saveQuery). The statement is of the form:
+     *
+     *     convert test.csv to test.sqlair;
+     *
+     * @param sql The tokens in the convert statement to be processed.
+     * @param mustWait This flag is not applicable for this query. If specified,
+     * it is ignored.
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified query.
+     */
+    void validateAndProcessConvert(const StrVec& sql, bool mustWait,
+        std::ostream& os);
+
+    /**
+     * Checks if a "create index" statement is valid and calls the
+     * createIndexQuery() method to build the index. The statement is of the
+     * form (for a hash, sorted, or trigram index respectively):
+     *
+     *     create index on test.csv (movieid);
+     *     create sorted index on airports.csv (latitude);
+     *     create trigram index on airports.csv (name);
+     *
+     * @param sql The tokens in the create statement to be processed.
+     * @param mustWait This flag is not applicable for this query. If specified,
+     * it is ignored.
+     * @param os The output stream to where the results are to be written.
+     *
+     * @exception This method throws an exception if error occur when
+     * processing the specified query.
+     */
+    void validateAndProcessCreate(const StrVec& sql, bool mustWait,
+        std::ostream& os);
+
+    /**
+     * Builds a hash, sorted, or trigram index on a given column of a CSV.
+     * Once a hash index exists, select, update, and delete statements with
+     * a "where col = value" clause on the column look up the matching rows
+     * in the index instead of scanning the whole column. Similarly, a
+     * sorted index is used for range conditions (e.g., "where col > 10")
+     * and a trigram index for "like" conditions of at least 3 characters.
+     * If the column already has an index of the kind, the index is rebuilt.
+     *
+     * @param csv The CSV whose column is to be indexed.
+     *
+     * @param colIdx The index of the column to be indexed.
+     *
+     * @param kind The kind of index to be built.
+     *
+     * @param os The output stream to where the result is to be written.
+     */
+    void createIndexQuery(CSV& csv, const int colIdx, const IndexKind kind,
+                          std::ostream& os);
+
+    /**
+     * Finds the rows in a CSV that match an optional condition and calls a
+     * given handler with the matching rows in each segment. The handler is
+     * called while holding a read lock on the CSV and a (shared or
+     * exclusive) lock on the segment. If the condition is "=" and
+     * the column has a hash index, or it is a range condition and the
+     * column has a sorted index, or it is "like" and the column has a
+     * trigram index, the rows are looked up in the index.
+     * Otherwise, the column is scanned, with the segments spread over the
+     * threads in the scan pool. So the handler may be called for different
+     * segments at the same time. The output appended by the handler is
+     * passed to the output method on the calling thread, in segment order.
+     *
+     * @param csv The CSV whose rows are to be checked.
+     *
+     * @param whereColIdx The column in the where clause. If this value is -1,
+     * then all rows match.
+     *
+     * @param cond The condition to be checked: "=", "<>", "like", or a
+     * range condition (see Range).
+     *
+     * @param value The value specified in the where clause.
+     *
+     * @param exclusive If this flag is true, then each segment is locked
+     * exclusively (so the handler may change rows). Otherwise the segment
+     * lock is shared with other readers.
+     *
+     * @param handler The method to be called with the matching rows in each
+     * segment that has at least one matching row.
+     *
+     * @param output The method to be called with the (non-empty) output of
+     * each segment. May be nullptr. The remaining segments are skipped once
+     * it returns false.
+     *
+     * @return This method returns false (without calling the handler) if
+     * the CSV has been replaced by a refresh (see getReplacement).
+     */
+    bool forEachMatch(CSV& csv, const int whereColIdx, const std::string& cond,
+        const std::string& value, const bool exclusive,
+        const MatchHandler& handler, const OutputHandler& output = nullptr);
+
     /**
      * This method is a refactored utility method. This method is called from
      * the seqlectQuery method. This method performs the actual operations
@@ -364,12 +876,222 @@ protected:
      *     2. All other requests are assumed to be requests for files that are
      *        returned back to the client using http::file() helper method in
      *        the HTTPFile class.
+     * The connection is persistent (keep-alive): requests are processed
+     * one after another (so pipelined requests are answered in order)
+     * until the client asks to close the connection or is idle for
+     * IdleTimeout.
      * 
      * @param client The socket stream to be used for performing all of the
      * I/O operations.
      */
     void clientThread(TcpStreamPtr client);
 
+    /**
+     * Internal helper method to load a local CSV file. The file is
+     * memory-mapped and the column store refers to values directly in the
+     * file. Values are copied only when they are updated. If the file
+     * cannot be mapped, it is loaded via CSV::load() instead. If the file is
+     * a binary snapshot, it is loaded without any parsing.
+     *
+     * @param csv The CSV object into which the data is to be loaded.
+     *
+     * @param path The path to the CSV file.
+     *
+     * @exception Exp This method throws exceptions if the file could not be
+     * loaded.
+     */
+    void loadFromFile(CSV& csv, const std::string& path);
+
+    /**
+     * Internal helper method to load a CSV from data in memory: a mapped
+     * file or data read from a stream. The column store refers to values
+     * directly in the data. A binary snapshot is loaded without parsing.
+     *
+     * @param csv The CSV object into which the data is to be loaded.
+     *
+     * @param file The data to be loaded. The column store keeps it as long
+     * as it needs it.
+     *
+     * @exception std::exception This method throws exceptions if the data
+     * is not a valid CSV or snapshot.
+     */
+    void loadMapped(CSV& csv, std::shared_ptr<MappedFile> file);
+
+    /**
+     * Internal helper method to save a CSV to a local file, as CSV text or
+     * as a binary snapshot (if the file name ends with ".sqlair"). The data
+     * is written to a temporary file that is then renamed over the file.
+     * If the CSV was saved to (or loaded from) the snapshot, just the
+     * segments that changed are appended to it instead.
+     *
+     * @param csv The CSV to be saved.
+     *
+     * @param path The path to the file to be written.
+     *
+     * @param filter The rows to be written. If this is nullptr, all the
+     * rows that are not deleted are written.
+     *
+     * @exception Exp This method throws exceptions if the file could not be
+     * written.
+     */
+    void saveToFile(CSV& csv, const std::string& path,
+                    const RowFilter& filter = nullptr);
+
+    /**
+     * Wait for the changes made to a CSV by a statement to be written to
+     * its log (if any). If the log has grown large enough, a checkpoint is
+     * queued for the checkpoint thread.
+     *
+     * @param csv The CSV that was changed.
+     */
+    void commitChanges(CSV& csv);
+
+    /**
+     * Fold the log of a CSV into its file: the CSV is saved to its file
+     * (dropping deleted rows) and the log is replaced by a log of just the
+     * changes made while the file was being written. Queries are held up
+     * only while the rows to be saved are noted, not while the file is
+     * written.
+     *
+     * @param csv The CSV to be saved. Its changes must be logged.
+     *
+     * @exception Exp This method throws exceptions if the file could not be
+     * written.
+     */
+    void checkpoint(CSV& csv);
+
+    /**
+     * The thread-main method that runs the checkpoints queued by
+     * commitChanges, one at a time, until this object is destroyed.
+     */
+    void checkpointThread();
+
+    /**
+     * Check if a CSV loaded from a URL has changed on the web server (via a
+     * conditional GET, and a hash of the data in case the server sends it
+     * anyway) and, if so, replace it with the new data. The new
+     * CSV replaces the old one in inMemoryCSV in one step, so statements
+     * see either the old or the new CSV. Statements that are using the old
+     * CSV keep it (see retiredCSVs) until they are done, but statements
+     * that change rows (or wait for them) move to the new CSV (see
+     * getReplacement). CSVs with changes that are not saved are not
+     * replaced.
+     *
+     * @param url The URL of the CSV, i.e., its key in inMemoryCSV. The
+     * CSV is pinned (see pinCSV) and the caller must unpin it.
+     *
+     * @exception Exp This method throws exceptions if the data could not be
+     * obtained from the web server.
+     */
+    void refreshCSV(const std::string& url);
+
+    /**
+     * Obtain the CSV that replaced a given CSV, if it was replaced by
+     * refreshCSV. Statements that wait for rows, or change them, use this
+     * method to carry on with the new CSV. The new CSV is pinned (see
+     * pinCSV) until the statement is done.
+     *
+     * @param csv The CSV used by the statement. It must be pinned.
+     *
+     * @return The CSV that replaced the given one. If it has not been
+     * replaced, this method returns nullptr.
+     *
+     * @exception Exp This method throws an exception if the new CSV does
+     * not have the same columns as the given one.
+     */
+    CSV* getReplacement(CSV& csv);
+
+    /**
+     * The thread-main method that refreshes (see refreshCSV) the CSVs loaded
+     * from URLs once they were last fetched more than refreshInterval ago,
+     * until this object is destroyed.
+     */
+    void refreshThread();
+
+    /**
+     * Helper method to process a statement, as described for process().
+     * The process method calls it and then unpins the CSVs it used.
+     *
+     * @param sql The SQL-air query to be processed by this method.
+     *
+     * @param os The output stream to where results are to be written.
+     *
+     * @return This method returns true if further queries are to be
+     * processed.
+     */
+    bool processStatement(const std::string& sql, std::ostream& os);
+
+    /**
+     * Helper method to load a CSV (for loadAndGet) from a file, URL, or
+     * the snapshot it was spilled to when it was evicted.
+     *
+     * @param csv The empty CSV into which the data is to be loaded.
+     *
+     * @param fileOrURL Path to a CSV file or a URL to CSV data.
+     *
+     * @param spillFile The snapshot to be loaded instead, or "" if none.
+     *
+     * @exception This method throws an exception if the CSV could not be
+     * loaded.
+     */
+    void loadCSV(CSV& csv, const std::string& fileOrURL,
+                 const std::string& spillFile);
+
+    /**
+     * Pin a CSV for the statement being processed on this thread and note
+     * that it was just used. The caller must hold recentCSVMutex.
+     *
+     * @param csv The CSV to be pinned.
+     *
+     * @return The CSV, for convenience.
+     */
+    CSV& pinCSV(CSV& csv);
+
+    /**
+     * Unpin the CSVs pinned by the statement just processed on this thread,
+     * noting the memory each one now uses, and then evict CSVs if they use
+     * more than the memory budget.
+     */
+    void unpinCSVs();
+
+    /**
+     * Wait until rows change to match the where clause of a query. If the
+     * query is being processed by processOrPark, then it is parked instead
+     * (with the CSVs it pinned) and this method throws to unwind it.
+     *
+     * @param waiting The query's subscription. It is moved into the parked
+     * query if the query is parked.
+     */
+    void waitFor(std::unique_ptr<WaitRegistry::Subscription>& waiting);
+
+    /**
+     * Evict the least recently used CSVs that are not pinned until the
+     * in-memory CSVs fit within the memory budget (if any).
+     */
+    void evictCSVs();
+
+    /**
+     * Obtain the indexes on a CSV, so that they can be built again on a
+     * new copy of it.
+     *
+     * @param csv The CSV whose indexes are needed.
+     *
+     * @return The kind and column of each index on the CSV.
+     */
+    std::vector<std::pair<IndexKind, int>> getIndexKinds(CSV& csv);
+
+    /**
+     * Evict a CSV from memory. If it has changes that are neither saved
+     * nor logged, it is first spilled to a snapshot in the temporary
+     * directory, from which loadAndGet loads it again. If the snapshot
+     * cannot be written, the CSV stays in memory.
+     *
+     * @param fileOrURL The key of the CSV in inMemoryCSV.
+     *
+     * @param csv The CSV to be evicted. It must be marked as evicting.
+     */
+    void evictCSV(const std::string& fileOrURL, CSV& csv);
+
     /**
      * Internal helper method to obtain CSV file from a given URL. The URL
      * processing is initially done in the gloadAndGet method that calls
@@ -378,8 +1100,14 @@ protected:
      * is broken down into host, port, and path by calling the 
      * Helper::breakdownURL() method.  However, the user
      * must continue to use the full URL for referencing the data. This method
-     * establishes the TCP stream and simply calls the csv.load() method to
-     * load the CSV data from the TCP stream.
+     * establishes the TCP stream and reads the data into a single buffer,
+     * which the column store refers to (see loadMapped), instead of having
+     * csv.load() store each value in its own string.
+     * 
+     * If validators from an earlier load are given, the request is a
+     * conditional GET (with If-None-Match and If-Modified-Since headers) and
+     * nothing is loaded if the server reports that the data has not
+     * changed. The validators sent by the server are stored in the CSV.
      * 
      * @param csv The CSV object into which the data is to be loaded.
      * 
@@ -392,11 +1120,25 @@ protected:
      * @param path The path to the CSV file on the server. The path to the 
      * file on the server. This is of the form "/test.csv"
      * 
+     * @param etag The ETag header of the data loaded earlier, if any.
+     * 
+     * @param lastModified The Last-Modified header of the data loaded
+     * earlier, if any.
+     * 
+     * @param contentHash The hash of the data loaded earlier (see
+     * CSV::contentHash), if any.
+     * 
+     * @return This method returns false (without loading anything) if the
+     * server reported that the data has not been modified, or sent the same
+     * data as before.
+     * 
      * @exception Exp This method throws exceptions if errors ocurr when 
      * reading the data from the server.
      */
-    void loadFromURL(CSV& csv, const std::string& hostName, 
-        const std::string& port, const std::string& path);
+    bool loadFromURL(CSV& csv, const std::string& hostName, 
+        const std::string& port, const std::string& path,
+        const std::string& etag = "", const std::string& lastModified = "",
+        const size_t contentHash = 0);
     
 private:
     /**
@@ -420,6 +1162,98 @@ private:
      * getOrLoadCSV() method in this class.
      */
     std::unordered_map<std::string, CSV> inMemoryCSV;
+
+    /**
+     * The CSV::schemaId given to the most recently loaded CSV. This value
+     * is guarded by recentCSVMutex.
+     */
+    unsigned long lastSchemaId = 0;
+
+    /**
+     * The CSVs that are being loaded, by their key in inMemoryCSV. Just
+     * the first thread that needs a CSV loads it. The others wait for the
+     * future (see loadAndGet). This map is guarded by recentCSVMutex.
+     */
+    std::unordered_map<std::string, std::shared_future<void>> loading;
+
+    // -------------[ Memory budget ]-----------------------------
+    /** What loadAndGet needs to load a CSV again after it was evicted. */
+    struct Evicted {
+        /** The snapshot the CSV was spilled to, or "" if it was saved. */
+        std::string spillFile;
+        /** The kind and column of each index on the CSV. */
+        std::vector<std::pair<IndexKind, int>> indexes;
+    };
+
+    /** The memory budget for the CSVs (0 for none). See setMemoryBudget */
+    size_t memoryBudget = 0;
+
+    /** The number of times CSVs have been used (see CSV::lastUsed). This
+     * and the following values are guarded by recentCSVMutex.
+     */
+    unsigned long useCount = 0;
+
+    /** The CSVs that have been evicted, by their key in inMemoryCSV. */
+    std::unordered_map<std::string, Evicted> evicted;
+
+    /** Used to wake up threads waiting for a CSV to be evicted. */
+    std::condition_variable evictCond;
+
+    /**
+     * CSVs that were replaced by refreshCSV while statements were using
+     * them. Each one is freed once it is no longer pinned (see unpinCSVs).
+     * This list is guarded by recentCSVMutex.
+     */
+    std::vector<decltype(inMemoryCSV)::node_type> retiredCSVs;
+    // -----------------------------------------------------------
+
+    /** The cache of parsed statements used by the process method. */
+    StatementCache stmtCache;
+
+    /** The threads used to scan the segments of a table in parallel. */
+    std::unique_ptr<ScanPool> scanPool;
+
+    /** Flag to indicate if runServer uses an AsyncServer. */
+    bool useAsync = false;
+
+    // -------------[ Write-ahead logging ]-----------------------
+    /** Flag to indicate if changes to local files are logged. */
+    bool useWal = false;
+
+    /** The thread that runs checkpoints in the background. */
+    std::thread checkpointer;
+
+    /** The CSVs whose logs are due to be checkpointed. */
+    std::set<CSV*> checkpointQueue;
+
+    /** Flag to tell the checkpoint thread to stop. */
+    bool stopCheckpoints = false;
+
+    /** The mutex that guards checkpointQueue and stopCheckpoints. */
+    std::mutex checkpointMutex;
+
+    /** Used to wake up the checkpoint thread. */
+    std::condition_variable checkpointCond;
+    // -----------------------------------------------------------
+
+    // -------------[ Refreshing CSVs loaded from URLs ]----------
+    /** How long a CSV loaded from a URL is used before it is checked for
+     * changes. If this value is zero, such CSVs are never refreshed.
+     */
+    std::chrono::duration<double> refreshInterval{0};
+
+    /** The thread that refreshes CSVs in the background. */
+    std::thread refresher;
+
+    /** Flag to tell the refresher thread to stop. */
+    bool stopRefresh = false;
+
+    /** The mutex that guards stopRefresh. */
+    std::mutex refreshMutex;
+
+    /** Used to wake up the refresher thread to stop it. */
+    std::condition_variable refreshCond;
+    // -----------------------------------------------------------
     
     // -------------[ Limit number of threads ]-------------------    
     /** The atomic counter that tracks the number of active threads.
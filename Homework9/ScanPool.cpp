@@ -0,0 +1,123 @@
+/*
+ * Implementation of the pool of threads used for parallel scans.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <boost/asio/post.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <vector>
+#include "ScanPool.h"
+
+ScanPool::ScanPool(const size_t numThreads) :
+    numThreads(std::max<size_t>(1, numThreads)), pool(this->numThreads) {
+}
+
+ScanPool::~ScanPool() {
+    pool.join();
+}
+
+void
+ScanPool::run(const size_t numSegs, const ScanTask& scan,
+              const DoneTask& done) {
+    const size_t workers = std::min(numThreads, numSegs);
+    if (workers <= 1) {
+        // Not worth handing out to other threads
+        for (size_t s = 0; (s < numSegs); s++) {
+            scan(s, 0);
+            if (done && !done(s)) {
+                break;
+            }
+        }
+        return;
+    }
+    // The state shared by the workers and this thread, guarded by mutex
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t next = 0;             // The next segment to be scanned
+    size_t consumed = 0;         // The number of segments passed to done
+    size_t running = 0;          // The number of workers posted to the pool
+    bool stopped = false;        // Flag set when done wants no more
+    std::vector<bool> ready(numSegs, false);
+    std::vector<size_t> idle;    // The indexes of workers not posted
+    std::exception_ptr error;
+    const size_t window = workers * WindowPerThread;
+    // Check if a worker could take the next segment
+    auto canScan = [&] {
+        return !error && !stopped && next < numSegs &&
+            next < consumed + window;
+    };
+    // Each worker repeatedly takes the next segment (instead of a fixed
+    // range of segments), so that a slow segment does not hold up others.
+    // A worker never waits for the window to move (e.g., while done writes
+    // to a slow client). It returns its thread to the pool instead and is
+    // posted again (see postIdle) once done consumes a segment.
+    auto worker = [&](const size_t w) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (canScan()) {
+            const size_t s = next++;
+            lock.unlock();
+            std::exception_ptr scanError;
+            try {
+                scan(s, w);
+            } catch (...) {
+                scanError = std::current_exception();
+            }
+            lock.lock();
+            error = (error ? error : scanError);
+            ready[s] = true;
+            cv.notify_all();
+        }
+        idle.push_back(w);
+        running--;
+        cv.notify_all();
+    };
+    // Post idle workers to the pool while there are segments they can take.
+    // The caller must hold the mutex.
+    auto postIdle = [&] {
+        for (; (running < workers && canScan()); running++) {
+            const size_t w = idle.back();
+            idle.pop_back();
+            boost::asio::post(pool, [&worker, w] { worker(w); });
+        }
+    };
+    for (size_t w = workers; (w > 0); w--) {
+        idle.push_back(w - 1);
+    }
+    // Pass the segments to done in order, as soon as each one is ready. A
+    // segment that is not ready was taken by a worker that is still
+    // running, because workers stop taking segments only at the window.
+    std::unique_lock<std::mutex> lock(mutex);
+    postIdle();
+    for (size_t s = 0; (s < numSegs && !error); s++) {
+        cv.wait(lock, [&] { return ready[s] || error; });
+        if (error) {
+            break;
+        }
+        lock.unlock();
+        bool more = true;
+        try {
+            more = (!done || done(s));
+        } catch (...) {
+            lock.lock();
+            error = std::current_exception();
+            cv.notify_all();
+            break;
+        }
+        lock.lock();
+        consumed = s + 1;
+        stopped  = !more;
+        if (stopped) {
+            break;
+        }
+        postIdle();
+    }
+    // The workers refer to the state on this stack. So wait for them.
+    cv.wait(lock, [&] { return running == 0; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef SCAN_POOL_H
+#define SCAN_POOL_H
+
+/*
+ * A pool of threads used to scan the segments of a table in parallel. A
+ * query splits its table into segments and the segments are handed out to
+ * the workers. The results of the segments are then consumed by the
+ * query's own thread in the original (segment) order, as soon as they are
+ * ready, so the output is the same as that of a sequential scan.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <boost/asio/thread_pool.hpp>
+#include <functional>
+
+/**
+ * A fixed pool of threads shared by all queries. This class is MT-safe.
+ */
+class ScanPool {
+public:
+    /**
+     * The method called (on a worker thread) to scan a segment. The
+     * parameters are the index of the segment and the index of the worker
+     * (from 0 to getThreads() - 1), which can be used to reuse per-worker
+     * scratch space.
+     */
+    using ScanTask = std::function<void(const size_t, const size_t)>;
+
+    /**
+     * The method called (on the query's own thread) once a segment has been
+     * scanned. It is called for the segments in ascending order. It returns
+     * false to stop the scan early (e.g., once enough rows were found).
+     */
+    using DoneTask = std::function<bool(const size_t)>;
+
+    /**
+     * Create the pool.
+     *
+     * @param numThreads The maximum number of threads that work on a query
+     * at the same time (the degree of parallelism). If this value is 1,
+     * queries are run on their own thread only.
+     */
+    explicit ScanPool(const size_t numThreads);
+
+    /** The destructor waits for the threads in the pool to finish. */
+    ~ScanPool();
+
+    /**
+     * Obtain the number of threads that work on a query.
+     *
+     * @return The degree of parallelism.
+     */
+    size_t getThreads() const { return numThreads; }
+
+    /**
+     * Scan a number of segments, using the pool if there is more than one
+     * segment. This method returns once all the segments have been scanned
+     * and done has been called for each of them. If done returns false, the
+     * remaining segments are skipped (segments that are already being
+     * scanned are finished, but not passed to done). If scan or done throws
+     * an exception, the remaining segments are skipped and the exception is
+     * rethrown to the caller.
+     *
+     * @param numSegs The number of segments to be scanned.
+     *
+     * @param scan The method called to scan each segment. It may be called
+     * for different segments on different threads at the same time.
+     *
+     * @param done The method called, on the caller's thread and in segment
+     * order, after each segment has been scanned. May be nullptr.
+     */
+    void run(const size_t numSegs, const ScanTask& scan,
+             const DoneTask& done = nullptr);
+
+private:
+    /**
+     * The maximum number of segments that may be scanned ahead of the
+     * segment being consumed by done, per worker. This bounds the memory
+     * used for results that are waiting to be consumed. Workers that reach
+     * it return their threads to the pool, so that a query whose done is
+     * slow (e.g., writing to a client that stopped reading) does not hold
+     * up the scans of other queries.
+     */
+    static constexpr size_t WindowPerThread = 4;
+
+    /** The degree of parallelism. */
+    const size_t numThreads;
+
+    /** The threads on which segments are scanned. */
+    boost::asio::thread_pool pool;
+};
+
+#endif /* SCAN_POOL_H */
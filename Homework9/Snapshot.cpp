@@ -0,0 +1,375 @@
+/*
+ * Implementation of the binary snapshot format for tables.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <boost/crc.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstring>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "Snapshot.h"
+
+/**
+ * Helper method to compute the number of bytes needed to pad a block to a
+ * multiple of 8 bytes.
+ *
+ * @param size The size of the block.
+ *
+ * @return The number of padding bytes (0 to 7).
+ */
+static size_t
+padding(const size_t size) {
+    return (8 - size % 8) % 8;
+}
+
+/**
+ * Helper method to write a column block: its header, the length of each
+ * value, and the values.
+ *
+ * @param os The stream to which the block is to be written.
+ *
+ * @param lens The length of each value.
+ *
+ * @param data The values stored back-to-back.
+ */
+static void
+writeBlock(std::ostream& os, const std::vector<uint32_t>& lens,
+           const std::string& data) {
+    boost::crc_32_type crc;
+    crc.process_bytes(lens.data(), lens.size() * sizeof(uint32_t));
+    crc.process_bytes(data.data(), data.size());
+    const uint32_t header[] = {static_cast<uint32_t>(lens.size()),
+        static_cast<uint32_t>(data.size()), crc.checksum(), 0};
+    os.write(reinterpret_cast<const char*>(header), sizeof(header));
+    os.write(reinterpret_cast<const char*>(lens.data()),
+             lens.size() * sizeof(uint32_t));
+    os.write(data.data(), data.size());
+    os.write("\0\0\0\0\0\0\0",
+             padding(lens.size() * sizeof(uint32_t) + data.size()));
+}
+
+uint32_t
+Snapshot::writeSegment(std::ostream& os, const ColumnStore& store,
+                       const Segment& seg, const size_t segIdx,
+                       const RowFilter& filter) {
+    // The blocks of a segment that has not changed since it was loaded
+    // from a snapshot can be copied as they are.
+    const std::string_view src = seg.getSource();
+    if (store.hasSnapshotSource() && !src.empty()) {
+        os.write(src.data(), src.size());
+        return seg.getRowCount();
+    }
+    uint32_t numRows = 0;
+    std::vector<uint32_t> lens;
+    std::string data;
+    for (size_t col = 0; (col < seg.cols.size()); col++) {
+        numRows = 0;
+        for (size_t row = 0; (row < seg.getRowCount()); row++) {
+            if (filter ? !filter(segIdx, row) : seg.isDeleted(row)) {
+                continue;
+            }
+            const std::string_view val = seg.cols[col].at(row);
+            lens.push_back(val.size());
+            data.append(val.data(), val.size());
+            numRows++;
+        }
+        writeBlock(os, lens, data);
+        lens.clear();
+        data.clear();
+    }
+    return numRows;
+}
+
+void
+Snapshot::writeDirectory(std::ostream& os, const uint64_t numRows,
+                         const std::vector<uint64_t>& offsets) {
+    Directory dir = {numRows, static_cast<uint32_t>(offsets.size()), 0};
+    boost::crc_32_type crc;
+    crc.process_bytes(&dir.numRows, sizeof(dir.numRows));
+    crc.process_bytes(offsets.data(), offsets.size() * sizeof(uint64_t));
+    dir.crc = crc.checksum();
+    os.write(reinterpret_cast<const char*>(&dir), sizeof(dir));
+    os.write(reinterpret_cast<const char*>(offsets.data()),
+             offsets.size() * sizeof(uint64_t));
+}
+
+bool
+Snapshot::isSnapshot(const MappedFile& file) {
+    return file.size() >= offsetof(Header, dirOffset) &&
+        std::memcmp(file.begin(), Magic, sizeof(Header::magic)) == 0;
+}
+
+bool
+Snapshot::hasExtension(const std::string& path) {
+    const std::string ext = Extension;
+    return path.size() > ext.size() &&
+        path.compare(path.size() - ext.size(), ext.size(), ext) == 0;
+}
+
+void
+Snapshot::save(std::ostream& os, ColumnStore& store, const StrVec& colNames,
+               const RowFilter& filter) {
+    if (!os.good()) {
+        throw std::runtime_error("The supplied stream was not good.");
+    }
+    // The schema is the length of each column name followed by the name.
+    std::string schema;
+    for (const auto& name : colNames) {
+        const uint32_t len = name.size();
+        schema.append(reinterpret_cast<const char*>(&len), sizeof(len));
+        schema += name;
+    }
+    boost::crc_32_type schemaCrc;
+    schemaCrc.process_bytes(schema.data(), schema.size());
+    schema.append(padding(schema.size()), '\0');
+    // The number of rows and segments are filled in once all the rows have
+    // been written, as rows may be deleted while the snapshot is written.
+    Header hdr = {};
+    std::memcpy(hdr.magic, Magic, sizeof(hdr.magic));
+    hdr.version   = Version;
+    hdr.numCols   = colNames.size();
+    hdr.schemaCrc = schemaCrc.checksum();
+    const auto hdrPos = os.tellp();
+    os.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    os << schema;
+    // Write each segment, noting where it is for the directory.
+    std::vector<uint64_t> offsets;
+    for (size_t s = 0; (s < store.getSegmentCount()); s++) {
+        Segment& seg = store.getSegment(s);
+        std::shared_lock<std::shared_mutex> lock(seg.segMutex);
+        seg.setUnsaved(false);
+        const uint64_t offset = os.tellp() - hdrPos;
+        hdr.numRows += writeSegment(os, store, seg, s, filter);
+        seg.setFileBlocks(offset, os.tellp() - hdrPos - offset);
+        offsets.push_back(offset);
+    }
+    hdr.numSegs   = offsets.size();
+    hdr.dirOffset = os.tellp() - hdrPos;
+    writeDirectory(os, hdr.numRows, offsets);
+    // Now fill in the header.
+    const auto endPos = os.tellp();
+    os.seekp(hdrPos);
+    os.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    os.seekp(endPos);
+}
+
+bool
+Snapshot::append(const std::string& path, ColumnStore& store,
+                 const StrVec& colNames) {
+    const MappedFile::FileId fileId = store.getSnapshotFile();
+    if (fileId == MappedFile::FileId(0, 0) ||
+        fileId != MappedFile::getFileId(path)) {
+        return false;  // Not the file the segments were saved to
+    }
+    const int fd = open(path.c_str(), O_RDWR);
+    if (fd == -1) {
+        return false;
+    }
+    struct stat info;
+    Header hdr;
+    if (fstat(fd, &info) != 0 ||
+        pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        std::memcmp(hdr.magic, Magic, sizeof(hdr.magic)) != 0 ||
+        hdr.version != Version || hdr.numCols != colNames.size()) {
+        close(fd);
+        return false;
+    }
+    // Compact the file (by rewriting it) once most of it would be
+    // segments that are no longer in use.
+    const uint64_t fileSize = info.st_size;
+    uint64_t liveBytes = 0;
+    for (size_t s = 0; (s < store.getSegmentCount()); s++) {
+        liveBytes += store.getSegment(s).getFileBytes();
+    }
+    if (fileSize > 2 * liveBytes + 64 * 1024) {
+        close(fd);
+        return false;
+    }
+    // Write the changed segments (in memory first) after the end of the
+    // file, followed by the new directory.
+    std::ostringstream os;
+    std::vector<uint64_t> offsets;
+    std::vector<std::pair<size_t, uint64_t>> written;
+    uint64_t numRows = 0;
+    for (size_t s = 0; (s < store.getSegmentCount()); s++) {
+        Segment& seg = store.getSegment(s);
+        std::shared_lock<std::shared_mutex> lock(seg.segMutex);
+        if (!seg.isUnsaved()) {
+            offsets.push_back(seg.getFileOffset());
+            numRows += seg.getLiveRowCount();
+            continue;
+        }
+        seg.setUnsaved(false);
+        const uint64_t offset = fileSize + os.tellp();
+        numRows += writeSegment(os, store, seg, s, nullptr);
+        offsets.push_back(offset);
+        written.emplace_back(s, offset);
+    }
+    hdr.numRows   = numRows;
+    hdr.numSegs   = offsets.size();
+    hdr.dirOffset = fileSize + os.tellp();
+    writeDirectory(os, numRows, offsets);
+    // The new directory must be on disk before the header points at it.
+    const std::string buf = os.str();
+    bool ok = true;
+    for (size_t done = 0; (ok && done < buf.size()); ) {
+        const ssize_t n = pwrite(fd, buf.data() + done, buf.size() - done,
+                                 fileSize + done);
+        ok = (n > 0);
+        done += ok ? n : 0;
+    }
+    ok = ok && fdatasync(fd) == 0 &&
+        pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+        fdatasync(fd) == 0;
+    close(fd);
+    if (!ok) {
+        throw std::runtime_error("Error writing " + path);
+    }
+    // Now the segments that were written are at their new locations.
+    for (size_t i = 0; (i < written.size()); i++) {
+        const size_t s = written[i].first;
+        const uint64_t end = (i + 1 < written.size()) ? written[i + 1].second :
+            hdr.dirOffset;
+        store.getSegment(s).setFileBlocks(written[i].second,
+                                          end - written[i].second);
+    }
+    return true;
+}
+
+StrVec
+Snapshot::load(std::shared_ptr<MappedFile> file, ColumnStore& store) {
+    const char *pos = file->begin(), *end = file->end();
+    // Helper lambda to check that the file has enough bytes left
+    auto need = [&pos, end](const size_t bytes) {
+        if (static_cast<size_t>(end - pos) < bytes) {
+            throw std::runtime_error("Snapshot is truncated");
+        }
+    };
+    // Version 1 headers do not have the directory offset.
+    Header hdr = {};
+    need(offsetof(Header, dirOffset));
+    std::memcpy(&hdr, pos, offsetof(Header, dirOffset));
+    if (std::memcmp(hdr.magic, Magic, sizeof(hdr.magic)) != 0) {
+        throw std::runtime_error("Not a snapshot file");
+    }
+    if (hdr.version != 1 && hdr.version != Version) {
+        throw std::runtime_error("Unsupported snapshot version " +
+                                 std::to_string(hdr.version));
+    }
+    const size_t hdrSize = (hdr.version == 1) ? offsetof(Header, dirOffset) :
+        sizeof(hdr);
+    need(hdrSize);
+    std::memcpy(&hdr, pos, hdrSize);
+    pos += hdrSize;
+    // Read the column names
+    StrVec colNames;
+    const char *schema = pos;
+    for (uint32_t col = 0; (col < hdr.numCols); col++) {
+        uint32_t len;
+        need(sizeof(len));
+        std::memcpy(&len, pos, sizeof(len));
+        pos += sizeof(len);
+        need(len);
+        colNames.emplace_back(pos, len);
+        pos += len;
+    }
+    boost::crc_32_type schemaCrc;
+    schemaCrc.process_bytes(schema, pos - schema);
+    if (schemaCrc.checksum() != hdr.schemaCrc) {
+        throw std::runtime_error("Snapshot schema checksum mismatch");
+    }
+    need(padding(pos - schema));
+    pos += padding(pos - schema);
+    // Find the segments: listed in the directory, or one after another
+    // (in version 1 files).
+    std::vector<uint64_t> offsets;
+    if (hdr.version != 1) {
+        Directory dir;
+        if (hdr.dirOffset > file->size() ||
+            file->size() - hdr.dirOffset < sizeof(dir)) {
+            throw std::runtime_error("Snapshot is truncated");
+        }
+        std::memcpy(&dir, file->begin() + hdr.dirOffset, sizeof(dir));
+        offsets.resize(dir.numSegs);
+        const size_t offsetsSize = offsets.size() * sizeof(uint64_t);
+        if (dir.numSegs != hdr.numSegs || dir.numRows != hdr.numRows ||
+            file->size() - hdr.dirOffset - sizeof(dir) < offsetsSize) {
+            throw std::runtime_error("Snapshot directory is inconsistent");
+        }
+        std::memcpy(offsets.data(), file->begin() + hdr.dirOffset +
+                    sizeof(dir), offsetsSize);
+        boost::crc_32_type crc;
+        crc.process_bytes(&dir.numRows, sizeof(dir.numRows));
+        crc.process_bytes(offsets.data(), offsetsSize);
+        if (crc.checksum() != dir.crc) {
+            throw std::runtime_error("Snapshot directory checksum mismatch");
+        }
+    }
+    // Point the columns in each segment at the values in the file
+    std::vector<std::unique_ptr<Segment>> segments;
+    uint64_t numRows = 0;
+    for (uint32_t s = 0; (s < hdr.numSegs); s++) {
+        if (!offsets.empty()) {
+            if (offsets[s] > hdr.dirOffset) {
+                throw std::runtime_error("Snapshot directory is corrupt");
+            }
+            pos = file->begin() + offsets[s];
+        }
+        const char *segStart = pos;
+        auto seg = std::make_unique<Segment>(hdr.numCols);
+        for (auto& col : seg->cols) {
+            BlockHeader blk;
+            need(sizeof(blk));
+            std::memcpy(&blk, pos, sizeof(blk));
+            pos += sizeof(blk);
+            const size_t lensSize = size_t(blk.numRows) * sizeof(uint32_t);
+            need(lensSize + blk.dataSize);
+            const char *lens = pos, *data = pos + lensSize;
+            boost::crc_32_type crc;
+            crc.process_bytes(pos, lensSize + blk.dataSize);
+            if (crc.checksum() != blk.crc) {
+                throw std::runtime_error("Snapshot block checksum mismatch");
+            }
+            if (blk.numRows > ColumnStore::SegmentRows ||
+                (&col != &seg->cols.front() &&
+                 blk.numRows != seg->cols.front().size())) {
+                throw std::runtime_error("Snapshot segment is inconsistent");
+            }
+            col.reserve(blk.numRows);
+            col.setMappedBase(data);
+            size_t offset = 0;
+            for (uint32_t row = 0; (row < blk.numRows); row++) {
+                uint32_t len;
+                std::memcpy(&len, lens + row * sizeof(len), sizeof(len));
+                if (offset + len > blk.dataSize) {
+                    throw std::runtime_error("Snapshot block is corrupt");
+                }
+                col.appendMapped(std::string_view(data + offset, len));
+                offset += len;
+            }
+            pos = data + blk.dataSize;
+            need(padding(lensSize + blk.dataSize));
+            pos += padding(lensSize + blk.dataSize);
+        }
+        seg->encode();
+        seg->setSource(std::string_view(segStart, pos - segStart));
+        seg->setFileBlocks(segStart - file->begin(), pos - segStart);
+        numRows += seg->getRowCount();
+        segments.push_back(std::move(seg));
+    }
+    if (numRows != hdr.numRows) {
+        throw std::runtime_error("Snapshot row count mismatch");
+    }
+    store.assign(std::move(segments), file);
+    if (hdr.version != 1) {
+        store.setSnapshotFile(file->getFileId());
+    }
+    return colNames;
+}
@@ -0,0 +1,195 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/*
+ * A binary snapshot format for tables. Loading a CSV file requires every
+ * line to be split into values. A snapshot instead stores the values of
+ * each column (per segment) back-to-back along with their lengths, i.e.,
+ * in the same layout as the ColumnStore. So a snapshot is loaded by
+ * memory-mapping the file and pointing the columns at the values in the
+ * file, without any parsing.
+ *
+ * The layout of a snapshot file (all integers are little-endian) is:
+ *
+ *     Header      : magic "SQLAIRSN", version, number of columns, number of
+ *                   rows, number of segments, CRC-32 of the schema, and
+ *                   the offset of the segment directory
+ *     Schema      : for each column, the length of its name and the name
+ *     Segments    : for each segment, for each column, a block with the
+ *                   number of rows, size of the values, CRC-32 of the
+ *                   block, the length of each value, and the values
+ *     Directory   : the number of rows, number of segments, CRC-32 of the
+ *                   directory, and the offset of each segment
+ *
+ * The schema and each block are padded to a multiple of 8 bytes. Version 1
+ * files have no directory (and no offset in the header): the segments
+ * follow each other.
+ *
+ * The directory allows changes to be saved without rewriting the file
+ * (see append): the changed segments and a new directory are appended,
+ * and then the header is updated to point at the new directory. The bytes
+ * already in the file never change, so this is safe even while the file
+ * is mapped (and a crash leaves the old directory in effect). Once most
+ * of the file is segments that are no longer in use, the file is
+ * rewritten instead.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "ColumnStore.h"
+
+/**
+ * Methods to write and read snapshot files. The methods are static as
+ * this class has no state.
+ */
+class Snapshot {
+public:
+    /** The file name extension used for snapshots */
+    static constexpr const char* Extension = ".sqlair";
+
+    /**
+     * Check if a mapped file is a snapshot (rather than a CSV file).
+     *
+     * @param file The file to be checked.
+     *
+     * @return This method returns true if the file starts with the magic
+     * bytes of a snapshot.
+     */
+    static bool isSnapshot(const MappedFile& file);
+
+    /**
+     * Check if a path has the file name extension used for snapshots.
+     *
+     * @param path The path to be checked.
+     *
+     * @return This method returns true if path ends with ".sqlair".
+     */
+    static bool hasExtension(const std::string& path);
+
+    /**
+     * Write all the (non-deleted) rows in a column store as a snapshot.
+     * Each segment in the store is written as a segment in the file. The
+     * blocks of segments that have not changed since they were loaded from
+     * a snapshot are copied from the snapshot as they are. The location of
+     * each segment in the file is recorded in the segment (see
+     * Segment::getFileOffset). The caller must hold the store's save mutex.
+     *
+     * @param os The stream to which the snapshot is to be written.
+     *
+     * @param store The rows to be written. Each segment is locked (shared)
+     * while its rows are copied out.
+     *
+     * @param colNames The names of the columns.
+     *
+     * @param filter The rows to be written. If this is nullptr, all the
+     * rows that are not deleted are written.
+     */
+    static void save(std::ostream& os, ColumnStore& store,
+                     const StrVec& colNames, const RowFilter& filter = nullptr);
+
+    /**
+     * Save the changes to a column store by appending the segments that
+     * changed (and a new directory) to the snapshot file the store was
+     * last saved to or loaded from. The caller must hold the store's save
+     * mutex, and a shared lock on the table (so that no segments are
+     * added or removed).
+     *
+     * @param path The path to the snapshot file.
+     *
+     * @param store The rows to be saved.
+     *
+     * @param colNames The names of the columns.
+     *
+     * @return This method returns false if the file is not the one the
+     * store was saved to (or loaded from), or if it has too many segments
+     * that are no longer in use. The caller must then write the whole
+     * file instead.
+     *
+     * @exception std::runtime_error This method throws an exception if the
+     * file could not be written.
+     */
+    static bool append(const std::string& path, ColumnStore& store,
+                       const StrVec& colNames);
+
+    /**
+     * Replace the contents of a column store with the rows in a snapshot.
+     * The values refer directly into the mapped file. The checksums of
+     * all the blocks are verified.
+     *
+     * @param file The mapped snapshot. The column store keeps the file
+     * mapped as long as it needs it.
+     *
+     * @param store The column store into which the rows are loaded.
+     *
+     * @return The names of the columns.
+     *
+     * @exception std::runtime_error This method throws an exception if the
+     * file is not a valid snapshot (e.g., truncated or a checksum does not
+     * match).
+     */
+    static StrVec load(std::shared_ptr<MappedFile> file, ColumnStore& store);
+
+private:
+    /** The magic bytes at the start of each snapshot file */
+    static constexpr char Magic[9] = "SQLAIRSN";
+
+    /** The version of the format written by this class */
+    static constexpr uint32_t Version = 2;
+
+    /** The fixed-size header at the start of a snapshot file. Version 1
+     * headers end before dirOffset.
+     */
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t numCols;
+        uint64_t numRows;
+        uint32_t numSegs;
+        uint32_t schemaCrc;
+        uint64_t dirOffset;
+    };
+
+    /** The fixed-size start of a segment directory. The offset of each
+     * segment follows it.
+     */
+    struct Directory {
+        uint64_t numRows;
+        uint32_t numSegs;
+        uint32_t crc;
+    };
+
+    /**
+     * Helper method to write a segment's blocks. The blocks are copied
+     * from the snapshot the segment was loaded from if it has not changed.
+     * The caller must hold a lock on the segment.
+     *
+     * @return The number of rows written.
+     */
+    static uint32_t writeSegment(std::ostream& os, const ColumnStore& store,
+                                 const Segment& seg, const size_t segIdx,
+                                 const RowFilter& filter);
+
+    /**
+     * Helper method to write a segment directory.
+     *
+     * @param numRows The number of rows in the segments.
+     *
+     * @param offsets The offset of each segment.
+     */
+    static void writeDirectory(std::ostream& os, const uint64_t numRows,
+                               const std::vector<uint64_t>& offsets);
+
+    /** The fixed-size header at the start of each column block */
+    struct BlockHeader {
+        uint32_t numRows;
+        uint32_t dataSize;
+        uint32_t crc;
+        uint32_t reserved;
+    };
+};
+
+#endif /* SNAPSHOT_H */
@@ -0,0 +1,112 @@
+/*
+ * Implementation of the sorted index on a column of a CSV.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <algorithm>
+#include <mutex>
+#include "SortedIndex.h"
+
+/**
+ * Helper method to remove a row from an entry in an index, dropping the
+ * entry once it has no rows.
+ *
+ * @param entries The entries in the index.
+ *
+ * @param entry The entry for the value the row had.
+ *
+ * @param id The row to be removed.
+ */
+template <typename Map>
+static void
+eraseRow(Map& entries, const typename Map::iterator entry, const RowId id) {
+    if (entry == entries.end()) {
+        return;  // Value is not in the index.
+    }
+    std::vector<RowId>& ids = entry->second;
+    ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+    if (ids.empty()) {
+        entries.erase(entry);
+    }
+}
+
+SortedIndex::SortedIndex(const int colIdx, const ColumnType type) :
+    colIdx(colIdx),
+    numeric(type == ColumnType::Int || type == ColumnType::Double) {
+}
+
+void
+SortedIndex::add(const Segment& seg, const size_t segIdx) {
+    const Column& col = seg.cols.at(colIdx);
+    for (size_t row = 0; (row < seg.getRowCount()); row++) {
+        if (!seg.isDeleted(row)) {
+            insert(col.at(row), ColumnStore::toRowId(segIdx, row));
+        }
+    }
+}
+
+template <typename Iter>
+std::vector<RowId>
+SortedIndex::collect(Iter first, const Iter last) {
+    std::vector<RowId> ids;
+    for (; (first != last); first++) {
+        ids.insert(ids.end(), first->second.begin(), first->second.end());
+    }
+    return ids;
+}
+
+std::vector<RowId>
+SortedIndex::find(const Range& range) const {
+    std::vector<RowId> ids;
+    {
+        // The ends are included here. Rows at an excluded end are dropped
+        // when the rows are re-checked.
+        std::shared_lock<std::shared_mutex> lock(indexMutex);
+        if (numeric) {
+            ids = collect(numEntries.lower_bound(range.getLow()),
+                          numEntries.upper_bound(range.getHigh()));
+        } else {
+            ids = collect(textEntries.lower_bound(range.getLowText()),
+                          range.hasHigh() ?
+                          textEntries.upper_bound(range.getHighText()) :
+                          textEntries.end());
+        }
+    }
+    // The rows are grouped by value. So sort to restore row order.
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+void
+SortedIndex::insert(std::string_view value, const RowId id) {
+    double num;
+    if (numeric && !Range::toDouble(value, num)) {
+        return;  // Not in any numeric range
+    }
+    std::unique_lock<std::shared_mutex> lock(indexMutex);
+    if (numeric) {
+        numEntries[num].push_back(id);
+    } else {
+        auto entry = textEntries.lower_bound(value);
+        if (entry == textEntries.end() || entry->first != value) {
+            entry = textEntries.emplace_hint(entry, std::string(value),
+                                             std::vector<RowId>());
+        }
+        entry->second.push_back(id);
+    }
+}
+
+void
+SortedIndex::erase(std::string_view value, const RowId id) {
+    double num;
+    if (numeric && !Range::toDouble(value, num)) {
+        return;  // Value is not in the index.
+    }
+    std::unique_lock<std::shared_mutex> lock(indexMutex);
+    if (numeric) {
+        eraseRow(numEntries, numEntries.find(num), id);
+    } else {
+        eraseRow(textEntries, textEntries.find(value), id);
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef SORTED_INDEX_H
+#define SORTED_INDEX_H
+
+/*
+ * A sorted index on a column of a CSV. The index keeps the distinct values
+ * in the column in order (in a balanced tree), each with the list of rows
+ * that have that value. This enables range conditions, such as
+ * "where latitude > 40", to find the k matching rows in O(log n + k) time
+ * without scanning the whole table.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <shared_mutex>
+#include "ColumnStore.h"
+
+/**
+ * A sorted index on one column of a ColumnStore. The values of a numeric
+ * column are kept in numeric order; values that are not numbers are not
+ * indexed (as they are not in any numeric range). The index is MT-safe.
+ * The rows returned by the index must be re-checked against the column
+ * store (while holding the segment's lock) as the rows may change after
+ * the index has been looked up.
+ */
+class SortedIndex {
+public:
+    /**
+     * Create an index on a given column.
+     *
+     * @param colIdx The index of the column on which this index is built.
+     *
+     * @param type The type of the column (see ColumnStore::getColumnType).
+     */
+    SortedIndex(const int colIdx, const ColumnType type);
+
+    /**
+     * Add all the rows in a given segment to this index. The caller must
+     * ensure the segment does not change, e.g., by locking the CSV.
+     *
+     * @param seg The segment whose rows are to be added.
+     *
+     * @param segIdx The index of the segment in the column store.
+     */
+    void add(const Segment& seg, const size_t segIdx);
+
+    /**
+     * Check if this index can be used to find the rows in a range.
+     *
+     * @param range The range of values to look for.
+     *
+     * @return This method returns true if the range compares values in the
+     * same way (as numbers or strings) as this index orders them.
+     */
+    bool canFind(const Range& range) const {
+        return range.isNumeric() == numeric;
+    }
+
+    /**
+     * Obtain the rows whose value may be in a given range, in ascending
+     * order. The rows include all the rows in the range (and possibly rows
+     * at the ends of the range that are excluded from it).
+     *
+     * @param range The range of values to look for. See canFind.
+     *
+     * @return The rows that had a value in the range when this method was
+     * called.
+     */
+    std::vector<RowId> find(const Range& range) const;
+
+    /**
+     * Record that a row has been added with a given value.
+     *
+     * @param value The value of the indexed column in the row.
+     *
+     * @param id The row that has the value.
+     */
+    void insert(std::string_view value, const RowId id);
+
+    /**
+     * Record that a row no longer has a given value (because it was
+     * updated or deleted).
+     *
+     * @param value The old value of the indexed column in the row.
+     *
+     * @param id The row that no longer has the value.
+     */
+    void erase(std::string_view value, const RowId id);
+
+    /**
+     * Obtain the column on which this index was built.
+     *
+     * @return The index of the column on which this index was built.
+     */
+    int getColumnIndex() const { return colIdx; }
+
+private:
+    /**
+     * Helper method to collect the rows in a range of entries.
+     *
+     * @param first The first entry in the range.
+     *
+     * @param last The entry just past the range.
+     *
+     * @return The rows in the entries, in ascending order.
+     */
+    template <typename Iter>
+    static std::vector<RowId> collect(Iter first, const Iter last);
+
+    /** The column on which this index is built. */
+    const int colIdx;
+
+    /** Flag to indicate if the values are ordered as numbers. */
+    const bool numeric;
+
+    /** The rows with each distinct number (for numeric columns). */
+    std::map<double, std::vector<RowId>> numEntries;
+
+    /** The rows with each distinct value (for other columns). */
+    std::map<std::string, std::vector<RowId>, std::less<>> textEntries;
+
+    /** Reader-writer lock to enable MT-safe lookups and changes. */
+    mutable std::shared_mutex indexMutex;
+};
+
+#endif /* SORTED_INDEX_H */
@@ -0,0 +1,69 @@
+/*
+ * Implementation of the cache of parsed SQL-air statements.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <cctype>
+#include "StatementCache.h"
+
+StatementPtr
+StatementCache::find(const std::string& sql) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto entry = lookup.find(sql);
+    if (entry == lookup.end()) {
+        return nullptr;
+    }
+    // Move the statement to the front as it is now the most recently used
+    entries.splice(entries.begin(), entries, entry->second);
+    return entry->second->second;
+}
+
+void
+StatementCache::insert(const std::string& sql, StatementPtr stmt) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const auto entry = lookup.find(sql);
+    if (entry != lookup.end()) {
+        // Replace the stale statement (e.g., if the CSV was reloaded)
+        entry->second->second = std::move(stmt);
+        entries.splice(entries.begin(), entries, entry->second);
+        return;
+    }
+    if (entries.size() >= capacity) {
+        // Drop the least recently used statement to make room
+        lookup.erase(entries.back().first);
+        entries.pop_back();
+    }
+    entries.emplace_front(sql, std::move(stmt));
+    lookup[sql] = entries.begin();
+}
+
+std::string
+StatementCache::normalize(const std::string& sql) {
+    std::string result;
+    char quote = 0;  // The quote character if we are inside a quote
+    for (size_t i = 0; (i < sql.size()); i++) {
+        const char c = sql[i];
+        if (quote != 0) {
+            result += c;
+            if (c == '\\' && i + 1 < sql.size()) {
+                result += sql[++i];  // Escaped character
+            } else if (c == quote) {
+                quote = 0;
+            }
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            // Replace runs of white space with a single space
+            if (!result.empty() && result.back() != ' ') {
+                result += ' ';
+            }
+        } else {
+            quote = (c == '"' || c == '\'') ? c : 0;
+            result += c;
+        }
+    }
+    // Remove the trailing space and semicolon (if any)
+    while (!result.empty() && (result.back() == ' ' || result.back() == ';')) {
+        result.pop_back();
+    }
+    return result;
+}
@@ -0,0 +1,138 @@
+#ifndef STATEMENT_CACHE_H
+#define STATEMENT_CACHE_H
+
+/*
+ * A bounded cache of parsed SQL-air statements. Parsing a statement
+ * (tokenizing it, extracting the column names and where clause, and looking
+ * up column indexes) allocates many strings. Typical workloads repeat the
+ * same few statements over and over. So the parsed form of each statement
+ * is cached, keyed by its normalized text, and the least recently used
+ * statements are dropped when the cache is full.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include "TopK.h"
+
+class Aggregation;
+
+/** Shortcut to refer to a list of strings */
+using StrVec = std::vector<std::string>;
+
+/**
+ * The fully parsed form of a select, update, or delete statement. The
+ * column indexes are valid only for the CSV load identified by schemaId.
+ */
+struct Statement {
+    /** The kinds of statements that are cached. */
+    enum Kind { None, Select, Update, Delete, Aggregate };
+
+    /** The kind of statement. None if the statement is not cacheable. */
+    Kind kind = None;
+
+    /** Flag to indicate if the statement has a "wait" clause. */
+    bool mustWait = false;
+
+    /** The CSV file or URL as given in the statement (may be empty to
+     * refer to the most recently used CSV).
+     */
+    std::string fileOrURL;
+
+    /** The CSV::schemaId of the CSV against which this was parsed. */
+    unsigned long schemaId = 0;
+
+    /** The columns to be printed (select) or changed (update). */
+    StrVec colNames;
+
+    /** The index of each column in colNames. */
+    std::vector<int> colIdxs;
+
+    /** The new value for each column (update). */
+    StrVec values;
+
+    /** The column in the where clause, or -1 if there is none. */
+    int whereColIdx = -1;
+
+    /** The condition in the where clause. */
+    std::string cond;
+
+    /** The value in the where clause. */
+    std::string value;
+
+    /** The aggregates to be computed (select with aggregate functions). */
+    std::shared_ptr<const Aggregation> aggregation;
+
+    /** The order by and limit clauses (select). */
+    OrderBy order;
+};
+
+/** Shortcut to a cached statement that is shared between threads */
+using StatementPtr = std::shared_ptr<const Statement>;
+
+/**
+ * A least-recently-used cache of parsed statements. This class is MT-safe.
+ */
+class StatementCache {
+public:
+    /**
+     * Create an empty cache.
+     *
+     * @param capacity The maximum number of statements in the cache.
+     */
+    explicit StatementCache(const size_t capacity = 1024) :
+        capacity(capacity) {}
+
+    /**
+     * Obtain the parsed form of a statement and mark it as recently used.
+     *
+     * @param sql The normalized text of the statement.
+     *
+     * @return The cached statement, or nullptr if it is not in the cache.
+     */
+    StatementPtr find(const std::string& sql);
+
+    /**
+     * Add (or replace) the parsed form of a statement. The least recently
+     * used statement is dropped if the cache is full.
+     *
+     * @param sql The normalized text of the statement.
+     *
+     * @param stmt The parsed statement.
+     */
+    void insert(const std::string& sql, StatementPtr stmt);
+
+    /**
+     * Normalize the text of a statement so that statements differing only
+     * in white space (outside of quotes) or a trailing semicolon share an
+     * entry in the cache.
+     *
+     * @param sql The text of the statement.
+     *
+     * @return The normalized text.
+     */
+    static std::string normalize(const std::string& sql);
+
+private:
+    /** An entry in the cache: the normalized text and parsed statement */
+    using Entry = std::pair<std::string, StatementPtr>;
+
+    /** The maximum number of statements in the cache. */
+    const size_t capacity;
+
+    /** The statements, most recently used first. */
+    std::list<Entry> entries;
+
+    /** The position of each statement in entries, for fast look up. */
+    std::unordered_map<std::string, std::list<Entry>::iterator> lookup;
+
+    /** The mutex to guard entries and lookup. */
+    std::mutex mutex;
+};
+
+#endif /* STATEMENT_CACHE_H */
@@ -0,0 +1,131 @@
+/*
+ * Implementation of the vectorized substring search used for "like".
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <cstring>
+#include <string_view>
+#include "StrSearch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STR_SEARCH_X86 1
+#endif
+
+// Pick the implementation once, when the program starts.
+const StrSearch::FindFn StrSearch::findImpl = StrSearch::pickImpl();
+
+StrSearch::FindFn
+StrSearch::pickImpl() {
+#ifdef STR_SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return findAVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return findSSE2;
+    }
+#endif
+    return findGeneric;
+}
+
+const char*
+StrSearch::getKernelName() {
+    if (findImpl == findAVX2) {
+        return "avx2";
+    }
+    return (findImpl == findSSE2) ? "sse2" : "generic";
+}
+
+const char*
+StrSearch::findGeneric(const char* begin, const char* end,
+                       const char* needle, size_t n) {
+    const std::string_view buf(begin, end - begin);
+    const size_t pos = buf.find(std::string_view(needle, n));
+    return (pos == std::string_view::npos) ? nullptr : begin + pos;
+}
+
+#ifdef STR_SEARCH_X86
+
+const char*
+StrSearch::findSSE2(const char* begin, const char* end,
+                    const char* needle, size_t n) {
+    const size_t len = end - begin;
+    if (n > len) {
+        return nullptr;
+    }
+    // Vectors with the first and last character of needle in every byte
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last  = _mm_set1_epi8(needle[n - 1]);
+    size_t i = 0;
+    for (; (i + n - 1 + 16 <= len); i += 16) {
+        // Compare the first character at 16 positions and the last
+        // character at the same 16 positions (shifted by n - 1)
+        const __m128i blkFirst = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(begin + i));
+        const __m128i blkLast = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(begin + i + n - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(first, blkFirst), _mm_cmpeq_epi8(last, blkLast)));
+        // Each bit in mask is a position where both characters match.
+        // Check the rest of the characters only at those positions.
+        while (mask != 0) {
+            const int bit = __builtin_ctz(mask);
+            if (std::memcmp(begin + i + bit + 1, needle + 1, n - 1) == 0) {
+                return begin + i + bit;
+            }
+            mask &= mask - 1;  // Clear the lowest set bit
+        }
+    }
+    // The last few positions do not fill a whole vector.
+    return findGeneric(begin + i, end, needle, n);
+}
+
+__attribute__((target("avx2")))
+const char*
+StrSearch::findAVX2(const char* begin, const char* end,
+                    const char* needle, size_t n) {
+    const size_t len = end - begin;
+    if (n > len) {
+        return nullptr;
+    }
+    // Same as findSSE2, but 32 positions at a time
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last  = _mm256_set1_epi8(needle[n - 1]);
+    size_t i = 0;
+    for (; (i + n - 1 + 32 <= len); i += 32) {
+        const __m256i blkFirst = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(begin + i));
+        const __m256i blkLast = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(begin + i + n - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(first, blkFirst),
+            _mm256_cmpeq_epi8(last, blkLast)));
+        while (mask != 0) {
+            const int bit = __builtin_ctz(mask);
+            if (std::memcmp(begin + i + bit + 1, needle + 1, n - 1) == 0) {
+                return begin + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return findSSE2(begin + i, end, needle, n);
+}
+
+#else
+
+// Vector instructions are not available on this platform.
+const char*
+StrSearch::findSSE2(const char* begin, const char* end,
+                    const char* needle, size_t n) {
+    return findGeneric(begin, end, needle, n);
+}
+
+const char*
+StrSearch::findAVX2(const char* begin, const char* end,
+                    const char* needle, size_t n) {
+    return findGeneric(begin, end, needle, n);
+}
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef STR_SEARCH_H
+#define STR_SEARCH_H
+
+/*
+ * A vectorized substring search used to evaluate "like" clauses. The search
+ * uses SSE2 (16 bytes at a time) or AVX2 (32 bytes at a time) instructions
+ * to compare the first and last characters of the search string at many
+ * positions at once. Only the positions where both characters match are
+ * checked fully. The instruction set is picked at run time based on the
+ * CPU the program is running on.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <cstddef>
+#include <string>
+
+/**
+ * A collection of static methods to find a substring in a buffer.
+ */
+class StrSearch {
+public:
+    /**
+     * Find the first occurrence of a string in a given buffer.
+     *
+     * @param begin Pointer to the first character in the buffer.
+     *
+     * @param end Pointer just past the last character in the buffer.
+     *
+     * @param needle The string to look for. It must not be empty.
+     *
+     * @return Pointer to the first occurrence of needle in the buffer. If
+     * the needle is not found, then this method returns nullptr.
+     */
+    static const char* find(const char* begin, const char* end,
+                            const std::string& needle) {
+        return findImpl(begin, end, needle.data(), needle.size());
+    }
+
+    /**
+     * Obtain the name of the instruction set used by find(). This is
+     * handy for troubleshooting performance.
+     *
+     * @return One of "avx2", "sse2", or "generic".
+     */
+    static const char* getKernelName();
+
+private:
+    /** The signature shared by all the implementations of find. */
+    using FindFn = const char* (*)(const char*, const char*, const char*,
+                                   size_t);
+
+    /** The implementation picked (based on the CPU) when the program
+     * starts.
+     */
+    static const FindFn findImpl;
+
+    /** Implementation of find that does not use vector instructions. */
+    static const char* findGeneric(const char* begin, const char* end,
+                                   const char* needle, size_t n);
+
+    /** Implementation of find that checks 16 positions at a time. */
+    static const char* findSSE2(const char* begin, const char* end,
+                                const char* needle, size_t n);
+
+    /** Implementation of find that checks 32 positions at a time. */
+    static const char* findAVX2(const char* begin, const char* end,
+                                const char* needle, size_t n);
+
+    /** Pick the best implementation of find for this CPU. */
+    static FindFn pickImpl();
+};
+
+#endif /* STR_SEARCH_H */
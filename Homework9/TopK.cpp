@@ -0,0 +1,89 @@
+/*
+ * Implementation of the bounded heap used for order by and limit.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <algorithm>
+#include "TopK.h"
+
+TopK::TopK(const size_t k, const ColumnType type, const bool descending) :
+    k(k), numeric(type == ColumnType::Int || type == ColumnType::Double),
+    descending(descending) {
+}
+
+void
+TopK::setKey(std::string_view value, const RowId id, Entry& entry) const {
+    entry.id    = id;
+    entry.isNum = numeric && Range::toDouble(value, entry.num);
+    if (!numeric) {
+        entry.text.assign(value);
+    }
+}
+
+bool
+TopK::before(const Entry& lhs, const Entry& rhs) const {
+    if (numeric && lhs.isNum != rhs.isNum) {
+        return lhs.isNum;  // Numbers come before other values
+    } else if (numeric && lhs.isNum && lhs.num != rhs.num) {
+        return descending ? (lhs.num > rhs.num) : (lhs.num < rhs.num);
+    } else if (!numeric && lhs.text != rhs.text) {
+        return descending ? (lhs.text > rhs.text) : (lhs.text < rhs.text);
+    }
+    return lhs.id < rhs.id;
+}
+
+bool
+TopK::accepts(std::string_view value, const RowId id) const {
+    if (heap.size() < k) {
+        return true;
+    } else if (k == 0) {
+        return false;
+    }
+    setKey(value, id, probe);
+    return before(probe, heap.front());
+}
+
+void
+TopK::push(std::string_view value, const RowId id, std::string line) {
+    Entry entry;
+    setKey(value, id, entry);
+    entry.line = std::move(line);
+    insert(std::move(entry));
+}
+
+void
+TopK::insert(Entry entry) {
+    const auto cmp = [this](const Entry& lhs, const Entry& rhs) {
+        return before(lhs, rhs);
+    };
+    if (heap.size() < k) {
+        heap.push_back(std::move(entry));
+    } else if (k > 0 && before(entry, heap.front())) {
+        // Drop the last row to make room for this one
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        heap.back() = std::move(entry);
+    } else {
+        return;  // Not in the top k
+    }
+    std::push_heap(heap.begin(), heap.end(), cmp);
+}
+
+void
+TopK::merge(TopK& other) {
+    for (Entry& entry : other.heap) {
+        insert(std::move(entry));
+    }
+    other.heap.clear();
+}
+
+std::vector<TopK::Entry>
+TopK::take() {
+    std::sort_heap(heap.begin(), heap.end(),
+                   [this](const Entry& lhs, const Entry& rhs) {
+                       return before(lhs, rhs);
+                   });
+    std::vector<Entry> entries = std::move(heap);
+    heap.clear();
+    return entries;
+}
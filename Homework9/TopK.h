@@ -0,0 +1,173 @@
+#ifndef TOP_K_H
+#define TOP_K_H
+
+/*
+ * The order by and limit clauses of select statements, e.g.:
+ *
+ *     select name from airports.csv order by altitude desc limit 10;
+ *
+ * Rows are sorted with a bounded heap that keeps only the first k (limit +
+ * offset) rows seen so far. So finding the top k of n rows takes
+ * O(n log k) time and O(k) memory, and only rows that make it into the
+ * heap are formatted.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "ColumnStore.h"
+
+/** The order by and limit clauses of a select statement. */
+struct OrderBy {
+    /** The column by which the rows are sorted, or -1 to keep the rows in
+     * table order. For aggregates, the index of the item in the select list
+     * (see Aggregation::findItem).
+     */
+    int colIdx = -1;
+
+    /** Flag to indicate if the rows are sorted in descending order. */
+    bool descending = false;
+
+    /** The number of rows to be skipped. */
+    size_t offset = 0;
+
+    /** The maximum number of rows to be printed. */
+    size_t limit = std::numeric_limits<size_t>::max();
+
+    /**
+     * Obtain the number of rows needed to print the rows after the offset.
+     *
+     * @return The offset plus the limit (without overflowing).
+     */
+    size_t getNeeded() const {
+        return (limit > std::numeric_limits<size_t>::max() - offset) ?
+            std::numeric_limits<size_t>::max() : offset + limit;
+    }
+};
+
+/**
+ * The first k rows in the order of a given column. Values in a numeric
+ * column are compared as numbers, and values that are not numbers come
+ * after all the numbers (in either order). Rows with the same value stay
+ * in table order. This class is not MT-safe: each thread fills in its own
+ * TopK and they are then merged.
+ */
+class TopK {
+public:
+    /** A row that is in the top k: its sort key and the formatted row. */
+    struct Entry {
+        /** Flag to indicate if the value is a number (numeric columns). */
+        bool isNum;
+        /** The value as a number, if it is one. */
+        double num;
+        /** The value, for columns that are not numeric. */
+        std::string text;
+        /** The row, to keep rows with the same value in table order. */
+        RowId id;
+        /** The formatted row to be printed. */
+        std::string line;
+    };
+
+    /**
+     * Create an empty top k.
+     *
+     * @param k The maximum number of rows to be kept.
+     *
+     * @param type The type of the column by which rows are sorted (see
+     * ColumnStore::getColumnType).
+     *
+     * @param descending Flag to indicate if the largest values come first.
+     */
+    TopK(const size_t k, const ColumnType type, const bool descending);
+
+    /**
+     * Check if a row would be kept. This is used to avoid formatting rows
+     * that are not in the top k.
+     *
+     * @param value The value of the row in the column being sorted on.
+     *
+     * @param id The row.
+     *
+     * @return This method returns true if the row is among the first k rows
+     * seen so far.
+     */
+    bool accepts(std::string_view value, const RowId id) const;
+
+    /**
+     * Add a row, if it is in the top k. Call accepts first to avoid
+     * formatting rows that would not be kept.
+     *
+     * @param value The value of the row in the column being sorted on.
+     *
+     * @param id The row.
+     *
+     * @param line The formatted row.
+     */
+    void push(std::string_view value, const RowId id, std::string line);
+
+    /**
+     * Add the rows of another top k (with the same order) to this one.
+     *
+     * @param other The top k to be merged. Its rows are moved.
+     */
+    void merge(TopK& other);
+
+    /**
+     * Obtain the rows kept. This top k is left empty.
+     *
+     * @return The rows, in order.
+     */
+    std::vector<Entry> take();
+
+private:
+    /**
+     * Helper method to fill in the sort key of a row.
+     *
+     * @param value The value of the row in the column being sorted on.
+     *
+     * @param id The row.
+     *
+     * @param entry The entry whose key is to be set.
+     */
+    void setKey(std::string_view value, const RowId id, Entry& entry) const;
+
+    /**
+     * Helper method to add a row if it is in the top k, dropping the last
+     * row if there are more than k rows.
+     *
+     * @param entry The row to be added.
+     */
+    void insert(Entry entry);
+
+    /**
+     * Helper method to check if a row comes before another.
+     *
+     * @param lhs The row to be checked.
+     *
+     * @param rhs The other row.
+     *
+     * @return This method returns true if lhs comes before rhs.
+     */
+    bool before(const Entry& lhs, const Entry& rhs) const;
+
+    /** The maximum number of rows to be kept. */
+    size_t k;
+
+    /** Flag to indicate if values are compared as numbers. */
+    bool numeric;
+
+    /** Flag to indicate if the largest values come first. */
+    bool descending;
+
+    /** The rows kept, as a heap with the last of them at the top. */
+    std::vector<Entry> heap;
+
+    /** Scratch space used to check rows in accepts. */
+    mutable Entry probe;
+};
+
+#endif /* TOP_K_H */
@@ -0,0 +1,169 @@
+/*
+ * Implementation of the trigram index on a column of a CSV.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <mutex>
+#include "TrigramIndex.h"
+
+std::vector<TrigramIndex::Trigram>
+TrigramIndex::toTrigrams(std::string_view value) {
+    std::vector<Trigram> trigrams;
+    for (size_t i = 0; (i + 3 <= value.size()); i++) {
+        trigrams.push_back((Trigram(uint8_t(value[i])) << 16) |
+                           (Trigram(uint8_t(value[i + 1])) << 8) |
+                           Trigram(uint8_t(value[i + 2])));
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                   trigrams.end());
+    return trigrams;
+}
+
+void
+TrigramIndex::append(Postings& postings, RowId id) {
+    // The first row is stored as is, the others as the difference from
+    // the previous row. 7 bits per byte; the top bit marks more bytes.
+    RowId delta = postings.hasRows ? (id - postings.last) : id;
+    for (; (delta >= 0x80); delta >>= 7) {
+        postings.bytes += char(0x80 | (delta & 0x7f));
+    }
+    postings.bytes += char(delta);
+    postings.last    = id;
+    postings.hasRows = true;
+}
+
+std::vector<RowId>
+TrigramIndex::decode(const Postings& postings) {
+    std::vector<RowId> ids;
+    RowId id = 0;
+    for (size_t i = 0; (i < postings.bytes.size());) {
+        RowId delta = 0;
+        for (int shift = 0; ; shift += 7) {
+            const uint8_t byte = postings.bytes[i++];
+            delta |= RowId(byte & 0x7f) << shift;
+            if (byte < 0x80) {
+                break;
+            }
+        }
+        id = ids.empty() ? delta : (id + delta);
+        ids.push_back(id);
+    }
+    if (!postings.added.empty()) {
+        const size_t mid = ids.size();
+        ids.insert(ids.end(), postings.added.begin(), postings.added.end());
+        std::sort(ids.begin() + mid, ids.end());
+        std::inplace_merge(ids.begin(), ids.begin() + mid, ids.end());
+    }
+    if (!postings.removed.empty()) {
+        std::vector<RowId> removed = postings.removed;
+        std::sort(removed.begin(), removed.end());
+        std::vector<RowId> kept;
+        std::set_difference(ids.begin(), ids.end(), removed.begin(),
+                            removed.end(), std::back_inserter(kept));
+        ids.swap(kept);
+    }
+    return ids;
+}
+
+void
+TrigramIndex::compact(Postings& postings) {
+    // Recompressing is linear in the number of rows. So it is done only
+    // once the changes are a fair fraction of the rows.
+    const size_t changes = postings.added.size() + postings.removed.size();
+    if (changes < 32 || changes < postings.bytes.size() / 16) {
+        return;
+    }
+    const std::vector<RowId> ids = decode(postings);
+    postings = Postings();
+    for (const RowId id : ids) {
+        append(postings, id);
+    }
+}
+
+void
+TrigramIndex::add(const Segment& seg, const size_t segIdx) {
+    const Column& col = seg.cols.at(colIdx);
+    for (size_t row = 0; (row < seg.getRowCount()); row++) {
+        if (!seg.isDeleted(row)) {
+            insert(col.at(row), ColumnStore::toRowId(segIdx, row));
+        }
+    }
+}
+
+std::vector<RowId>
+TrigramIndex::find(const std::string& value) const {
+    const std::vector<Trigram> trigrams = toTrigrams(value);
+    std::shared_lock<std::shared_mutex> lock(indexMutex);
+    // Start with the shortest list, so the candidates only get fewer
+    std::vector<const Postings*> lists;
+    for (const Trigram trigram : trigrams) {
+        const auto entry = entries.find(trigram);
+        if (entry == entries.end()) {
+            return {};  // No row contains this trigram
+        }
+        lists.push_back(&entry->second);
+    }
+    std::sort(lists.begin(), lists.end(), [](auto lhs, auto rhs) {
+        return lhs->bytes.size() < rhs->bytes.size();
+    });
+    std::vector<RowId> ids;
+    for (const Postings* postings : lists) {
+        if (postings == lists.front()) {
+            ids = decode(*postings);
+            continue;
+        }
+        const std::vector<RowId> other = decode(*postings);
+        std::vector<RowId> common;
+        std::set_intersection(ids.begin(), ids.end(), other.begin(),
+                              other.end(), std::back_inserter(common));
+        ids.swap(common);
+        if (ids.empty()) {
+            break;
+        }
+    }
+    return ids;
+}
+
+void
+TrigramIndex::insert(std::string_view value, const RowId id) {
+    const std::vector<Trigram> trigrams = toTrigrams(value);
+    std::unique_lock<std::shared_mutex> lock(indexMutex);
+    for (const Trigram trigram : trigrams) {
+        Postings& postings = entries[trigram];
+        const auto removed = std::find(postings.removed.begin(),
+                                       postings.removed.end(), id);
+        if (removed != postings.removed.end()) {
+            postings.removed.erase(removed);  // The row is still in bytes
+        } else if (!postings.hasRows || id > postings.last) {
+            append(postings, id);  // Rows are added in order when built
+        } else {
+            postings.added.push_back(id);
+            compact(postings);
+        }
+    }
+}
+
+void
+TrigramIndex::erase(std::string_view value, const RowId id) {
+    const std::vector<Trigram> trigrams = toTrigrams(value);
+    std::unique_lock<std::shared_mutex> lock(indexMutex);
+    for (const Trigram trigram : trigrams) {
+        const auto entry = entries.find(trigram);
+        if (entry == entries.end()) {
+            continue;  // Value is not in the index.
+        }
+        Postings& postings = entry->second;
+        const auto added = std::find(postings.added.begin(),
+                                     postings.added.end(), id);
+        if (added != postings.added.end()) {
+            postings.added.erase(added);
+        } else {
+            postings.removed.push_back(id);
+            compact(postings);
+        }
+    }
+}
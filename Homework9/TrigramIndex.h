@@ -0,0 +1,168 @@
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+/*
+ * A trigram index on a column of a CSV. The index maps each 3-character
+ * substring (trigram) of the values in the column to the list of rows
+ * whose value contains it. A "like" condition matches rows whose value
+ * contains a given substring. Such rows must contain every trigram of the
+ * substring. So intersecting the lists of the substring's trigrams gives
+ * a (usually small) set of candidate rows, which are then checked, instead
+ * of scanning every row.
+ *
+ * The lists are compressed: the rows are stored in ascending order, as the
+ * differences between consecutive rows, using 7 bits per byte (so most
+ * entries take 1 byte instead of 4).
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include "ColumnStore.h"
+
+/**
+ * A trigram index on one column of a ColumnStore. The index is MT-safe.
+ * The rows returned by the index must be re-checked against the column
+ * store (while holding the segment's lock) as the rows may change after the
+ * index has been looked up.
+ */
+class TrigramIndex {
+public:
+    /**
+     * Create an index on a given column.
+     *
+     * @param colIdx The index of the column on which this index is built.
+     */
+    explicit TrigramIndex(const int colIdx) : colIdx(colIdx) {}
+
+    /**
+     * Add all the rows in a given segment to this index. The caller must
+     * ensure the segment does not change, e.g., by locking the CSV.
+     *
+     * @param seg The segment whose rows are to be added.
+     *
+     * @param segIdx The index of the segment in the column store.
+     */
+    void add(const Segment& seg, const size_t segIdx);
+
+    /**
+     * Check if this index can be used to find the rows that contain a
+     * given substring.
+     *
+     * @param value The substring in a "like" condition.
+     *
+     * @return This method returns true if the substring has at least one
+     * trigram, i.e., it is at least 3 characters long.
+     */
+    static bool canFind(const std::string& value) {
+        return value.size() >= 3;
+    }
+
+    /**
+     * Obtain the rows whose value may contain a given substring, in
+     * ascending order. The rows include all the rows that contain it.
+     *
+     * @param value The substring to look for. See canFind.
+     *
+     * @return The rows that had all the trigrams of the substring when this
+     * method was called.
+     */
+    std::vector<RowId> find(const std::string& value) const;
+
+    /**
+     * Record that a row has been added with a given value.
+     *
+     * @param value The value of the indexed column in the row.
+     *
+     * @param id The row that has the value.
+     */
+    void insert(std::string_view value, const RowId id);
+
+    /**
+     * Record that a row no longer has a given value (because it was
+     * updated or deleted).
+     *
+     * @param value The old value of the indexed column in the row.
+     *
+     * @param id The row that no longer has the value.
+     */
+    void erase(std::string_view value, const RowId id);
+
+    /**
+     * Obtain the column on which this index was built.
+     *
+     * @return The index of the column on which this index was built.
+     */
+    int getColumnIndex() const { return colIdx; }
+
+private:
+    /** A trigram, with its 3 characters packed into the low 24 bits. */
+    using Trigram = uint32_t;
+
+    /** The rows that contain a trigram. */
+    struct Postings {
+        /** The compressed rows, in ascending order. */
+        std::string bytes;
+        /** The last row in bytes (rows can be appended only after it). */
+        RowId last = 0;
+        /** Flag to indicate if bytes has any rows. */
+        bool hasRows = false;
+        /** Rows added (by updates) that could not be appended to bytes. */
+        std::vector<RowId> added;
+        /** Rows in bytes that have been removed (by updates or deletes). */
+        std::vector<RowId> removed;
+    };
+
+    /**
+     * Helper method to obtain the distinct trigrams in a value.
+     *
+     * @param value The value whose trigrams are needed.
+     *
+     * @return The trigrams, in ascending order, without duplicates.
+     */
+    static std::vector<Trigram> toTrigrams(std::string_view value);
+
+    /**
+     * Helper method to add a row to the end of the compressed rows.
+     *
+     * @param postings The rows of a trigram. The row must be larger than
+     * the last row in them.
+     *
+     * @param id The row to be added.
+     */
+    static void append(Postings& postings, const RowId id);
+
+    /**
+     * Helper method to obtain the rows of a trigram, including the changes
+     * that have not been compressed yet.
+     *
+     * @param postings The rows of a trigram.
+     *
+     * @return The rows, in ascending order.
+     */
+    static std::vector<RowId> decode(const Postings& postings);
+
+    /**
+     * Helper method to compress the rows of a trigram once enough changes
+     * have accumulated.
+     *
+     * @param postings The rows of a trigram.
+     */
+    static void compact(Postings& postings);
+
+    /** The column on which this index is built. */
+    const int colIdx;
+
+    /** The rows that contain each trigram. */
+    std::unordered_map<Trigram, Postings> entries;
+
+    /** Reader-writer lock to enable MT-safe lookups and changes. */
+    mutable std::shared_mutex indexMutex;
+};
+
+#endif /* TRIGRAM_INDEX_H */
@@ -0,0 +1,142 @@
+/*
+ * Implementation of the registry of waiting queries.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
+#include "WaitRegistry.h"
+
+std::unique_ptr<WaitRegistry::Subscription>
+WaitRegistry::subscribe(const int colIdx, const std::string& cond,
+                        const std::string& value, const ColumnType type) {
+    auto range = Range::isRange(cond) ?
+        std::make_unique<Range>(cond, value, type) : nullptr;
+    std::lock_guard<std::mutex> lock(mutex);
+    // Queries with the same where clause share its entry
+    const auto clause = clauses.try_emplace({colIdx, cond, value}).first;
+    if (clause->second.waiters.empty()) {
+        clause->second.colIdx = colIdx;
+        clause->second.cond   = cond;
+        clause->second.value  = value;
+        clause->second.range  = std::move(range);
+    }
+    clause->second.waiters.emplace_back();
+    clause->second.pending++;
+    // The constructor is private, so std::make_unique cannot be used.
+    return std::unique_ptr<Subscription>(new Subscription(*this, clause,
+        std::prev(clause->second.waiters.end())));
+}
+
+void
+WaitRegistry::Subscription::wait() {
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    waiter->cv.wait(lock, [this] { return waiter->woken; });
+    waiter->woken = false;  // Get ready for the next wait
+    clause->second.pending++;
+}
+
+bool
+WaitRegistry::Subscription::park(std::function<void()> onWake) {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    if (waiter->woken) {
+        waiter->woken = false;  // As if wait() returned right away
+        clause->second.pending++;
+        return false;
+    }
+    waiter->onWake = std::move(onWake);
+    return true;
+}
+
+WaitRegistry::Subscription::~Subscription() {
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    Clause& entry = clause->second;
+    if (!waiter->woken) {
+        entry.pending--;
+    }
+    entry.waiters.erase(waiter);
+    if (entry.waiters.empty()) {
+        registry.clauses.erase(clause);
+    }
+}
+
+void
+WaitRegistry::notify(const Segment& seg, const RowList& rows) {
+    if (rows.empty()) {
+        return;  // Nothing changed
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    // The distinct values in the rows, by column. A column's values are
+    // found when the first where clause on it is checked.
+    std::unordered_map<int, std::unordered_set<std::string_view>> values;
+    for (auto& entry : clauses) {
+        Clause& clause = entry.second;
+        if (clause.pending == 0) {
+            continue;  // Already woken up by an earlier change
+        }
+        // A query without a where clause is satisfied by any row.
+        bool found = (clause.colIdx == -1);
+        if (!found) {
+            auto& colVals = values[clause.colIdx];
+            if (colVals.empty()) {
+                for (const auto row : rows) {
+                    colVals.insert(seg.cols[clause.colIdx].at(row));
+                }
+            }
+            if (clause.range == nullptr && clause.cond == "=") {
+                found = (colVals.find(clause.value) != colVals.end());
+            } else {
+                found = std::any_of(colVals.begin(), colVals.end(),
+                    [&clause](const std::string_view colVal) {
+                        return (clause.range != nullptr) ?
+                            clause.range->contains(colVal) :
+                            matches(colVal, clause.cond, clause.value);
+                    });
+            }
+        }
+        if (found) {
+            wake(clause);
+        }
+    }
+}
+
+void
+WaitRegistry::notifyAll() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& entry : clauses) {
+        wake(entry.second);
+    }
+}
+
+void
+WaitRegistry::wake(Clause& clause) {
+    for (auto& waiter : clause.waiters) {
+        if (waiter.woken) {
+            continue;
+        }
+        waiter.woken = true;
+        if (waiter.onWake) {
+            // A parked query has its function called (only once)
+            const auto onWake = std::move(waiter.onWake);
+            waiter.onWake = nullptr;
+            onWake();
+        } else {
+            waiter.cv.notify_one();
+        }
+    }
+    clause.pending = 0;
+}
+
+bool
+WaitRegistry::matches(std::string_view colVal, const std::string& cond,
+                      const std::string& value) {
+    if (cond == "=") {
+        return colVal == value;
+    } else if (cond == "<>") {
+        return colVal != value;
+    }
+    return colVal.find(value) != std::string_view::npos;  // like
+}
@@ -0,0 +1,197 @@
+#ifndef WAIT_REGISTRY_H
+#define WAIT_REGISTRY_H
+
+/*
+ * A registry of queries (with a "wait" clause) that are waiting for rows
+ * matching their where clause. Instead of waking up every waiting query
+ * after each change (and having all of them rescan the table), a change
+ * wakes up only the queries whose where clause is satisfied by the rows
+ * that changed.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <string>
+#include <string_view>
+#include <list>
+#include <map>
+#include <tuple>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "ColumnStore.h"
+
+/**
+ * The list of waiting queries on a CSV. This class is MT-safe.
+ */
+class WaitRegistry {
+private:
+    /** A waiting query and the flag used to wake it. */
+    struct Waiter {
+        /** Flag set when a change satisfied the where clause. */
+        bool woken = false;
+        /** The condition variable on which the query sleeps. */
+        std::condition_variable cv;
+        /** The function to be called instead, if the query is parked. */
+        std::function<void()> onWake;
+    };
+
+    /**
+     * A where clause and the queries waiting for it. Queries with the same
+     * where clause are checked (and woken up) together.
+     */
+    struct Clause {
+        /** The column in the where clause, or -1 if there is none. */
+        int colIdx;
+        /** The condition in the where clause: "=", "<>", "like", or a
+         * range condition.
+         */
+        std::string cond;
+        /** The value in the where clause. */
+        std::string value;
+        /** The range of values, if cond is a range condition. */
+        std::unique_ptr<Range> range;
+        /** The queries waiting for this where clause. A list is used so
+         * that the iterators held by subscriptions remain valid as queries
+         * come and go.
+         */
+        std::list<Waiter> waiters;
+        /** The number of waiters that have not been woken up. */
+        size_t pending = 0;
+    };
+
+    /** The where clauses, by column, condition, and value. */
+    using ClauseMap = std::map<std::tuple<int, std::string, std::string>,
+                               Clause>;
+
+public:
+    /**
+     * The registration of a waiting query. The query is removed from the
+     * registry when this object is destroyed.
+     */
+    class Subscription {
+    public:
+        /**
+         * Sleep until a change satisfies the where clause of the query.
+         * This method returns immediately if such a change was made since
+         * the previous call (or since the subscription was created).
+         */
+        void wait();
+
+        /**
+         * Have a given function called (once) when a change satisfies the
+         * where clause of the query, instead of sleeping until then. The
+         * function is called while the registry is locked, so it must
+         * only hand the query over (e.g., post it to a thread pool).
+         *
+         * @param onWake The function to be called.
+         *
+         * @return This method returns false (without keeping the function)
+         * if such a change was made since the previous call to wait() or
+         * park(), in which case the query should look for rows again.
+         */
+        bool park(std::function<void()> onWake);
+
+        /** The destructor removes the query from the registry. */
+        ~Subscription();
+
+    private:
+        friend class WaitRegistry;
+
+        /**
+         * Create a subscription. Use WaitRegistry::subscribe() instead.
+         *
+         * @param registry The registry to which the waiter was added.
+         *
+         * @param clause The where clause of the query in the registry.
+         *
+         * @param waiter The entry for this query in the clause.
+         */
+        Subscription(WaitRegistry& registry, ClauseMap::iterator clause,
+                     std::list<Waiter>::iterator waiter)
+            : registry(registry), clause(clause), waiter(waiter) {}
+
+        /** The registry to which the waiter was added. */
+        WaitRegistry& registry;
+
+        /** The where clause of the query in the registry. */
+        ClauseMap::iterator clause;
+
+        /** The entry for this query in the clause. */
+        std::list<Waiter>::iterator waiter;
+    };
+
+    /**
+     * Add a waiting query to the registry. A query must subscribe *before*
+     * it looks for matching rows. Otherwise a change made after the query
+     * looked (but before it sleeps) would not wake it up.
+     *
+     * @param colIdx The column in the query's where clause, or -1 if the
+     * query does not have a where clause.
+     *
+     * @param cond The condition in the where clause.
+     *
+     * @param value The value in the where clause.
+     *
+     * @param type The type of the column, used to compare values for
+     * range conditions (see Range).
+     *
+     * @return The subscription for the query.
+     */
+    std::unique_ptr<Subscription> subscribe(const int colIdx,
+        const std::string& cond, const std::string& value,
+        const ColumnType type = ColumnType::String);
+
+    /**
+     * Wake up the waiting queries whose where clause is satisfied by any of
+     * the given rows. This method must be called after the rows have been
+     * changed, while still holding the segment's lock. The distinct values
+     * in the rows are found once for each column that a where clause
+     * refers to, and each where clause is checked against those values.
+     *
+     * @param seg The segment in which the rows were changed.
+     *
+     * @param rows The rows that were changed (or added).
+     */
+    void notify(const Segment& seg, const RowList& rows);
+
+    /**
+     * Wake up all the waiting queries, whatever their where clause. This
+     * is used when the CSV has been replaced (see SQLAir::refreshCSV), so
+     * that the queries look for rows in the new CSV instead.
+     */
+    void notifyAll();
+
+private:
+    /**
+     * Check if a value satisfies a condition. This method has the same
+     * semantics as SQLAirBase::matches().
+     *
+     * @param colVal The value in a row.
+     *
+     * @param cond The condition: "=", "<>", or "like".
+     *
+     * @param value The value to compare with.
+     *
+     * @return This method returns true if the condition is satisfied.
+     */
+    static bool matches(std::string_view colVal, const std::string& cond,
+                        const std::string& value);
+
+    /**
+     * Wake up the queries waiting for a where clause that have not been
+     * woken up yet. The caller must hold the mutex.
+     *
+     * @param clause The where clause whose queries are to be woken up.
+     */
+    static void wake(Clause& clause);
+
+    /** The where clauses of the waiting queries. */
+    ClauseMap clauses;
+
+    /** The mutex to guard the clauses and the state in each waiter. */
+    std::mutex mutex;
+};
+
+#endif /* WAIT_REGISTRY_H */
@@ -0,0 +1,381 @@
+/*
+ * Implementation of the write-ahead log for changes to tables.
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <boost/crc.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include "WriteAheadLog.h"
+
+/**
+ * Each record in the log is a fixed-size header followed by the value (for
+ * updates). The CRC-32 covers the rest of the record, so that a record
+ * that was only partially written (during a crash) is detected.
+ */
+struct RecordHeader {
+    uint32_t size;      // The number of bytes after the crc
+    uint32_t crc;
+    uint8_t  type;
+    uint8_t  reserved[3];
+    uint32_t pos;       // The position of the row in the file
+    uint32_t colIdx;
+};
+
+/**
+ * Helper method to check if a file exists.
+ *
+ * @param path The path to the file.
+ *
+ * @return This method returns true if the file exists.
+ */
+static bool
+exists(const std::string& path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+/**
+ * Helper method to make the creation, renaming, and removal of files in
+ * the directory containing a given file durable.
+ *
+ * @param path The path to a file in the directory.
+ */
+static void
+syncDir(const std::string& path) {
+    const size_t slash = path.rfind('/');
+    const std::string dir = (slash == std::string::npos) ? "." :
+        path.substr(0, slash + 1);
+    const int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+/**
+ * Helper method to write a buffer to a file and wait until it is on disk.
+ *
+ * @param fd The file descriptor of the file.
+ *
+ * @param buf The bytes to be written.
+ *
+ * @return This method returns false if the bytes could not be written.
+ */
+static bool
+writeAndSync(const int fd, const std::string& buf) {
+    for (size_t done = 0; (done < buf.size()); ) {
+        const ssize_t n = write(fd, buf.data() + done, buf.size() - done);
+        if (n < 0) {
+            return false;
+        }
+        done += n;
+    }
+    return fdatasync(fd) == 0;
+}
+
+/**
+ * Helper method to open a log for appending.
+ *
+ * @param path The path to the log.
+ *
+ * @param truncate If this flag is true, any existing log is emptied.
+ *
+ * @return The file descriptor of the log.
+ */
+static int
+openLog(const std::string& path, const bool truncate) {
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND |
+                        (truncate ? O_TRUNC : 0), 0644);
+    if (fd == -1) {
+        throw std::runtime_error("Unable to open " + path);
+    }
+    return fd;
+}
+
+//-------------------------------------------------------------------------
+
+WriteAheadLog::RowMap::RowMap(ColumnStore& store) {
+    uint32_t numRows = 0;
+    for (size_t s = 0; (s < store.getSegmentCount()); s++) {
+        const Segment& seg = store.getSegment(s);
+        rowsBefore.push_back(numRows);
+        deletedBefore.emplace_back();
+        if (seg.getLiveRowCount() != seg.getRowCount()) {
+            auto& before = deletedBefore.back();
+            before.resize(seg.getRowCount() + 1);
+            for (size_t row = 0; (row < seg.getRowCount()); row++) {
+                before[row + 1] = before[row] + seg.isDeleted(row);
+            }
+        }
+        numRows += seg.getLiveRowCount();
+    }
+}
+
+bool
+WriteAheadLog::RowMap::contains(const size_t segIdx, const size_t row) const {
+    if (rowsBefore.empty()) {
+        return true;
+    }
+    if (segIdx >= deletedBefore.size()) {
+        return false;  // The segment was added after the file was written
+    }
+    const auto& before = deletedBefore[segIdx];
+    return before.empty() || before[row] == before[row + 1];
+}
+
+uint32_t
+WriteAheadLog::RowMap::translate(const size_t segIdx, const size_t row) const {
+    if (rowsBefore.empty()) {
+        return ColumnStore::toRowId(segIdx, row);
+    }
+    const auto& before = deletedBefore[segIdx];
+    return rowsBefore[segIdx] + row - (before.empty() ? 0 : before[row]);
+}
+
+bool
+WriteAheadLog::RowMap::locate(const uint32_t pos, size_t& segIdx,
+                               size_t& row) const {
+    if (rowsBefore.empty()) {
+        segIdx = pos / ColumnStore::SegmentRows;
+        row    = pos % ColumnStore::SegmentRows;
+        return true;
+    }
+    // Find the last segment that starts at or before the position. Empty
+    // segments start at the same position as the segment after them.
+    const auto next = std::upper_bound(rowsBefore.begin(), rowsBefore.end(),
+                                       pos);
+    if (next == rowsBefore.begin()) {
+        return false;
+    }
+    segIdx = next - rowsBefore.begin() - 1;
+    row    = pos - rowsBefore[segIdx];
+    return true;
+}
+
+//-------------------------------------------------------------------------
+
+void
+WriteAheadLog::recover(const std::string& path) {
+    const std::string log = path + ".wal", next = log + ".next";
+    if (!exists(next)) {
+        return;  // No checkpoint was in progress
+    }
+    // The temporary file is created before the next log and is renamed
+    // over the file before the next log is renamed. So if it still exists,
+    // the file was not replaced and the log has all the changes.
+    const std::string tmp = path + ".tmp";
+    if (exists(tmp)) {
+        std::remove(next.c_str());
+        std::remove(tmp.c_str());
+    } else if (std::rename(next.c_str(), log.c_str()) != 0) {
+        throw std::runtime_error("Unable to recover " + log);
+    }
+    syncDir(path);
+}
+
+WriteAheadLog::WriteAheadLog(const std::string& filePath) :
+    filePath(filePath), logPath(filePath + ".wal") {
+    fd = openLog(logPath, false);
+    syncDir(logPath);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    close(fd);
+    if (nextFd != -1) {
+        close(nextFd);
+    }
+}
+
+size_t
+WriteAheadLog::replay(ColumnStore& store) {
+    // The file has not been rewritten since the changes were logged. So
+    // the rows as loaded are the rows in the file.
+    const RowMap loaded(store);
+    std::ifstream is(logPath, std::ios::binary);
+    const std::string log((std::istreambuf_iterator<char>(is)),
+                          std::istreambuf_iterator<char>());
+    size_t pos = 0, numChanges = 0;
+    RecordHeader hdr;
+    const size_t crcOffset = offsetof(RecordHeader, type);
+    while (log.size() - pos >= sizeof(hdr)) {
+        std::memcpy(&hdr, log.data() + pos, sizeof(hdr));
+        if (hdr.size < sizeof(hdr) - crcOffset ||
+            hdr.size > log.size() - pos - crcOffset) {
+            break;  // Partially written record
+        }
+        boost::crc_32_type crc;
+        crc.process_bytes(log.data() + pos + crcOffset, hdr.size);
+        if (crc.checksum() != hdr.crc) {
+            break;
+        }
+        const std::string_view value(log.data() + pos + sizeof(hdr),
+                                     hdr.size - (sizeof(hdr) - crcOffset));
+        pos += crcOffset + hdr.size;
+        size_t segIdx, row;
+        if (!loaded.locate(hdr.pos, segIdx, row) ||
+            segIdx >= store.getSegmentCount() ||
+            row >= store.getSegment(segIdx).getRowCount()) {
+            continue;
+        }
+        Segment& seg = store.getSegment(segIdx);
+        if (hdr.type == Update && hdr.colIdx < seg.cols.size()) {
+            seg.set(row, hdr.colIdx, value);
+            numChanges++;
+        } else if (hdr.type == Delete && !seg.isDeleted(row)) {
+            seg.erase(row);
+            numChanges++;
+        }
+    }
+    // Drop a partially written record at the end, so that new changes are
+    // not appended after it.
+    if (pos != log.size() && truncate(logPath.c_str(), pos) != 0) {
+        throw std::runtime_error("Unable to truncate " + logPath);
+    }
+    logSize = pos;
+    std::lock_guard<std::mutex> guard(mutex);
+    map = loaded;
+    return numChanges;
+}
+
+void
+WriteAheadLog::append(const RecordType type, const size_t segIdx,
+                      const size_t row, const int colIdx,
+                      std::string_view value) {
+    // Helper lambda to add a record to the pending changes for a log
+    auto add = [&](const RowMap& rows, std::string& buf) {
+        if (!rows.contains(segIdx, row)) {
+            return;
+        }
+        RecordHeader hdr = {};
+        const size_t crcOffset = offsetof(RecordHeader, type);
+        hdr.size   = sizeof(hdr) - crcOffset + value.size();
+        hdr.type   = type;
+        hdr.pos    = rows.translate(segIdx, row);
+        hdr.colIdx = colIdx;
+        boost::crc_32_type crc;
+        crc.process_bytes(reinterpret_cast<const char*>(&hdr) + crcOffset,
+                          sizeof(hdr) - crcOffset);
+        crc.process_bytes(value.data(), value.size());
+        hdr.crc = crc.checksum();
+        buf.append(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+        buf.append(value.data(), value.size());
+    };
+    std::lock_guard<std::mutex> guard(mutex);
+    add(map, pending);
+    if (nextFd != -1) {
+        add(nextMap, nextPending);
+    }
+    lastSeqNum++;
+}
+
+void
+WriteAheadLog::logUpdate(const size_t segIdx, const size_t row,
+                         const int colIdx, std::string_view value) {
+    append(Update, segIdx, row, colIdx, value);
+}
+
+void
+WriteAheadLog::logDelete(const size_t segIdx, const size_t row) {
+    append(Delete, segIdx, row, 0, "");
+}
+
+void
+WriteAheadLog::commit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    const uint64_t seqNum = lastSeqNum;
+    while (durableSeqNum < seqNum) {
+        if (flushing) {
+            // Another thread is writing. Our changes may be in its batch.
+            flushed.wait(lock);
+        } else {
+            flush(lock);
+        }
+    }
+}
+
+void
+WriteAheadLog::flush(std::unique_lock<std::mutex>& lock) {
+    // Take all the pending changes, so that others can add more while
+    // these are written.
+    flushing = true;
+    std::string buf, nextBuf;
+    buf.swap(pending);
+    nextBuf.swap(nextPending);
+    const int logFd = fd, nextLogFd = nextFd;
+    const uint64_t seqNum = lastSeqNum;
+    lock.unlock();
+    bool ok = writeAndSync(logFd, buf);
+    if (ok && nextLogFd != -1) {
+        ok = writeAndSync(nextLogFd, nextBuf);
+    }
+    lock.lock();
+    flushing = false;
+    flushed.notify_all();
+    if (!ok) {
+        throw std::runtime_error("Error writing " + logPath);
+    }
+    logSize       += buf.size();
+    nextLogSize   += nextBuf.size();
+    durableSeqNum  = seqNum;
+}
+
+bool
+WriteAheadLog::needsCheckpoint() {
+    std::lock_guard<std::mutex> guard(mutex);
+    return logSize >= CheckpointSize && nextFd == -1;
+}
+
+void
+WriteAheadLog::beginCheckpoint(const RowMap& map) {
+    // The temporary file must be durable before the next log is created.
+    // See recover().
+    syncDir(filePath);
+    std::lock_guard<std::mutex> guard(mutex);
+    nextFd = openLog(logPath + ".next", true);
+    syncDir(filePath);
+    nextMap = map;
+    nextPending.clear();
+    nextLogSize = 0;
+}
+
+void
+WriteAheadLog::endCheckpoint() {
+    // The rename of the file must be durable before the next log replaces
+    // the log. See recover().
+    syncDir(filePath);
+    std::unique_lock<std::mutex> lock(mutex);
+    flushed.wait(lock, [this] { return !flushing; });
+    // The changes in the log are all in the file now. Changes that are
+    // not yet written out are still pending for the next log.
+    if (std::rename((logPath + ".next").c_str(), logPath.c_str()) != 0) {
+        throw std::runtime_error("Unable to replace " + logPath);
+    }
+    syncDir(filePath);
+    close(fd);
+    fd = nextFd;
+    nextFd = -1;
+    map = nextMap;
+    pending.swap(nextPending);
+    nextPending.clear();
+    logSize = nextLogSize;
+}
+
+void
+WriteAheadLog::abortCheckpoint() {
+    std::unique_lock<std::mutex> lock(mutex);
+    flushed.wait(lock, [this] { return !flushing; });
+    if (nextFd != -1) {
+        close(nextFd);
+        nextFd = -1;
+        std::remove((logPath + ".next").c_str());
+        nextPending.clear();
+    }
+}
@@ -0,0 +1,302 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+/*
+ * A write-ahead log (WAL) that makes changes to a table durable without
+ * rewriting the whole file. Each change (the new value of a cell, or the
+ * deletion of a row) is appended to the log "<file>.wal". Statements that
+ * change rows wait until their changes are on disk. The changes of
+ * concurrent statements are written together with a single fdatasync
+ * (group commit). When a table is loaded, the changes in its log are
+ * replayed. The log is periodically folded into the file (a checkpoint).
+ *
+ * Rows are identified in the log by their position in the file (so that
+ * the log can be replayed after the file is loaded). A checkpoint drops
+ * deleted rows from the file. So, after a checkpoint, the position of a
+ * row in the file differs from its RowId in memory. The RowMap class
+ * translates between the two.
+ *
+ * A checkpoint writes "<file>.tmp", renames it over the file, and then
+ * renames "<file>.wal.next" (the log for the new file) over the log. The
+ * changes made during the checkpoint are logged to both logs. So a table
+ * can be recovered no matter when a crash occurs (see recover()).
+ *
+ * Copyright (C) 2021 John Doll
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "ColumnStore.h"
+
+/**
+ * The log of changes to a table loaded from a local file. This class is
+ * MT-safe.
+ */
+class WriteAheadLog {
+public:
+    /** The size of the log after which a checkpoint is due. */
+    static constexpr size_t CheckpointSize = 64 * 1024 * 1024;
+
+    /**
+     * Translates the RowIds of rows in memory to the position of the rows
+     * in the file, given the rows that were deleted when the file was
+     * written (by a checkpoint).
+     */
+    class RowMap {
+    public:
+        /** Create a map for a file whose segments are all full and that
+         * has no deleted rows. Each row is at the position given by its
+         * RowId.
+         */
+        RowMap() {}
+
+        /**
+         * Create a map for a file that contains all the rows in a store
+         * that are not deleted at present. The caller must ensure that
+         * no rows are deleted while this constructor runs.
+         *
+         * @param store The rows to be written to the file.
+         */
+        explicit RowMap(ColumnStore& store);
+
+        /**
+         * Check if a row is in the file.
+         *
+         * @param segIdx The index of the row's segment in memory.
+         *
+         * @param row The row within the segment.
+         *
+         * @return This method returns false if the row was deleted when
+         * the file was written.
+         */
+        bool contains(const size_t segIdx, const size_t row) const;
+
+        /**
+         * Obtain the position of a row in the file.
+         *
+         * @param segIdx The index of the row's segment in memory.
+         *
+         * @param row The row within the segment. The row must be in the
+         * file (see contains).
+         *
+         * @return The position of the row in the file.
+         */
+        uint32_t translate(const size_t segIdx, const size_t row) const;
+
+        /**
+         * Find the row in memory at a given position in the file. This is
+         * the reverse of translate, for a map of a store that had no
+         * deleted rows when the map was created.
+         *
+         * @param pos The position of the row in the file.
+         *
+         * @param segIdx Set to the index of the row's segment in memory.
+         *
+         * @param row Set to the row within the segment.
+         *
+         * @return This method returns false if there is no such row.
+         */
+        bool locate(const uint32_t pos, size_t& segIdx, size_t& row) const;
+
+    private:
+        /** The number of rows in the file before each segment. This
+         * vector is empty if the file has not been rewritten.
+         */
+        std::vector<uint32_t> rowsBefore;
+
+        /** For each segment with deleted rows, the number of deleted rows
+         * before each row (and at the end). Empty for other segments.
+         */
+        std::vector<std::vector<uint16_t>> deletedBefore;
+    };
+
+    /**
+     * Clean up after a checkpoint that was interrupted by a crash, leaving
+     * just the log that matches the file. This method must be called
+     * before a table is loaded.
+     *
+     * @param path The path to the table's file.
+     */
+    static void recover(const std::string& path);
+
+    /**
+     * Open (or create) the log for a table.
+     *
+     * @param filePath The path to the table's file. The log is
+     * "<filePath>.wal".
+     *
+     * @exception std::runtime_error This constructor throws an exception
+     * if the log could not be opened.
+     */
+    explicit WriteAheadLog(const std::string& filePath);
+
+    /** The destructor closes the log. */
+    ~WriteAheadLog();
+
+    /**
+     * Apply the changes in the log to a table that was just loaded from
+     * the file. A partially written change at the end of the log (from a
+     * crash) is discarded. Segments loaded from a snapshot need not be
+     * full, so the positions of rows in the file are counted using a
+     * RowMap of the store as loaded.
+     *
+     * @param store The rows loaded from the file.
+     *
+     * @return The number of changes applied.
+     */
+    size_t replay(ColumnStore& store);
+
+    /**
+     * Add the change of a value to the log. The caller must hold the lock
+     * on the row's segment. The change is not durable until commit() is
+     * called.
+     *
+     * @param segIdx The index of the row's segment.
+     *
+     * @param row The row within the segment.
+     *
+     * @param colIdx The column that changed.
+     *
+     * @param value The new value.
+     */
+    void logUpdate(const size_t segIdx, const size_t row, const int colIdx,
+                   std::string_view value);
+
+    /**
+     * Add the deletion of a row to the log. The caller must hold the lock
+     * on the row's segment.
+     *
+     * @param segIdx The index of the row's segment.
+     *
+     * @param row The row within the segment.
+     */
+    void logDelete(const size_t segIdx, const size_t row);
+
+    /**
+     * Wait until all the changes logged so far are on disk. The first
+     * thread to call this method writes out the changes of all the threads
+     * waiting, so that one fdatasync covers many statements. This method
+     * must not be called while holding a segment's lock.
+     *
+     * @exception std::runtime_error This method throws an exception if the
+     * log could not be written.
+     */
+    void commit();
+
+    /**
+     * Obtain the path to the table's file.
+     *
+     * @return The path to the file whose changes are in this log.
+     */
+    const std::string& getFilePath() const { return filePath; }
+
+    /**
+     * Check if the log is large enough to be folded into the file.
+     *
+     * @return This method returns true if a checkpoint is due.
+     */
+    bool needsCheckpoint();
+
+    /**
+     * Start a checkpoint. Changes made from now on are also logged to
+     * "<file>.wal.next", with positions in the file being written. The
+     * file "<file>.tmp" must exist (even if empty) before this method is
+     * called. The caller must ensure no rows change during this call.
+     *
+     * @param map The rows in the file being written.
+     */
+    void beginCheckpoint(const RowMap& map);
+
+    /**
+     * Finish a checkpoint after "<file>.tmp" has been renamed over the
+     * file: the next log becomes the log.
+     */
+    void endCheckpoint();
+
+    /**
+     * Abandon a checkpoint that failed before the file was renamed.
+     */
+    void abortCheckpoint();
+
+    /**
+     * Obtain the mutex that callers use to run one checkpoint at a time.
+     *
+     * @return The mutex for checkpoints of this table.
+     */
+    std::mutex& getCheckpointMutex() { return checkpointMutex; }
+
+private:
+    /** The kinds of changes in the log */
+    enum RecordType : uint8_t { Update = 1, Delete = 2 };
+
+    /**
+     * Add a change to the pending changes for the log (and the next log,
+     * during a checkpoint).
+     */
+    void append(const RecordType type, const size_t segIdx,
+                    const size_t row, const int colIdx,
+                    std::string_view value);
+
+    /**
+     * Write out the pending changes and wait for them to be on disk. The
+     * caller must hold mutex, and no other flush may be in progress.
+     *
+     * @param lock The lock on mutex, which is released while writing.
+     */
+    void flush(std::unique_lock<std::mutex>& lock);
+
+    /** The path to the table's file. */
+    const std::string filePath;
+
+    /** The path to the log. */
+    const std::string logPath;
+
+    /** The file descriptor of the log. */
+    int fd = -1;
+
+    /** The file descriptor of the next log during a checkpoint, or -1. */
+    int nextFd = -1;
+
+    /** The positions in the file of the rows in memory. */
+    RowMap map;
+
+    /** The positions of the rows in the file being written by the
+     * checkpoint in progress (if any).
+     */
+    RowMap nextMap;
+
+    /** The changes not yet written to the log. */
+    std::string pending;
+
+    /** The changes not yet written to the next log. */
+    std::string nextPending;
+
+    /** The sequence number of the most recent change. */
+    uint64_t lastSeqNum = 0;
+
+    /** The sequence number up to which changes are on disk. */
+    uint64_t durableSeqNum = 0;
+
+    /** Flag to indicate a thread is writing out changes. */
+    bool flushing = false;
+
+    /** The number of bytes in the log. */
+    size_t logSize = 0;
+
+    /** The number of bytes in the next log. */
+    size_t nextLogSize = 0;
+
+    /** The mutex that guards all the state above. */
+    std::mutex mutex;
+
+    /** Used to wait for changes to be on disk. */
+    std::condition_variable flushed;
+
+    /** See getCheckpointMutex. */
+    std::mutex checkpointMutex;
+};
+
+#endif /* WRITE_AHEAD_LOG_H */
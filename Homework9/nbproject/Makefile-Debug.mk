@@ -35,7 +35,24 @@ OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 
 # Object Files
 OBJECTFILES= \
+	${OBJECTDIR}/Aggregation.o \
+	${OBJECTDIR}/AsyncServer.o \
+	${OBJECTDIR}/ColumnStore.o \
+	${OBJECTDIR}/HashIndex.o \
+	${OBJECTDIR}/HashJoin.o \
+	${OBJECTDIR}/MappedFile.o \
+	${OBJECTDIR}/Range.o \
+	${OBJECTDIR}/ResponseBuffer.o \
 	${OBJECTDIR}/SQLAir.o \
+	${OBJECTDIR}/ScanPool.o \
+	${OBJECTDIR}/Snapshot.o \
+	${OBJECTDIR}/SortedIndex.o \
+	${OBJECTDIR}/StatementCache.o \
+	${OBJECTDIR}/StrSearch.o \
+	${OBJECTDIR}/TopK.o \
+	${OBJECTDIR}/TrigramIndex.o \
+	${OBJECTDIR}/WaitRegistry.o \
+	${OBJECTDIR}/WriteAheadLog.o \
 	${OBJECTDIR}/main.o
 
 
@@ -64,15 +81,100 @@ Homework9: libsqlair_lib.a
 Homework9: ${OBJECTFILES}
 	${LINK.cc} -o Homework9 ${OBJECTFILES} ${LDLIBSOPTIONS} -lboost_system -lpthread -lmysqlpp
 
+${OBJECTDIR}/Aggregation.o: Aggregation.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/Aggregation.o Aggregation.cpp
+
+${OBJECTDIR}/AsyncServer.o: AsyncServer.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/AsyncServer.o AsyncServer.cpp
+
+${OBJECTDIR}/ColumnStore.o: ColumnStore.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/ColumnStore.o ColumnStore.cpp
+
+${OBJECTDIR}/HashIndex.o: HashIndex.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/HashIndex.o HashIndex.cpp
+
+${OBJECTDIR}/HashJoin.o: HashJoin.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/HashJoin.o HashJoin.cpp
+
+${OBJECTDIR}/MappedFile.o: MappedFile.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/MappedFile.o MappedFile.cpp
+
+${OBJECTDIR}/Range.o: Range.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/Range.o Range.cpp
+
+${OBJECTDIR}/ResponseBuffer.o: ResponseBuffer.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/ResponseBuffer.o ResponseBuffer.cpp
+
 ${OBJECTDIR}/SQLAir.o: SQLAir.cpp
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.cc) -g -Wall -std=c++14 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SQLAir.o SQLAir.cpp
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SQLAir.o SQLAir.cpp
+
+${OBJECTDIR}/ScanPool.o: ScanPool.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/ScanPool.o ScanPool.cpp
+
+${OBJECTDIR}/Snapshot.o: Snapshot.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/Snapshot.o Snapshot.cpp
+
+${OBJECTDIR}/SortedIndex.o: SortedIndex.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/SortedIndex.o SortedIndex.cpp
+
+${OBJECTDIR}/StatementCache.o: StatementCache.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/StatementCache.o StatementCache.cpp
+
+${OBJECTDIR}/StrSearch.o: StrSearch.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/StrSearch.o StrSearch.cpp
+
+${OBJECTDIR}/TopK.o: TopK.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/TopK.o TopK.cpp
+
+${OBJECTDIR}/TrigramIndex.o: TrigramIndex.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/TrigramIndex.o TrigramIndex.cpp
+
+${OBJECTDIR}/WaitRegistry.o: WaitRegistry.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/WaitRegistry.o WaitRegistry.cpp
+
+${OBJECTDIR}/WriteAheadLog.o: WriteAheadLog.cpp
+	${MKDIR} -p ${OBJECTDIR}
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/WriteAheadLog.o WriteAheadLog.cpp
 
 ${OBJECTDIR}/main.o: main.cpp
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.cc) -g -Wall -std=c++14 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.cpp
+	$(COMPILE.cc) -g -Wall -std=c++17 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.cpp
 
 # Subprojects
 .build-subprojects: